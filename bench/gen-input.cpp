@@ -0,0 +1,40 @@
+/* gen-input.cpp - Write a benchmark input
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Writes the input suite-bench generates for GRAMMAR (json, expr,
+   csv, sql or ini) to standard output, for suite-bench --input,
+   grako-bench.py or other parsers.  The input is streamed, so SIZE
+   (with a suffix K, M or G) can be larger than the memory.
+
+   Usage: gen-input GRAMMAR SIZE [SEED]  */
+
+#include <cstdlib>
+#include <iostream>
+
+#include "inputs.hpp"
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3 || argc > 4)
+    {
+      std::cerr << "Usage: gen-input GRAMMAR SIZE [SEED]\n";
+      return 2;
+    }
+  std::ios_base::sync_with_stdio(false);
+
+  std::unique_ptr<InputGenerator> gen = make_input_generator(argv[1]);
+  if (! gen)
+    {
+      std::cerr << "ERROR: unknown grammar " << argv[1] << "\n";
+      return 2;
+    }
+  uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1;
+  gen->generate(std::cout, parse_size(argv[2]), seed);
+  return std::cout ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#!/usr/bin/env python
+# bench/grako-bench.py - Grako benchmark for comparison -*- coding: utf-8 -*-
+# Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+# Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+#
+# This file is part of Grako++.  Grako++ is free software; you can
+# redistribute it and/or modify it under the terms of the 2-clause
+# BSD license, see file LICENSE.TXT.
+
+"""
+Parse the inputs of suite-bench with the benchmark grammars
+interpreted by Grako, and print the same JSON lines as suite-bench
+(without allocations and memo size), for example:
+
+    grako-bench.py --gen-input ./gen-input --size 1M json expr
+"""
+
+from __future__ import (absolute_import, division, print_function,
+                        unicode_literals)
+
+import argparse
+import codecs
+import json
+import os
+import resource
+import subprocess
+import time
+
+import grako
+
+# The tokenizer settings of bench/CMakeLists.txt.
+GRAMMARS = {
+    'json': ('\t\n\r ', True),
+    'expr': ('\t\n\r ', True),
+    'sql': ('\t\n\r ', True),
+    'csv': ('', False),
+    'ini': ('\t ', True),
+}
+
+
+def main():
+    argparser = argparse.ArgumentParser(description=__doc__)
+    argparser.add_argument('--gen-input', default='./gen-input',
+                           help='the gen-input program')
+    argparser.add_argument('--size', default='1M')
+    argparser.add_argument('--rounds', type=int, default=1)
+    argparser.add_argument('grammars', nargs='*',
+                           default=sorted(GRAMMARS.keys()))
+    args = argparser.parse_args()
+
+    srcdir = os.path.dirname(os.path.abspath(__file__))
+    for name in args.grammars:
+        whitespace, nameguard = GRAMMARS[name]
+        filename = os.path.join(srcdir, name + '.peg')
+        grammar = codecs.open(filename, 'r', encoding='utf-8').read()
+        model = grako.genmodel(name, grammar, filename=filename)
+        text = subprocess.check_output([args.gen_input, name, args.size])
+        text = text.decode('utf-8')
+
+        start = time.time()
+        for _ in range(args.rounds):
+            model.parse(text, start='start', whitespace=whitespace,
+                        nameguard=nameguard)
+        elapsed = time.time() - start
+
+        print(json.dumps({
+            'grammar': name,
+            'parser': 'grako',
+            'bytes': len(text),
+            'rounds': args.rounds,
+            'seconds': elapsed,
+            'mb_per_s': len(text) * args.rounds / elapsed / 1e6,
+            'peak_rss_kb': resource.getrusage(resource.RUSAGE_SELF).ru_maxrss,
+        }, sort_keys=True))
+
+if __name__ == '__main__':
+    main()
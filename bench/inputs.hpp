@@ -0,0 +1,423 @@
+/* inputs.hpp - Grako++ benchmark input generators
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Random, but reproducible, inputs for the benchmark grammars in
+   this directory.  An input is a header, records and a footer, and
+   grows record by record until it has the requested size, so that
+   inputs from a few KB to many GB can be streamed.  */
+
+#ifndef _BENCH_INPUTS_HPP
+#define _BENCH_INPUTS_HPP 1
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+class InputGenerator
+{
+public:
+  using rng_t = std::mt19937_64;
+
+  virtual ~InputGenerator() {}
+
+  virtual std::string header() { return ""; }
+  /* The separator is written between records.  */
+  virtual std::string separator() { return ""; }
+  virtual std::string footer() { return ""; }
+  virtual void record(rng_t& rng, size_t index, std::ostream& out) = 0;
+
+  /* Write a document of at least BYTES bytes to OUT, and return its
+     size.  */
+  size_t generate(std::ostream& out, size_t bytes, uint64_t seed=1)
+  {
+    rng_t rng(seed);
+    std::string head = header();
+    std::string sep = separator();
+    std::string foot = footer();
+    size_t size = head.size() + foot.size();
+    out << head;
+    for (size_t index = 0; index == 0 || size < bytes; index++)
+      {
+	std::ostringstream rec;
+	if (index)
+	  rec << sep;
+	record(rng, index, rec);
+	std::string str = rec.str();
+	out << str;
+	size += str.size();
+      }
+    out << foot;
+    return size;
+  }
+
+  std::string generate(size_t bytes, uint64_t seed=1)
+  {
+    std::ostringstream out;
+    generate(out, bytes, seed);
+    return out.str();
+  }
+
+protected:
+  static size_t pick(rng_t& rng, size_t count)
+  {
+    return rng() % count;
+  }
+
+  static std::string identifier(rng_t& rng)
+  {
+    static const char *words[] = {
+      "alpha", "beta", "gamma", "delta", "count", "total", "price",
+      "name", "value", "x", "y", "z", "item_id", "user2", "order_date"
+    };
+    std::string id = words[pick(rng, 15)];
+    if (pick(rng, 3) == 0)
+      id += std::to_string(pick(rng, 100));
+    return id;
+  }
+
+  static std::string number(rng_t& rng)
+  {
+    std::string num = std::to_string(pick(rng, 100000));
+    if (pick(rng, 2))
+      num += "." + std::to_string(pick(rng, 1000));
+    return num;
+  }
+
+  static std::string text(rng_t& rng, size_t words)
+  {
+    static const char *vocabulary[] = {
+      "lorem", "ipsum", "dolor", "sit", "amet", "parser", "grammar",
+      "packrat", "memo", "cut", "token", "rule"
+    };
+    std::string str;
+    for (size_t i = 0; i < words; i++)
+      {
+	if (i)
+	  str += ' ';
+	str += vocabulary[pick(rng, 12)];
+      }
+    return str;
+  }
+};
+
+
+/* Arrays of records with nested objects, arrays, escapes and all
+   kinds of numbers.  */
+class JsonInput : public InputGenerator
+{
+public:
+  std::string header() { return "[\n"; }
+  std::string separator() { return ",\n"; }
+  std::string footer() { return "\n]\n"; }
+
+  void record(rng_t& rng, size_t index, std::ostream& out)
+  {
+    out << "  { \"id\": " << index
+	<< ", \"name\": \"" << text(rng, 1 + pick(rng, 3)) << "\""
+	<< ", \"note\": \"line\\n\\\"quoted\\\" \\u00e9\""
+	<< ", \"price\": " << number(rng)
+	<< ", \"ratio\": -" << pick(rng, 10) << "." << pick(rng, 100) << "e-" << pick(rng, 10)
+	<< ", \"active\": " << (pick(rng, 2) ? "true" : "false")
+	<< ", \"parent\": null, \"tags\": ";
+    value(rng, 3, out);
+    out << " }";
+  }
+
+private:
+  void value(rng_t& rng, int depth, std::ostream& out)
+  {
+    size_t kind = depth > 0 ? pick(rng, 5) : pick(rng, 3);
+    if (kind == 0)
+      out << "\"" << text(rng, 1) << "\"";
+    else if (kind == 1)
+      out << number(rng);
+    else if (kind == 2)
+      out << (pick(rng, 2) ? "true" : "null");
+    else if (kind == 3)
+      {
+	out << "[";
+	size_t count = pick(rng, 5);
+	for (size_t i = 0; i < count; i++)
+	  {
+	    out << (i ? ", " : "");
+	    value(rng, depth - 1, out);
+	  }
+	out << "]";
+      }
+    else
+      {
+	out << "{";
+	size_t count = pick(rng, 4);
+	for (size_t i = 0; i < count; i++)
+	  {
+	    out << (i ? ", " : "") << "\"" << identifier(rng) << "\": ";
+	    value(rng, depth - 1, out);
+	  }
+	out << "}";
+      }
+  }
+};
+
+
+/* Assignments of nested arithmetic expressions with calls.  */
+class ExprInput : public InputGenerator
+{
+public:
+  std::string separator() { return "\n"; }
+  std::string footer() { return "\n"; }
+
+  void record(rng_t& rng, size_t, std::ostream& out)
+  {
+    out << identifier(rng) << " = ";
+    expression(rng, 4, out);
+    out << ";";
+  }
+
+private:
+  void expression(rng_t& rng, int depth, std::ostream& out)
+  {
+    static const char *ops[] = { " + ", " - ", " * ", " / ", " % " };
+    size_t terms = 1 + pick(rng, 4);
+    for (size_t i = 0; i < terms; i++)
+      {
+	if (i)
+	  out << ops[pick(rng, 5)];
+	size_t kind = depth > 0 ? pick(rng, 5) : pick(rng, 2);
+	if (kind == 0)
+	  out << identifier(rng);
+	else if (kind == 1)
+	  out << number(rng);
+	else if (kind == 2)
+	  {
+	    out << identifier(rng) << "(";
+	    size_t args = pick(rng, 4);
+	    for (size_t j = 0; j < args; j++)
+	      {
+		out << (j ? ", " : "");
+		expression(rng, depth - 1, out);
+	      }
+	    out << ")";
+	  }
+	else
+	  {
+	    out << "(";
+	    expression(rng, depth - 1, out);
+	    out << ")";
+	  }
+      }
+  }
+};
+
+
+/* Rows with plain, empty and quoted fields (with commas, quotes and
+   line ends in them).  */
+class CsvInput : public InputGenerator
+{
+public:
+  std::string header() { return "id,name,price,comment,empty,date\r\n"; }
+
+  void record(rng_t& rng, size_t index, std::ostream& out)
+  {
+    out << index << "," << text(rng, 1 + pick(rng, 2)) << "," << number(rng) << ",";
+    size_t kind = pick(rng, 3);
+    if (kind == 0)
+      out << "\"" << text(rng, 3) << ", \"\"quoted\"\"\"";
+    else if (kind == 1)
+      out << "\"multi\nline\"";
+    else
+      out << text(rng, 4);
+    out << ",,2014-" << 1 + pick(rng, 12) << "-" << 1 + pick(rng, 28) << "\r\n";
+  }
+};
+
+
+/* SELECT, INSERT, UPDATE and DELETE statements with conditions.  */
+class SqlInput : public InputGenerator
+{
+public:
+  std::string separator() { return "\n"; }
+  std::string footer() { return "\n"; }
+
+  void record(rng_t& rng, size_t, std::ostream& out)
+  {
+    size_t kind = pick(rng, 4);
+    if (kind == 0)
+      {
+	out << "SELECT ";
+	if (pick(rng, 4) == 0)
+	  out << "*";
+	else
+	  expressions(rng, 1 + pick(rng, 4), out);
+	out << " FROM " << identifier(rng);
+	if (pick(rng, 2))
+	  where(rng, out);
+	if (pick(rng, 3) == 0)
+	  out << " ORDER BY " << identifier(rng) << ", " << identifier(rng);
+      }
+    else if (kind == 1)
+      {
+	size_t count = 1 + pick(rng, 5);
+	out << "INSERT INTO " << identifier(rng) << " (";
+	for (size_t i = 0; i < count; i++)
+	  out << (i ? ", " : "") << identifier(rng);
+	out << ") VALUES (";
+	expressions(rng, count, out);
+	out << ")";
+      }
+    else if (kind == 2)
+      {
+	out << "UPDATE " << identifier(rng) << " SET ";
+	size_t count = 1 + pick(rng, 3);
+	for (size_t i = 0; i < count; i++)
+	  {
+	    out << (i ? ", " : "") << identifier(rng) << " = ";
+	    expression(rng, 2, out);
+	  }
+	where(rng, out);
+      }
+    else
+      {
+	out << "DELETE FROM " << identifier(rng);
+	where(rng, out);
+      }
+    out << ";";
+  }
+
+private:
+  void where(rng_t& rng, std::ostream& out)
+  {
+    static const char *compare[] = { " = ", " <> ", " < ", " <= ", " > ", " >= " };
+    out << " WHERE ";
+    size_t count = 1 + pick(rng, 3);
+    for (size_t i = 0; i < count; i++)
+      {
+	if (i)
+	  out << (pick(rng, 2) ? " AND " : " OR ");
+	expression(rng, 1, out);
+	if (pick(rng, 5) == 0)
+	  out << " LIKE '%" << text(rng, 1) << "%'";
+	else
+	  {
+	    out << compare[pick(rng, 6)];
+	    expression(rng, 1, out);
+	  }
+      }
+  }
+
+  void expressions(rng_t& rng, size_t count, std::ostream& out)
+  {
+    for (size_t i = 0; i < count; i++)
+      {
+	out << (i ? ", " : "");
+	expression(rng, 2, out);
+      }
+  }
+
+  void expression(rng_t& rng, int depth, std::ostream& out)
+  {
+    static const char *ops[] = { " + ", " - ", " * ", " / " };
+    size_t operands = 1 + pick(rng, 3);
+    for (size_t i = 0; i < operands; i++)
+      {
+	if (i)
+	  out << ops[pick(rng, 4)];
+	size_t kind = depth > 0 ? pick(rng, 4) : pick(rng, 3);
+	if (kind == 0)
+	  out << identifier(rng);
+	else if (kind == 1)
+	  out << number(rng);
+	else if (kind == 2)
+	  out << "'" << text(rng, 2) << " o''clock'";
+	else
+	  {
+	    out << "(";
+	    expression(rng, depth - 1, out);
+	    out << ")";
+	  }
+      }
+  }
+};
+
+
+/* Sections of key-value pairs, with comments and blank lines.  */
+class IniInput : public InputGenerator
+{
+public:
+  void record(rng_t& rng, size_t index, std::ostream& out)
+  {
+    out << "; section " << index << "\n[" << identifier(rng) << "." << index << "]\n";
+    size_t pairs = 1 + pick(rng, 8);
+    for (size_t i = 0; i < pairs; i++)
+      {
+	if (pick(rng, 6) == 0)
+	  out << "# " << text(rng, 4) << "\n";
+	out << (pick(rng, 2) ? "  " : "") << identifier(rng) << " = ";
+	if (pick(rng, 2))
+	  out << number(rng);
+	else
+	  out << text(rng, 1 + pick(rng, 5));
+	out << "\n";
+      }
+    out << "\n";
+  }
+};
+
+
+/* The generator for GRAMMAR, or a null pointer.  */
+static inline std::unique_ptr<InputGenerator> make_input_generator(const std::string& grammar)
+{
+  InputGenerator *gen = nullptr;
+  if (grammar == "json")
+    gen = new JsonInput();
+  else if (grammar == "expr")
+    gen = new ExprInput();
+  else if (grammar == "csv")
+    gen = new CsvInput();
+  else if (grammar == "sql")
+    gen = new SqlInput();
+  else if (grammar == "ini")
+    gen = new IniInput();
+  return std::unique_ptr<InputGenerator>(gen);
+}
+
+static inline const std::vector<std::string>& input_grammars()
+{
+  static const std::vector<std::string> grammars = {
+    "json", "expr", "csv", "sql", "ini"
+  };
+  return grammars;
+}
+
+/* Parse a size like 64K, 10M or 1G.  */
+static inline size_t parse_size(const std::string& str)
+{
+  size_t end;
+  size_t size = std::stoul(str, &end);
+  if (end < str.size())
+    switch (str[end])
+      {
+      case 'k':
+      case 'K':
+	return size << 10;
+      case 'm':
+      case 'M':
+	return size << 20;
+      case 'g':
+      case 'G':
+	return size << 30;
+      }
+  return size;
+}
+
+#endif /* _BENCH_INPUTS_HPP */
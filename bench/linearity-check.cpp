@@ -0,0 +1,264 @@
+/* linearity-check.cpp - Check that parsing time grows linearly
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* A packrat parser takes linear time, but Parser::_drop_memos throws
+   memos away at cuts, and memo budgets and unmemoized rules may parse
+   the same input again, so a grammar can still go super-linear.  This
+   parses generated inputs (see inputs.hpp) of the sizes N, 2N, 4N, ...
+   with each benchmark grammar, and compares the rule calls, memo
+   misses and time per input byte of the largest input with those of
+   the smallest.  If one of them grows by more than the tolerance, the
+   check fails and lists the rules whose calls per byte grew the
+   most.  The counts come from RuleProfiler, so this must be compiled
+   with -DGRAKOPP_PROFILE.
+
+   Usage: linearity-check [--size N] [--steps STEPS] [--rounds ROUNDS]
+			  [--tolerance FACTOR] [--time-tolerance FACTOR]
+			  [GRAMMAR...]
+
+   The defaults are 64K, 4 steps, the best time of 3 rounds and a
+   tolerance of 1.5 for the counts and 3 for the time, which is much
+   noisier.  */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+
+#ifndef GRAKOPP_PROFILE
+#error "linearity-check needs -DGRAKOPP_PROFILE"
+#endif
+
+#include "_json.hpp"
+#include "_expr.hpp"
+#include "_csv.hpp"
+#include "_sql.hpp"
+#include "_ini.hpp"
+
+#include "inputs.hpp"
+
+
+/* The measurements of one input size.  */
+class Step
+{
+public:
+  Step()
+    : _bytes(0), _calls(0), _misses(0), _seconds(0)
+  {
+  }
+
+  double per_byte(double value) const
+  {
+    return value / _bytes;
+  }
+
+  size_t _bytes;
+  uint64_t _calls;
+  uint64_t _misses;
+  double _seconds;
+  std::map<std::string, uint64_t> _rule_calls;
+};
+
+
+class Options
+{
+public:
+  Options()
+    : _size(64 << 10), _steps(4), _rounds(3), _tolerance(1.5),
+      _time_tolerance(3)
+  {
+  }
+
+  size_t _size;
+  size_t _steps;
+  size_t _rounds;
+  double _tolerance;
+  double _time_tolerance;
+};
+
+
+template <typename P>
+static bool measure(const std::string& grammar, const std::string& input,
+		    size_t rounds, Step& step)
+{
+  BufferPtr buffer = std::make_shared<Buffer>();
+  P parser;
+
+  step._bytes = input.size();
+  for (size_t i = 0; i < rounds; i++)
+    {
+      buffer->from_string(input);
+      parser.set_buffer(buffer);
+      parser.reset();
+      parser._profiler.clear();
+      auto start = std::chrono::steady_clock::now();
+      AstPtr ast = parser._start_();
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (ast->as_exception())
+	{
+	  std::cerr << "ERROR: " << grammar << ": the input does not parse\n";
+	  return false;
+	}
+      if (i == 0 || elapsed.count() < step._seconds)
+	step._seconds = elapsed.count();
+    }
+
+  /* The counts are the same in every round.  */
+  step._calls = 0;
+  step._misses = 0;
+  step._rule_calls.clear();
+  for (auto& entry: parser._profiler._rules)
+    {
+      step._calls += entry.second._calls;
+      step._misses += entry.second._memo_misses;
+      step._rule_calls[entry.first] = entry.second._calls;
+    }
+  return true;
+}
+
+
+static bool measure_grammar(const std::string& grammar, const std::string& input,
+			    size_t rounds, Step& step)
+{
+  if (grammar == "json")
+    return measure<jsonParser>(grammar, input, rounds, step);
+  else if (grammar == "expr")
+    return measure<exprParser>(grammar, input, rounds, step);
+  else if (grammar == "csv")
+    return measure<csvParser>(grammar, input, rounds, step);
+  else if (grammar == "sql")
+    return measure<sqlParser>(grammar, input, rounds, step);
+  else if (grammar == "ini")
+    return measure<iniParser>(grammar, input, rounds, step);
+  std::cerr << "ERROR: unknown grammar " << grammar << "\n";
+  return false;
+}
+
+
+/* The factor by which VALUE per byte grew from FIRST to LAST.  A
+   count that was zero counts as one, so that a rule that appears
+   only in the larger inputs is not a division by zero.  */
+static double growth(const Step& first, double first_value,
+		     const Step& last, double last_value)
+{
+  return last.per_byte(last_value) / first.per_byte(std::max(first_value, 1.0));
+}
+
+
+static bool check_grammar(const std::string& grammar, const Options& options)
+{
+  std::unique_ptr<InputGenerator> gen = make_input_generator(grammar);
+  if (! gen)
+    {
+      std::cerr << "ERROR: unknown grammar " << grammar << "\n";
+      return false;
+    }
+
+  std::vector<Step> steps(options._steps);
+  std::cout << grammar << ":\n"
+	    << std::setw(12) << "bytes" << std::setw(14) << "calls/byte"
+	    << std::setw(14) << "misses/byte" << std::setw(14) << "ns/byte" << "\n";
+  for (size_t i = 0; i < steps.size(); i++)
+    {
+      Step& step = steps[i];
+      if (! measure_grammar(grammar, gen->generate(options._size << i),
+			    options._rounds, step))
+	return false;
+      std::cout << std::setw(12) << step._bytes << std::fixed << std::setprecision(3)
+		<< std::setw(14) << step.per_byte(step._calls)
+		<< std::setw(14) << step.per_byte(step._misses)
+		<< std::setw(14) << step.per_byte(step._seconds * 1e9) << "\n";
+    }
+
+  const Step& first = steps.front();
+  const Step& last = steps.back();
+  double calls = growth(first, first._calls, last, last._calls);
+  double misses = growth(first, first._misses, last, last._misses);
+  double seconds = last.per_byte(last._seconds) / first.per_byte(first._seconds);
+  std::cout << "  growth per byte: calls " << calls << ", misses " << misses
+	    << ", time " << seconds << "\n";
+
+  bool ok = true;
+  if (calls > options._tolerance || misses > options._tolerance)
+    {
+      std::cout << "  FAIL: rule calls or memo misses grow faster than the input\n";
+      ok = false;
+    }
+  if (seconds > options._time_tolerance)
+    {
+      std::cout << "  FAIL: time grows faster than the input\n";
+      ok = false;
+    }
+
+  if (! ok)
+    {
+      /* Blame the rules whose calls per byte grew the most.  */
+      std::vector<std::pair<double, std::string> > rules;
+      for (auto& entry: last._rule_calls)
+	{
+	  auto el = first._rule_calls.find(entry.first);
+	  uint64_t first_calls = el == first._rule_calls.end() ? 0 : el->second;
+	  rules.push_back(std::make_pair(growth(first, first_calls, last, entry.second),
+					 entry.first));
+	}
+      std::sort(rules.rbegin(), rules.rend());
+      for (size_t i = 0; i < rules.size() && i < 5; i++)
+	if (rules[i].first > options._tolerance)
+	  std::cout << "    rule " << rules[i].second << ": calls per byte grew by "
+		    << rules[i].first << "\n";
+    }
+  return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+  std::list<std::string> args(argv + 1, argv + argc);
+  Options options;
+
+  while (args.size() > 0 && args.front().compare(0, 2, "--") == 0)
+    {
+      std::string option = args.front();
+      args.pop_front();
+      if (args.empty())
+	{
+	  std::cerr << "ERROR: missing argument for " << option << "\n";
+	  return 2;
+	}
+      if (option == "--size")
+	options._size = parse_size(args.front());
+      else if (option == "--steps")
+	options._steps = std::max<size_t>(std::stoul(args.front()), 2);
+      else if (option == "--rounds")
+	options._rounds = std::max<size_t>(std::stoul(args.front()), 1);
+      else if (option == "--tolerance")
+	options._tolerance = std::stod(args.front());
+      else if (option == "--time-tolerance")
+	options._time_tolerance = std::stod(args.front());
+      else
+	{
+	  std::cerr << "ERROR: unknown option " << option << "\n";
+	  return 2;
+	}
+      args.pop_front();
+    }
+
+  std::list<std::string> grammars(args);
+  if (grammars.empty())
+    grammars.assign(input_grammars().begin(), input_grammars().end());
+
+  int result = 0;
+  for (const std::string& grammar: grammars)
+    if (! check_grammar(grammar, options))
+      result = 1;
+  return result;
+}
@@ -0,0 +1,385 @@
+/* micro-bench.cpp - Grako++ microbenchmarks of the runtime primitives
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Measures the hot primitives of the runtime on their own, so that
+   an optimization of one of them can be checked without the noise of
+   a whole parse: the tokenizer of Buffer, the memoization and cut of
+   Parser, Ast::add and the AST readers and writers of ast-io.hpp and
+   ast-binary.hpp.  This
+   uses Google Benchmark, so the usual options apply, for example:
+
+   Usage: micro-bench --benchmark_filter=Memo  */
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <grakopp/grakopp.hpp>
+#include <grakopp/ast-io.hpp>
+#include <grakopp/ast-binary.hpp>
+
+
+using BenchParser = Parser<>;
+
+
+/* Buffer.  */
+
+/* Skip ARG whitespace characters before a token.  */
+static void BM_NextToken(benchmark::State& state)
+{
+  Buffer buffer;
+  buffer.from_string(std::string(state.range(0), ' ') + "token");
+  buffer._whitespace = " \t\r\n";
+  for (auto _ : state)
+    {
+      buffer._pos = 0;
+      buffer.next_token();
+      benchmark::DoNotOptimize(buffer._pos);
+    }
+}
+BENCHMARK(BM_NextToken)->Arg(0)->Arg(1)->Arg(16)->Arg(256);
+
+/* Match a keyword, with the nameguard if ARG is 1.  */
+static void BM_Match(benchmark::State& state)
+{
+  Buffer buffer;
+  buffer.from_string("select * from table");
+  buffer._nameguard = state.range(0);
+  const std::string token("select");
+  for (auto _ : state)
+    {
+      buffer._pos = 0;
+      benchmark::DoNotOptimize(buffer.match(token));
+    }
+}
+BENCHMARK(BM_Match)->Arg(0)->Arg(1);
+
+/* Match a pattern that is already compiled.  */
+static void BM_MatchreHit(benchmark::State& state)
+{
+  Buffer buffer;
+  buffer.from_string("identifier_42 = 17");
+  const std::string pattern("[a-zA-Z_][a-zA-Z0-9_]*");
+  for (auto _ : state)
+    {
+      buffer._pos = 0;
+      benchmark::DoNotOptimize(buffer.matchre(pattern));
+    }
+}
+BENCHMARK(BM_MatchreHit);
+
+/* Match a new pattern each time, which compiles it first.  The
+   compiled patterns stay in the per-thread cache, so the number of
+   iterations is fixed.  */
+static void BM_MatchreMiss(benchmark::State& state)
+{
+  Buffer buffer;
+  buffer.from_string("identifier_42 = 17");
+  static size_t serial = 0;
+  for (auto _ : state)
+    {
+      state.PauseTiming();
+      std::string pattern = "[a-zA-Z_][a-zA-Z0-9_]*|x" + std::to_string(serial++);
+      buffer._pos = 0;
+      state.ResumeTiming();
+      benchmark::DoNotOptimize(buffer.matchre(pattern));
+    }
+}
+BENCHMARK(BM_MatchreMiss)->Iterations(20000);
+
+
+/* Parser.  */
+
+/* A parser over ARG characters, without whitespace, and a rule body
+   that consumes one character.  */
+class MemoBench
+{
+public:
+  MemoBench(size_t size)
+    : _name("rule")
+  {
+    BufferPtr buffer = std::make_shared<Buffer>();
+    buffer->from_string(std::string(size, 'x'));
+    _parser.set_whitespace("");
+    _parser.set_buffer(buffer);
+  }
+
+  AstPtr call(size_t pos)
+  {
+    _parser._buffer->_pos = pos;
+    return _parser._call(_name, nullptr, [this] ()
+      {
+	_parser._buffer->next();
+	return std::make_shared<Ast>();
+      });
+  }
+
+  void fill()
+  {
+    _parser.reset();
+    for (size_t pos = 0; pos < _parser._buffer->len(); pos++)
+      call(pos);
+  }
+
+  BenchParser _parser;
+  std::string _name;
+};
+
+/* Memoize the rule at all ARG positions.  */
+static void BM_MemoInsert(benchmark::State& state)
+{
+  MemoBench bench(state.range(0));
+  for (auto _ : state)
+    {
+      state.PauseTiming();
+      bench._parser.reset();
+      state.ResumeTiming();
+      for (size_t pos = 0; pos < size_t(state.range(0)); pos++)
+	benchmark::DoNotOptimize(bench.call(pos));
+    }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MemoInsert)->Range(64, 1 << 18);
+
+/* Look up the rule in a cache with ARG results.  */
+static void BM_MemoLookup(benchmark::State& state)
+{
+  MemoBench bench(state.range(0));
+  bench.fill();
+  size_t pos = 0;
+  for (auto _ : state)
+    {
+      benchmark::DoNotOptimize(bench.call(pos));
+      pos = (pos + 7919) % state.range(0);
+    }
+}
+BENCHMARK(BM_MemoLookup)->Range(64, 1 << 18);
+
+/* Cut at the end of a cache with ARG results, which drops them
+   all.  */
+static void BM_Cut(benchmark::State& state)
+{
+  MemoBench bench(state.range(0));
+  for (auto _ : state)
+    {
+      state.PauseTiming();
+      bench.fill();
+      state.ResumeTiming();
+      benchmark::DoNotOptimize(bench._parser._cut());
+    }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Cut)->Range(64, 1 << 18);
+
+
+/* Ast.  */
+
+static AstPtr make_string(const std::string& str)
+{
+  return std::make_shared<Ast>(str);
+}
+
+static AstPtr make_list(size_t length, bool mergeable=false)
+{
+  AstPtr ast = std::make_shared<Ast>(AstList());
+  for (size_t i = 0; i < length; i++)
+    ast->the_list().push_back(make_string("el"));
+  ast->the_list()._mergeable = mergeable;
+  return ast;
+}
+
+static AstPtr make_map()
+{
+  AstPtr ast = std::make_shared<Ast>(AstMap({ { "key", AST_DEFAULT },
+					       { "other", AST_DEFAULT } }));
+  AstMap& map = *ast->as_map();
+  map["key"] = make_string("value");
+  map["other"] = make_string("value");
+  return ast;
+}
+
+/* The cases of AstAdder, selected by ARG.  */
+enum AddCase
+{
+  ADD_NONE, ADD_TO_NONE, ADD_TO_STRING, ADD_TO_LIST, ADD_MERGEABLE,
+  ADD_MAP_TO_MAP, ADD_EXCEPTION
+};
+
+static void BM_AstAdd(benchmark::State& state)
+{
+  AddCase add_case = AddCase(state.range(0));
+  AstPtr addend;
+  switch (add_case)
+    {
+    case ADD_NONE:
+      addend = std::make_shared<Ast>();
+      break;
+    case ADD_MERGEABLE:
+      addend = make_list(4, true);
+      break;
+    case ADD_MAP_TO_MAP:
+      addend = make_map();
+      break;
+    case ADD_EXCEPTION:
+      addend = std::make_shared<Ast>(AstException(std::make_shared<FailedParse>("fail")));
+      break;
+    default:
+      addend = make_string("addend");
+    }
+
+  /* Pausing the timer for each addition would cost more than the
+     addition, so the augends are made in batches.  */
+  std::vector<AstPtr> augends(1024);
+  while (state.KeepRunningBatch(augends.size()))
+    {
+      state.PauseTiming();
+      for (AstPtr& augend: augends)
+	switch (add_case)
+	  {
+	  case ADD_NONE:
+	  case ADD_TO_NONE:
+	    augend = std::make_shared<Ast>();
+	    break;
+	  case ADD_TO_STRING:
+	    augend = make_string("augend");
+	    break;
+	  case ADD_MAP_TO_MAP:
+	    augend = make_map();
+	    break;
+	  default:
+	    augend = make_list(4);
+	  }
+      state.ResumeTiming();
+      for (AstPtr& augend: augends)
+	augend->add(addend);
+      benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_AstAdd)->DenseRange(ADD_NONE, ADD_EXCEPTION);
+
+
+/* ast-io.  */
+
+/* A list of ARG maps like the records of a JSON document.  */
+static AstPtr make_document(size_t records)
+{
+  AstPtr doc = std::make_shared<Ast>(AstList());
+  for (size_t i = 0; i < records; i++)
+    {
+      AstPtr record = std::make_shared<Ast>
+	(AstMap({ { "id", AST_DEFAULT }, { "name", AST_DEFAULT },
+		  { "tags", AST_FORCELIST }, { "parent", AST_DEFAULT } }));
+      AstMap& map = *record->as_map();
+      map["id"] = make_string(std::to_string(i));
+      map["name"] = make_string("item \"" + std::to_string(i) + "\"\n");
+      map["tags"] = make_list(i % 8);
+      map["parent"] = std::make_shared<Ast>();
+      doc->the_list().push_back(record);
+    }
+  return doc;
+}
+
+static void BM_AstDump(benchmark::State& state)
+{
+  AstPtr doc = make_document(state.range(0));
+  size_t bytes = 0;
+  for (auto _ : state)
+    {
+      std::ostringstream out;
+      out << *doc;
+      bytes += out.str().size();
+    }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_AstDump)->Range(8, 1 << 12);
+
+static void BM_AstLoad(benchmark::State& state)
+{
+  std::ostringstream out;
+  out << *make_document(state.range(0));
+  const std::string text = out.str();
+  for (auto _ : state)
+    {
+      std::istringstream in(text);
+      AstPtr ast = std::make_shared<Ast>();
+      in >> ast;
+      benchmark::DoNotOptimize(ast);
+    }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_AstLoad)->Range(8, 1 << 12);
+
+/* Like BM_AstLoad, but straight from the buffer, as read_json_file
+   does.  */
+static void BM_AstRead(benchmark::State& state)
+{
+  std::ostringstream out;
+  out << *make_document(state.range(0));
+  const std::string text = out.str();
+  for (auto _ : state)
+    {
+      AstJsonReader reader(text.data(), text.size());
+      benchmark::DoNotOptimize(reader.read());
+    }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_AstRead)->Range(8, 1 << 12);
+
+static void BM_BinaryWrite(benchmark::State& state)
+{
+  AstPtr doc = make_document(state.range(0));
+  AstBinaryWriter writer;
+  size_t bytes = 0;
+  for (auto _ : state)
+    bytes += writer.write(*doc).size();
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_BinaryWrite)->Range(8, 1 << 12);
+
+static void BM_BinaryLoad(benchmark::State& state)
+{
+  AstBinaryWriter writer;
+  const std::string data = writer.write(*make_document(state.range(0)));
+  for (auto _ : state)
+    {
+      AstBinary binary(data.data(), data.size());
+      benchmark::DoNotOptimize(binary.load());
+    }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_BinaryLoad)->Range(8, 1 << 12);
+
+/* Visit every record in place, without building the AST.  */
+static void BM_BinaryWalk(benchmark::State& state)
+{
+  AstBinaryWriter writer;
+  const std::string data = writer.write(*make_document(state.range(0)));
+  const std::string name("name");
+  for (auto _ : state)
+    {
+      AstBinary binary(data.data(), data.size());
+      AstBinaryNode doc = binary.root();
+      size_t records = doc.size();
+      size_t length = 0;
+      for (size_t index = 0; index < records; index++)
+	{
+	  AstBinaryNode value;
+	  if (doc.at(index).find(name, value))
+	    length += value.string()._size;
+	}
+      benchmark::DoNotOptimize(length);
+    }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_BinaryWalk)->Range(8, 1 << 12);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,145 @@
+/* parse-bench.cpp - Grako++ single-threaded parser benchmark
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Parses one large JSON document repeatedly.  This is linked against
+   the output of each code generator backend (parse-bench and
+   parse-bench-flat), or runs the bytecode program PARSE_BENCH_VM
+   (parse-bench-vm), so that they can be compared.  With --recognize,
+   only the recognizer of the start rule is run, and with --events,
+   its event emitter, with a handler that ignores the events.  With
+   --compact-failures, failures are memoized in bitmaps (see
+   Parser::_compact_failures).
+
+   Usage: parse-bench [--recognize] [--events] [--compact-failures]
+		      [RECORDS [ROUNDS]]  */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#ifdef PARSE_BENCH_VM
+#include <grakopp/vm.hpp>
+#else
+#include "_json.hpp"
+#endif
+
+#include <grakopp/ast-io.hpp>
+
+
+static std::string make_document(size_t records)
+{
+  std::ostringstream doc;
+  doc << "[\n";
+  for (size_t seed = 0; seed < records; seed++)
+    {
+      doc << (seed ? ",\n" : "")
+	  << "  { \"id\": " << seed << ", \"name\": \"item " << seed << "\", \"tags\": [";
+      for (unsigned int i = 0; i < 1 + seed % 8; i++)
+	doc << (i ? ", " : "") << "\"t" << i << "\"";
+      doc << "], \"price\": " << seed % 1000 << "." << seed % 100
+	  << ", \"active\": " << (seed % 2 ? "true" : "false") << " }";
+    }
+  doc << "\n]\n";
+  return doc.str();
+}
+
+
+int main(int argc, char *argv[])
+{
+  bool recognize = false;
+  bool events = false;
+  bool compact_failures = false;
+  while (argc > 1 && !strncmp(argv[1], "--", 2))
+    {
+      if (!strcmp(argv[1], "--recognize"))
+	recognize = true;
+      else if (!strcmp(argv[1], "--events"))
+	events = true;
+      else if (!strcmp(argv[1], "--compact-failures"))
+	compact_failures = true;
+      else
+	{
+	  std::cerr << "ERROR: unknown option " << argv[1] << "\n";
+	  return 2;
+	}
+      argc--;
+      argv++;
+    }
+  size_t records = argc > 1 ? std::atol(argv[1]) : 10000;
+  size_t rounds = argc > 2 ? std::atol(argv[2]) : 10;
+
+  std::string doc = make_document(records);
+  BufferPtr buffer = std::make_shared<Buffer>();
+#ifdef PARSE_BENCH_VM
+  if (recognize || events)
+    {
+      std::cerr << "ERROR: the VM has no recognizer or event mode\n";
+      return 2;
+    }
+  std::shared_ptr<VmProgram> program = std::make_shared<VmProgram>();
+  program->load_file(PARSE_BENCH_VM);
+  VmParser parser(program);
+  size_t start_rule = program->find_rule("start");
+#else
+  jsonParser parser;
+  ParseEventHandler handler;
+  parser.set_event_handler(&handler);
+#endif
+  parser.set_compact_failures(compact_failures);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++)
+    {
+      buffer->from_string(doc);
+      parser.set_buffer(buffer);
+      parser.reset();
+#ifndef PARSE_BENCH_VM
+      if (recognize)
+	{
+	  if (! parser._start_(Recognize()))
+	    {
+	      std::cerr << "ERROR: not recognized at position " << parser._error_pos << "\n";
+	      return 1;
+	    }
+	  continue;
+	}
+      if (events)
+	{
+	  if (! parser._start_(EmitEvents()))
+	    {
+	      std::cerr << "ERROR: no match at position " << parser._error_pos << "\n";
+	      return 1;
+	    }
+	  continue;
+	}
+#endif
+#ifdef PARSE_BENCH_VM
+      AstPtr ast = parser.parse_rule(start_rule);
+#else
+      AstPtr ast = parser._start_();
+#endif
+      if (ast->as_exception())
+	{
+	  std::cerr << "ERROR: " << *ast << "\n";
+	  return 1;
+	}
+    }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  size_t bytes = doc.size() * rounds;
+  std::cout << "records " << records
+	    << " rounds " << rounds
+	    << " bytes " << bytes
+	    << " seconds " << elapsed.count()
+	    << " MB/s " << bytes / elapsed.count() / 1e6 << "\n";
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+/* pool-bench.cpp - Grako++ multi-threaded parser pool benchmark
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Parses many small JSON documents on all cores, with one parser per
+   document taken from a ParserPool.
+
+   Usage: pool-bench [DOCUMENTS [THREADS]]  */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <grakopp/pool.hpp>
+
+#include "_json.hpp"
+
+
+static std::string make_document(unsigned int seed)
+{
+  std::ostringstream doc;
+  doc << "{ \"id\": " << seed << ", \"name\": \"item " << seed << "\", \"tags\": [";
+  for (unsigned int i = 0; i < 1 + seed % 8; i++)
+    doc << (i ? ", " : "") << "\"t" << i << "\"";
+  doc << "], \"price\": " << seed % 1000 << "." << seed % 100
+      << ", \"active\": " << (seed % 2 ? "true" : "false") << " }";
+  return doc.str();
+}
+
+
+int main(int argc, char *argv[])
+{
+  size_t documents = argc > 1 ? std::atol(argv[1]) : 100000;
+  unsigned int threads = argc > 2 ? std::atoi(argv[2]) : std::thread::hardware_concurrency();
+  if (threads == 0)
+    threads = 1;
+
+  std::vector<std::string> docs;
+  size_t bytes = 0;
+  for (size_t i = 0; i < documents; i++)
+    {
+      docs.push_back(make_document(i));
+      bytes += docs.back().size();
+    }
+
+  ParserPool<jsonParser> pool;
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> failures(0);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < threads; i++)
+    workers.emplace_back([&] () {
+	size_t idx;
+	while ((idx = next++) < docs.size())
+	  {
+	    auto handle = pool.acquire();
+	    AstPtr ast = handle.parse_string(docs[idx])._start_();
+	    if (ast->as_exception())
+	      failures++;
+	  }
+      });
+  for (auto& worker: workers)
+    worker.join();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "threads " << threads
+	    << " documents " << documents
+	    << " failures " << failures
+	    << " bytes " << bytes
+	    << " seconds " << elapsed.count()
+	    << " MB/s " << bytes / elapsed.count() / 1e6
+	    << " parsers " << pool.size() << "\n";
+
+  return failures ? 1 : 0;
+}
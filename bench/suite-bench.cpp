@@ -0,0 +1,199 @@
+/* suite-bench.cpp - Grako++ benchmark suite
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Parses a generated input (see inputs.hpp) with each of the
+   benchmark grammars, and prints one JSON object per grammar with the
+   throughput, the allocations per round, the peak RSS of the process
+   so far and the size of the memoization caches after the parse.
+   grako-bench.py prints the same for the Python parsers generated by
+   Grako, so that the lines can be compared.
+
+   Usage: suite-bench [--size SIZE] [--rounds N] [--input FILE] [GRAMMAR...]
+
+   SIZE may have a suffix K, M or G (default 1M).  With --input, FILE
+   is parsed instead of a generated input (with a single GRAMMAR).  */
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <new>
+
+#include "_json.hpp"
+#include "_expr.hpp"
+#include "_csv.hpp"
+#include "_sql.hpp"
+#include "_ini.hpp"
+
+#include <grakopp/ast-io.hpp>
+
+#include "inputs.hpp"
+
+
+/* Count all allocations of the process.  */
+static std::atomic<size_t> allocations(0);
+static std::atomic<size_t> allocated_bytes(0);
+
+void* operator new(size_t size)
+{
+  allocations++;
+  allocated_bytes += size;
+  void *ptr = std::malloc(size ? size : 1);
+  if (! ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  std::free(ptr);
+}
+
+
+static long peak_rss_kb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+
+template <typename P>
+static bool run(const std::string& grammar, const std::string& input, size_t rounds)
+{
+  BufferPtr buffer = std::make_shared<Buffer>();
+  P parser;
+  size_t memo_entries = 0;
+  size_t failures = 0;
+
+  size_t start_allocations = allocations;
+  size_t start_bytes = allocated_bytes;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++)
+    {
+      buffer->from_string(input);
+      parser.set_buffer(buffer);
+      parser.reset();
+      AstPtr ast = parser._start_();
+      if (ast->as_exception())
+	{
+	  std::cerr << "ERROR: " << grammar << ": " << *ast << "\n";
+	  return false;
+	}
+      memo_entries = parser._memoization_cache.size();
+      failures = parser._failure_cache.size();
+    }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  double bytes = double(input.size()) * rounds;
+  std::cout << "{\"grammar\": \"" << grammar << "\""
+	    << ", \"parser\": \"grakopp\""
+	    << ", \"bytes\": " << input.size()
+	    << ", \"rounds\": " << rounds
+	    << ", \"seconds\": " << elapsed.count()
+	    << ", \"mb_per_s\": " << bytes / elapsed.count() / 1e6
+	    << ", \"allocations\": " << (allocations - start_allocations) / rounds
+	    << ", \"allocated_bytes\": " << (allocated_bytes - start_bytes) / rounds
+	    << ", \"peak_rss_kb\": " << peak_rss_kb()
+	    << ", \"memo_entries\": " << memo_entries + failures
+	    << "}" << std::endl;
+  return true;
+}
+
+
+static bool run_grammar(const std::string& grammar, const std::string& input, size_t rounds)
+{
+  if (grammar == "json")
+    return run<jsonParser>(grammar, input, rounds);
+  else if (grammar == "expr")
+    return run<exprParser>(grammar, input, rounds);
+  else if (grammar == "csv")
+    return run<csvParser>(grammar, input, rounds);
+  else if (grammar == "sql")
+    return run<sqlParser>(grammar, input, rounds);
+  else if (grammar == "ini")
+    return run<iniParser>(grammar, input, rounds);
+  std::cerr << "ERROR: unknown grammar " << grammar << "\n";
+  return false;
+}
+
+
+int main(int argc, char *argv[])
+{
+  std::list<std::string> args(argv + 1, argv + argc);
+  size_t size = 1 << 20;
+  size_t rounds = 3;
+  std::string input_file;
+
+  while (args.size() > 0 && args.front().compare(0, 2, "--") == 0)
+    {
+      std::string option = args.front();
+      args.pop_front();
+      if (args.empty())
+	{
+	  std::cerr << "ERROR: missing argument for " << option << "\n";
+	  return 2;
+	}
+      if (option == "--size")
+	size = parse_size(args.front());
+      else if (option == "--rounds")
+	rounds = std::stoul(args.front());
+      else if (option == "--input")
+	input_file = args.front();
+      else
+	{
+	  std::cerr << "ERROR: unknown option " << option << "\n";
+	  return 2;
+	}
+      args.pop_front();
+    }
+
+  std::list<std::string> grammars(args);
+  if (grammars.empty())
+    grammars.assign(input_grammars().begin(), input_grammars().end());
+  if (! input_file.empty() && grammars.size() != 1)
+    {
+      std::cerr << "ERROR: --input needs exactly one grammar\n";
+      return 2;
+    }
+
+  int result = 0;
+  for (const std::string& grammar: grammars)
+    {
+      std::string input;
+      if (! input_file.empty())
+	{
+	  Buffer buffer;
+	  buffer.from_file(input_file);
+	  input = buffer.text();
+	}
+      else
+	{
+	  std::unique_ptr<InputGenerator> gen = make_input_generator(grammar);
+	  if (! gen)
+	    {
+	      std::cerr << "ERROR: unknown grammar " << grammar << "\n";
+	      return 2;
+	    }
+	  input = gen->generate(size);
+	}
+      if (! run_grammar(grammar, input, rounds))
+	result = 1;
+    }
+  return result;
+}
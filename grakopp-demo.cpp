@@ -12,7 +12,7 @@ public:
   typedef AstPtr (MyParser::*rule_method_t) ();
   rule_method_t find_rule(const std::string& name)
   {
-    std::map<std::string, rule_method_t> map({
+    static const std::map<std::string, rule_method_t> map({
 	{ "rule_one", &MyParser::rule_one },
 	{ "rule_h1", &MyParser::rule_h1 },
 	{ "startrule", &MyParser::startrule }
@@ -0,0 +1,783 @@
+/* grakopp/ast-binary.hpp - Grako++ binary AST format header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_AST_BINARY_HPP
+#define _GRAKOPP_AST_BINARY_HPP 1
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.hpp"
+#include "ast-io.hpp"
+
+/* A compact binary format for ASTs, which can be used in place, for
+   example from a memory-mapped file, without building the AST.  All
+   numbers are 32 bit little-endian words, and all offsets are from the
+   start of the data.  The layout is:
+
+   header:  "GKAB", version, root reference, string table offset,
+	    number of strings, total size
+   nodes:   the nodes, each after its children
+   strings: (offset, length) for each string, then the strings, each
+	    followed by a NUL character
+
+   Equal strings are stored only once.  A reference to an AST is the
+   offset of its node (a multiple of 4), or 0 for a null pointer (or,
+   in a map, a key in _order without a value).  Strings and None, the
+   most common leaves, have no node if they have no flags: the
+   reference of a string is its index times 2 plus 1, and that of None
+   is AST_BINARY_REF_NONE.
+
+   A node starts with a word with the kind in the low byte and the
+   flags above it, followed by:
+
+   AST_BINARY_NONE:       nothing
+   AST_BINARY_STRING:     string index
+   AST_BINARY_LIST:       count, count references
+   AST_BINARY_MAP:        count, number in _order, count pairs of key
+			  string index and reference (the keys in
+			  _order come first, in order)
+   AST_BINARY_EXCEPTION:  type string index, initializer string index
+   AST_BINARY_EXTENSION:  tag string index, data string index
+
+   Because children come first, a reader can check that every node
+   reference is smaller than that of its parent, so a corrupt file can
+   not make it loop.  */
+
+enum
+{
+  AST_BINARY_VERSION = 1,
+  AST_BINARY_HEADER_SIZE = 24,
+  AST_BINARY_REF_NONE = 2
+};
+
+enum AstBinaryKind
+{
+  AST_BINARY_NONE = 0,
+  AST_BINARY_STRING = 1,
+  AST_BINARY_LIST = 2,
+  AST_BINARY_MAP = 3,
+  AST_BINARY_EXCEPTION = 4,
+  AST_BINARY_EXTENSION = 5
+};
+
+#define AST_BINARY_CUT 0x100
+#define AST_BINARY_MERGEABLE 0x200
+
+
+/* An extension read from the binary format without a loader for its
+   tag.  It keeps the tag and the data, so that it is written back
+   unchanged, and its output is that of the original extension if it
+   had no tag.  */
+class AstBinaryExtension : public AstExtensionType
+{
+public:
+  AstBinaryExtension(const std::string& tag, const std::string& data)
+    : _tag(tag), _data(data)
+  {
+  }
+
+  std::string _tag;
+  std::string _data;
+
+  virtual std::ostream& output (std::ostream& _cout) const
+  {
+    if (_tag.empty())
+      return _cout << _data;
+    return _cout << _tag << "(" << _data.size() << " bytes)";
+  }
+
+  virtual bool operator==(const AstExtensionType& ext) const
+  {
+    const AstBinaryExtension* other = dynamic_cast<const AstBinaryExtension*>(&ext);
+    return other && other->_tag == _tag && other->_data == _data;
+  }
+
+  virtual bool serialize(std::string& tag, std::string& data) const
+  {
+    if (_tag.empty())
+      return false;
+    tag = _tag;
+    data = _data;
+    return true;
+  }
+};
+
+
+/* Writes ASTs in the binary format.  Extensions are stored with the
+   tag and data from AstExtensionType::serialize, or else with their
+   output.  */
+class AstBinaryWriter
+{
+public:
+  /* Serialize AST.  The result is valid until the next call.  */
+  const std::string& write(const Ast& ast)
+  {
+    _out.assign(AST_BINARY_HEADER_SIZE, '\0');
+    _strings.clear();
+    _string_index.clear();
+    _owned.clear();
+
+    uint32_t root = write_ref(ast);
+    uint32_t strings = offset();
+    uint32_t data = strings + 8 * _strings.size();
+    for (const std::string* str: _strings)
+      {
+	put(data);
+	put(str->size());
+	data += str->size() + 1;
+      }
+    for (const std::string* str: _strings)
+      _out.append(str->data(), str->size() + 1);
+    offset();
+
+    _out.replace(0, 4, "GKAB");
+    set(4, AST_BINARY_VERSION);
+    set(8, root);
+    set(12, strings);
+    set(16, _strings.size());
+    set(20, _out.size());
+    return _out;
+  }
+
+  const std::string& str() const
+  {
+    return _out;
+  }
+
+private:
+  class StringHash
+  {
+  public:
+    size_t operator()(const std::string* str) const
+    {
+      return std::hash<std::string>()(*str);
+    }
+  };
+
+  class StringEqual
+  {
+  public:
+    bool operator()(const std::string* left, const std::string* right) const
+    {
+      return *left == *right;
+    }
+  };
+
+  std::string _out;
+  /* The strings in the order of their index.  They are not copied:
+     the pointers are into the AST that is written, or into _owned.  */
+  std::vector<const std::string*> _strings;
+  std::unordered_map<const std::string*, uint32_t, StringHash, StringEqual> _string_index;
+  std::deque<std::string> _owned;
+  /* The child offsets of the lists and maps being written.  */
+  std::vector<uint32_t> _children;
+
+  /* The current size, which must fit into an offset.  */
+  uint32_t offset() const
+  {
+    if (_out.size() > UINT32_MAX)
+      throw std::length_error("AST too large for the binary format");
+    return _out.size();
+  }
+
+  void put(uint32_t word)
+  {
+    char bytes[4] = { char(word), char(word >> 8), char(word >> 16), char(word >> 24) };
+    _out.append(bytes, 4);
+  }
+
+  void set(size_t pos, uint32_t word)
+  {
+    _out[pos] = char(word);
+    _out[pos + 1] = char(word >> 8);
+    _out[pos + 2] = char(word >> 16);
+    _out[pos + 3] = char(word >> 24);
+  }
+
+  /* STR must stay valid until the end of write.  */
+  uint32_t intern(const std::string& str)
+  {
+    auto result = _string_index.insert(std::make_pair(&str, _strings.size()));
+    if (result.second)
+      _strings.push_back(&str);
+    return result.first->second;
+  }
+
+  uint32_t intern_copy(const std::string& str)
+  {
+    auto el = _string_index.find(&str);
+    if (el != _string_index.end())
+      return el->second;
+    _owned.push_back(str);
+    return intern(_owned.back());
+  }
+
+  uint32_t write_child(const AstPtr& ast)
+  {
+    return ast ? write_ref(*ast) : 0;
+  }
+
+  /* Strings and None without flags need no node.  */
+  uint32_t write_ref(const Ast& ast)
+  {
+    if (! ast._cut)
+      {
+	if (const AstString* str = ast.as_string())
+	  return (intern(*str) << 1) | 1;
+	else if (ast.as_none())
+	  return AST_BINARY_REF_NONE;
+      }
+    return write_node(ast);
+  }
+
+  /* Write the node header, and the words of the children from START
+     on.  */
+  uint32_t finish(uint32_t head, size_t count, size_t start)
+  {
+    uint32_t node = offset();
+    put(head);
+    put(count);
+    for (size_t index = start; index < _children.size(); index++)
+      put(_children[index]);
+    _children.resize(start);
+    return node;
+  }
+
+  uint32_t write_node(const Ast& ast)
+  {
+    uint32_t flags = ast._cut ? AST_BINARY_CUT : 0;
+
+    if (const AstString* str = ast.as_string())
+      {
+	uint32_t index = intern(*str);
+	uint32_t node = offset();
+	put(AST_BINARY_STRING | flags);
+	put(index);
+	return node;
+      }
+    else if (const AstList* list = ast.as_list())
+      {
+	size_t start = _children.size();
+	for (const AstPtr& child: *list)
+	  {
+	    uint32_t offset = write_child(child);
+	    _children.push_back(offset);
+	  }
+	return finish(AST_BINARY_LIST | flags
+		      | (list->_mergeable ? AST_BINARY_MERGEABLE : 0),
+		      list->size(), start);
+      }
+    else if (const AstMap* map = ast.as_map())
+      {
+	/* The number in _order comes first.  */
+	size_t start = _children.size();
+	_children.push_back(map->_order.size());
+	size_t found = 0;
+	for (const std::string& key: map->_order)
+	  {
+	    auto el = map->find(key);
+	    uint32_t offset = 0;
+	    if (el != map->end())
+	      {
+		offset = write_child(el->second);
+		found++;
+	      }
+	    _children.push_back(intern(key));
+	    _children.push_back(offset);
+	  }
+	if (found != map->size() || map->_order.size() != map->size())
+	  {
+	    /* Keys that are not in _order.  */
+	    std::set<std::string> order(map->_order.begin(), map->_order.end());
+	    for (auto& entry: *map)
+	      if (order.find(entry.first) == order.end())
+		{
+		  uint32_t offset = write_child(entry.second);
+		  _children.push_back(intern(entry.first));
+		  _children.push_back(offset);
+		}
+	  }
+	return finish(AST_BINARY_MAP | flags, (_children.size() - start - 1) / 2, start);
+      }
+    else if (const AstException* exc = ast.as_exception())
+      {
+	uint32_t type = intern_copy(exc->_exc ? exc->_exc->type() : "");
+	uint32_t initializer = intern_copy(exc->_exc ? exc->_exc->initializer() : "");
+	uint32_t node = offset();
+	put(AST_BINARY_EXCEPTION | flags);
+	put(type);
+	put(initializer);
+	return node;
+      }
+    else if (const AstExtension* ext = ast.as_extension())
+      {
+	std::string tag;
+	std::string data;
+	if (*ext && ! (*ext)->serialize(tag, data))
+	  {
+	    tag.clear();
+	    data = (*ext)->output();
+	  }
+	uint32_t tag_index = intern_copy(tag);
+	uint32_t data_index = intern_copy(data);
+	uint32_t node = offset();
+	put(AST_BINARY_EXTENSION | flags);
+	put(tag_index);
+	put(data_index);
+	return node;
+      }
+
+    uint32_t node = offset();
+    put(AST_BINARY_NONE | flags);
+    return node;
+  }
+};
+
+
+/* A string in the binary format.  It is followed by a NUL character,
+   but may also contain some.  */
+class AstBinaryStringRef
+{
+public:
+  AstBinaryStringRef() : _data(""), _size(0) {}
+  AstBinaryStringRef(const char *data, size_t size) : _data(data), _size(size) {}
+
+  const char *_data;
+  size_t _size;
+
+  std::string str() const
+  {
+    return std::string(_data, _size);
+  }
+
+  bool operator==(const std::string& other) const
+  {
+    return other.size() == _size && !memcmp(other.data(), _data, _size);
+  }
+};
+
+
+class AstBinary;
+
+/* A node of an AST in the binary format, given by its reference.
+   Accessing a node of the wrong kind, an index out of range or a
+   corrupt node throws std::invalid_argument.  */
+class AstBinaryNode
+{
+public:
+  AstBinaryNode() : _binary(nullptr), _ref(AST_BINARY_REF_NONE) {}
+  AstBinaryNode(const AstBinary* binary, uint32_t ref)
+    : _binary(binary), _ref(ref)
+  {
+  }
+
+  const AstBinary* _binary;
+  uint32_t _ref;
+
+  inline AstBinaryKind kind() const;
+  inline bool cut() const;
+  inline bool mergeable() const;
+
+  /* AST_BINARY_STRING.  */
+  inline AstBinaryStringRef string() const;
+
+  /* AST_BINARY_LIST and AST_BINARY_MAP: the elements or entries.  */
+  inline size_t size() const;
+  /* AST_BINARY_LIST.  */
+  inline AstBinaryNode at(size_t index) const;
+  /* AST_BINARY_MAP: the entries, of which the first ordered() are in
+     _order.  An entry may have no value.  */
+  inline size_t ordered() const;
+  inline AstBinaryStringRef key(size_t index) const;
+  inline bool has_value(size_t index) const;
+  inline AstBinaryNode value(size_t index) const;
+  /* Find the value of KEY, or return false.  */
+  inline bool find(const std::string& key, AstBinaryNode& node) const;
+
+  /* AST_BINARY_EXCEPTION.  */
+  inline AstBinaryStringRef exception_type() const;
+  inline AstBinaryStringRef exception_initializer() const;
+
+  /* AST_BINARY_EXTENSION.  */
+  inline AstBinaryStringRef extension_tag() const;
+  inline AstBinaryStringRef extension_data() const;
+
+  /* Build the AST of this node.  */
+  inline AstPtr load() const;
+
+private:
+  bool is_inline() const
+  {
+    return (_ref & 3) != 0;
+  }
+
+  inline uint32_t word(size_t index) const;
+  inline void expect(AstBinaryKind expected) const;
+  inline AstBinaryNode child(uint32_t ref) const;
+  inline void check_index(size_t index) const;
+};
+
+
+/* An AST in the binary format in a buffer, which must stay valid as
+   long as this and its nodes are used.  The header is checked here,
+   everything else when it is accessed.  */
+class AstBinary
+{
+public:
+  using ExtensionLoader = std::function<AstExtension (const std::string& data)>;
+
+  AstBinary(const char *data, size_t size)
+    : _data(data), _size(size)
+  {
+    if (size < AST_BINARY_HEADER_SIZE || memcmp(data, "GKAB", 4))
+      throw std::invalid_argument("not a binary AST");
+    if (get(4) != AST_BINARY_VERSION)
+      throw std::invalid_argument("unsupported binary AST version "
+				  + std::to_string(get(4)));
+    _root = get(8);
+    _strings = get(12);
+    _string_count = get(16);
+    if (get(20) != size || _strings > size
+	|| _string_count > (size - _strings) / 8)
+      throw std::invalid_argument("truncated binary AST");
+    if ((_root & 3) == 0 && (_root < AST_BINARY_HEADER_SIZE || _root >= _strings))
+      throw std::invalid_argument("corrupt binary AST");
+  }
+
+  const char *_data;
+  size_t _size;
+  uint32_t _root;
+  uint32_t _strings;
+  uint32_t _string_count;
+
+  /* Loaders for the extensions with a tag.  */
+  std::map<std::string, ExtensionLoader> _extension_loaders;
+
+  void set_extension_loader(const std::string& tag, ExtensionLoader loader)
+  {
+    _extension_loaders[tag] = loader;
+  }
+
+  AstBinaryNode root() const
+  {
+    return AstBinaryNode(this, _root);
+  }
+
+  AstPtr load() const
+  {
+    return root().load();
+  }
+
+  /* The word at OFFSET, which must be in the nodes.  */
+  uint32_t node_word(size_t offset) const
+  {
+    if (offset < AST_BINARY_HEADER_SIZE || offset + 4 > _strings)
+      throw std::invalid_argument("corrupt binary AST");
+    return get(offset);
+  }
+
+  AstBinaryStringRef string(uint32_t index) const
+  {
+    if (index >= _string_count)
+      throw std::invalid_argument("corrupt binary AST");
+    uint32_t offset = get(_strings + 8 * index);
+    uint32_t length = get(_strings + 8 * index + 4);
+    if (offset > _size || length >= _size - offset)
+      throw std::invalid_argument("corrupt binary AST");
+    return AstBinaryStringRef(_data + offset, length);
+  }
+
+private:
+  /* Nodes read the words they checked with get.  */
+  friend class AstBinaryNode;
+
+  uint32_t get(size_t offset) const
+  {
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(_data + offset);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24);
+  }
+};
+
+
+uint32_t AstBinaryNode::word(size_t index) const
+{
+  if (is_inline())
+    throw std::invalid_argument("wrong kind of binary AST node");
+  return _binary->node_word(_ref + 4 * index);
+}
+
+void AstBinaryNode::expect(AstBinaryKind expected) const
+{
+  if (kind() != expected)
+    throw std::invalid_argument("wrong kind of binary AST node");
+}
+
+AstBinaryNode AstBinaryNode::child(uint32_t ref) const
+{
+  if ((ref & 3) == 0 ? ref >= _ref : ((ref & 1) == 0 && ref != AST_BINARY_REF_NONE))
+    throw std::invalid_argument("corrupt binary AST");
+  return AstBinaryNode(_binary, ref);
+}
+
+void AstBinaryNode::check_index(size_t index) const
+{
+  if (index >= size())
+    throw std::invalid_argument("index out of range");
+}
+
+AstBinaryKind AstBinaryNode::kind() const
+{
+  if (_ref & 1)
+    return AST_BINARY_STRING;
+  else if (_ref == AST_BINARY_REF_NONE)
+    return AST_BINARY_NONE;
+  return AstBinaryKind(word(0) & 0xff);
+}
+
+bool AstBinaryNode::cut() const
+{
+  return ! is_inline() && (word(0) & AST_BINARY_CUT);
+}
+
+bool AstBinaryNode::mergeable() const
+{
+  return ! is_inline() && (word(0) & AST_BINARY_MERGEABLE);
+}
+
+AstBinaryStringRef AstBinaryNode::string() const
+{
+  if (_ref & 1)
+    return _binary->string(_ref >> 1);
+  expect(AST_BINARY_STRING);
+  return _binary->string(word(1));
+}
+
+size_t AstBinaryNode::size() const
+{
+  AstBinaryKind node_kind = kind();
+  if (node_kind != AST_BINARY_LIST && node_kind != AST_BINARY_MAP)
+    throw std::invalid_argument("wrong kind of binary AST node");
+  size_t count = word(1);
+  /* The node must hold that many elements or entries.  */
+  if (count > 0)
+    word(node_kind == AST_BINARY_LIST ? 1 + count : 2 + 2 * count);
+  return count;
+}
+
+AstBinaryNode AstBinaryNode::at(size_t index) const
+{
+  expect(AST_BINARY_LIST);
+  check_index(index);
+  return child(word(2 + index));
+}
+
+size_t AstBinaryNode::ordered() const
+{
+  expect(AST_BINARY_MAP);
+  return word(2);
+}
+
+AstBinaryStringRef AstBinaryNode::key(size_t index) const
+{
+  expect(AST_BINARY_MAP);
+  check_index(index);
+  return _binary->string(word(3 + 2 * index));
+}
+
+bool AstBinaryNode::has_value(size_t index) const
+{
+  expect(AST_BINARY_MAP);
+  check_index(index);
+  return word(4 + 2 * index) != 0;
+}
+
+AstBinaryNode AstBinaryNode::value(size_t index) const
+{
+  if (! has_value(index))
+    throw std::invalid_argument("map entry without value");
+  return child(word(4 + 2 * index));
+}
+
+bool AstBinaryNode::find(const std::string& key, AstBinaryNode& node) const
+{
+  size_t entries = size();
+  for (size_t index = 0; index < entries; index++)
+    if (this->key(index) == key && has_value(index))
+      {
+	node = value(index);
+	return true;
+      }
+  return false;
+}
+
+AstBinaryStringRef AstBinaryNode::exception_type() const
+{
+  expect(AST_BINARY_EXCEPTION);
+  return _binary->string(word(1));
+}
+
+AstBinaryStringRef AstBinaryNode::exception_initializer() const
+{
+  expect(AST_BINARY_EXCEPTION);
+  return _binary->string(word(2));
+}
+
+AstBinaryStringRef AstBinaryNode::extension_tag() const
+{
+  expect(AST_BINARY_EXTENSION);
+  return _binary->string(word(1));
+}
+
+AstBinaryStringRef AstBinaryNode::extension_data() const
+{
+  expect(AST_BINARY_EXTENSION);
+  return _binary->string(word(2));
+}
+
+AstPtr AstBinaryNode::load() const
+{
+  if (_ref & 1)
+    {
+      AstBinaryStringRef str = _binary->string(_ref >> 1);
+      AstPtr ast = std::make_shared<Ast>(AstString());
+      ast->the_string().assign(str._data, str._size);
+      return ast;
+    }
+  else if (_ref == AST_BINARY_REF_NONE)
+    return std::make_shared<Ast>();
+
+  AstPtr ast;
+  uint32_t head = word(0);
+  switch (head & 0xff)
+    {
+    case AST_BINARY_NONE:
+      ast = std::make_shared<Ast>();
+      break;
+
+    case AST_BINARY_STRING:
+      {
+	AstBinaryStringRef str = _binary->string(word(1));
+	ast = std::make_shared<Ast>(AstString());
+	ast->the_string().assign(str._data, str._size);
+	break;
+      }
+
+    case AST_BINARY_LIST:
+      {
+	ast = std::make_shared<Ast>(AstList());
+	AstList& list = ast->the_list();
+	list._mergeable = head & AST_BINARY_MERGEABLE;
+	/* size checks the words of the elements.  */
+	size_t elements = size();
+	for (size_t index = 0; index < elements; index++)
+	  {
+	    uint32_t ref = _binary->get(_ref + 4 * (2 + index));
+	    list.push_back(ref ? child(ref).load() : AstPtr());
+	  }
+	break;
+      }
+
+    case AST_BINARY_MAP:
+      {
+	ast = std::make_shared<Ast>(AstMap());
+	AstMap& map = *ast->as_map();
+	size_t entries = size();
+	size_t in_order = word(2);
+	map._order.reserve(std::min(entries, in_order));
+	for (size_t index = 0; index < entries; index++)
+	  {
+	    size_t entry = _ref + 4 * (3 + 2 * index);
+	    AstBinaryStringRef key = _binary->string(_binary->get(entry));
+	    uint32_t ref = _binary->get(entry + 4);
+	    std::string name(key._data, key._size);
+	    if (index < in_order)
+	      map._order.push_back(name);
+	    if (ref)
+	      map[std::move(name)] = child(ref).load();
+	  }
+	break;
+      }
+
+    case AST_BINARY_EXCEPTION:
+      {
+	std::string type = exception_type().str();
+	AstException exc;
+	if (! type.empty())
+	  {
+	    exc._exc = make_failed_parse(type, exception_initializer().str());
+	    if (! exc._exc)
+	      throw std::invalid_argument("unknown exception " + type);
+	  }
+	ast = std::make_shared<Ast>(exc);
+	break;
+      }
+
+    case AST_BINARY_EXTENSION:
+      {
+	std::string tag = extension_tag().str();
+	std::string data = extension_data().str();
+	auto loader = _binary->_extension_loaders.find(tag);
+	AstExtension ext;
+	if (! tag.empty() && loader != _binary->_extension_loaders.end())
+	  ext = loader->second(data);
+	else
+	  ext = std::make_shared<AstBinaryExtension>(tag, data);
+	ast = std::make_shared<Ast>(ext);
+	break;
+      }
+
+    default:
+      throw std::invalid_argument("unknown binary AST node kind");
+    }
+  ast->_cut = head & AST_BINARY_CUT;
+  return ast;
+}
+
+
+/* Write AST in the binary format to OUT.  */
+inline void write_binary(std::ostream& out, const Ast& ast)
+{
+  AstBinaryWriter writer;
+  const std::string& data = writer.write(ast);
+  out.write(data.data(), data.size());
+}
+
+/* Read the AST in the binary file FILENAME.  To use the nodes without
+   building the AST, keep a MappedFile and an AstBinary over it.  */
+inline AstPtr read_binary_file(const std::string& filename)
+{
+  MappedFile file(filename);
+  AstBinary binary(file.data(), file.size());
+  return binary.load();
+}
+
+/* Read the AST in FILENAME, in the binary format or in JSON.  */
+inline AstPtr read_ast_file(const std::string& filename)
+{
+  MappedFile file(filename);
+  if (file.size() >= 4 && !memcmp(file.data(), "GKAB", 4))
+    return AstBinary(file.data(), file.size()).load();
+
+  AstJsonReader reader(file.data(), file.size());
+  AstPtr ast = reader.read();
+  reader.expect_end();
+  return ast;
+}
+
+#endif /* _GRAKOPP_AST_BINARY_HPP */
@@ -10,9 +10,18 @@
 #ifndef _GRAKOPP_AST_IO_HPP
 #define _GRAKOPP_AST_IO_HPP 1
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <istream>
+#include <iterator>
 #include <ostream>
+#include <sstream>
+#include <stdexcept>
 #include <streambuf>
-#include <boost/algorithm/string/replace.hpp>
 
 #include "ast.hpp"
 
@@ -58,312 +67,628 @@ public:
 };
 
 
-std::ostream& operator<< (std::ostream& cout, const Ast& ast)
+/* Writes ASTs as JSON into a string that grows as needed, which is
+   much faster than writing through a stream (and AstIndentGuard).
+   Strings are escaped in one pass, with the short escapes of JSON
+   where there is one and \uXXXX for the other control characters.
+   Bytes from 0x80 on are copied, so UTF-8 stays UTF-8.  Lists and
+   maps are indented by INDENT spaces per level, or with COMPACT, all
+   whitespace is left out.  Given a stream, the writer flushes its
+   output every CHUNK bytes, so that large ASTs are not kept in
+   memory twice.  */
+class AstJsonWriter
 {
-  class AstDumper : public boost::static_visitor<void>
+public:
+  explicit AstJsonWriter(bool compact=false, int indent=4)
+    : _compact(compact), _indent(indent), _stream(nullptr), _chunk(1 << 16)
   {
-    void json_escape(std::string* data) const
-    {
-      using boost::algorithm::replace_all;
-      replace_all(*data, "\\", "\\\\");
-      replace_all(*data, "\"", "\\\"");
-      replace_all(*data, "\b", "\\b");
-      replace_all(*data, "\f", "\\f");
-      replace_all(*data, "\n", "\\n");
-      replace_all(*data, "\t", "\\t");
-      /* FIXME: Replace all < 32 */
-    }
-    
-  public:
-    AstDumper(std::ostream& cout) : _cout(cout) {}
-    std::ostream& _cout;
-    
-    void operator() (const AstNone& none) const
-    {
-      _cout << "null";
-    }
+  }
 
-    void operator() (const AstString& leaf) const
-    {
-      std::string _leaf = leaf;
-      json_escape(&_leaf);
-      _cout << "\"" << _leaf << "\"";
-    }
+  explicit AstJsonWriter(std::ostream& stream, bool compact=false, int indent=4)
+    : _compact(compact), _indent(indent), _stream(&stream), _chunk(1 << 16)
+  {
+  }
 
-    void operator() (const AstList& list) const
-    {
-      bool first = true;
-      _cout << "[";
+  ~AstJsonWriter()
+  {
+    flush();
+  }
+
+  bool _compact;
+  int _indent;
+  std::ostream* _stream;
+  size_t _chunk;
+  std::string _out;
+
+  void write(const Ast& ast)
+  {
+    write(ast, 0);
+    if (_stream && _out.size() >= _chunk)
+      flush();
+  }
+
+  const std::string& str() const
+  {
+    return _out;
+  }
+
+  /* Write the output to the stream, if any.  */
+  void flush()
+  {
+    if (! _stream)
+      return;
+    _stream->write(_out.data(), _out.size());
+    _out.clear();
+  }
+
+  /* Append STR to OUT as a JSON string, with quotes.  */
+  static void escape(std::string& out, const std::string& str)
+  {
+    escape(out, str.data(), str.size());
+  }
+
+  static void escape(std::string& out, const char* str, size_t length)
+  {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *table = escape_table();
+    const char *run = str;
+    const char *end = run + length;
+
+    out += '"';
+    for (const char *ptr = run; ptr < end; ptr++)
       {
-	AstIndentGuard ind_cout(_cout);
-	
-	for (auto& child: list)
+	unsigned char chr = *ptr;
+	unsigned char esc = table[chr];
+	if (! esc)
+	  continue;
+	out.append(run, ptr - run);
+	out += '\\';
+	if (esc == 'u')
 	  {
-	    if (first)
-	      {
-		first = false;
-		_cout << "\n";
-	      }
-	    else
-	      _cout << ",\n";
-	    _cout << *child;
+	    out += "u00";
+	    out += hex[chr >> 4];
+	    out += hex[chr & 15];
 	  }
+	else
+	  out += esc;
+	run = ptr + 1;
       }
-      if (!first)
-	_cout << "\n";
-      _cout << "]";
-    }
+    out.append(run, end - run);
+    out += '"';
+  }
 
-    void operator() (const AstMap& map) const
-    {
-      bool first = true;
-      _cout << "{";
-      {
-	AstIndentGuard ind_out(_cout);
+private:
+  /* For each byte, 0 if it is copied, 'u' if it is written as
+     \u00XX, and otherwise the character after the backslash.  */
+  static const unsigned char* escape_table()
+  {
+    static const unsigned char *table = [] () {
+      static unsigned char escapes[256] = { 0 };
+      for (int chr = 0; chr < 0x20; chr++)
+	escapes[chr] = 'u';
+      escapes[(unsigned char) '"'] = '"';
+      escapes[(unsigned char) '\\'] = '\\';
+      escapes[(unsigned char) '\b'] = 'b';
+      escapes[(unsigned char) '\f'] = 'f';
+      escapes[(unsigned char) '\n'] = 'n';
+      escapes[(unsigned char) '\r'] = 'r';
+      escapes[(unsigned char) '\t'] = 't';
+      return escapes;
+    } ();
+    return table;
+  }
+
+  void newline(int depth)
+  {
+    if (_compact)
+      return;
+    _out += '\n';
+    _out.append(depth * _indent, ' ');
+  }
 
-	for (auto& key: map._order)
+  void write(const Ast& ast, int depth)
+  {
+    if (ast.as_none())
+      _out += "null";
+    else if (const AstString* str = ast.as_string())
+      escape(_out, *str);
+    else if (const AstList* list = ast.as_list())
+      {
+	_out += '[';
+	bool first = true;
+	for (auto& child: *list)
 	  {
-	    if (first)
-	      {
-		first = false;
-		_cout << "\n";
-	      }
-	    else
-	      _cout << ",\n";
-	    _cout << "\"" << key << "\" : " << *map.at(key);
+	    if (! first)
+	      _out += ',';
+	    first = false;
+	    newline(depth + 1);
+	    write(*child, depth + 1);
+	    if (_stream && _out.size() >= _chunk)
+	      flush();
 	  }
+	if (! first)
+	  newline(depth);
+	_out += ']';
+      }
+    else if (const AstMap* map = ast.as_map())
+      {
 	/* FIXME: Output those keys which are in the map but not in
 	   _order?  */
+	_out += '{';
+	bool first = true;
+	for (auto& key: map->_order)
+	  {
+	    if (! first)
+	      _out += ',';
+	    first = false;
+	    newline(depth + 1);
+	    escape(_out, key);
+	    _out += _compact ? ":" : " : ";
+	    write(*map->at(key), depth + 1);
+	  }
+	if (! first)
+	  newline(depth);
+	_out += '}';
       }
-      if (!first)
-	_cout << "\n";
-      _cout << "}";
-    }
-
-    void operator() (const AstException& exc) const
-    {
-      std::string msg = (*exc).what();
-      json_escape(&msg);
-      _cout << (*exc).type() << "(\"" << msg << "\")";
-    }
-
-    void operator() (const AstExtension& ext) const
-    {
-      ext->output(_cout);
-    }
+    else if (const AstException* exc = ast.as_exception())
+      {
+	_out += (**exc).type();
+	_out += '(';
+	escape(_out, (**exc).what());
+	_out += ')';
+      }
+    else if (const AstExtension* ext = ast.as_extension())
+      {
+	/* Extensions write to a stream, and their lines are indented
+	   like the rest (except empty ones).  */
+	std::ostringstream oss;
+	(*ext)->output(oss);
+	bool bol = false;
+	for (char chr: oss.str())
+	  {
+	    if (chr == '\n')
+	      {
+		if (! _compact)
+		  _out += chr;
+		bol = true;
+		continue;
+	      }
+	    if (bol && ! _compact)
+	      _out.append(depth * _indent, ' ');
+	    bol = false;
+	    _out += chr;
+	  }
+      }
+  }
+};
 
-  };
 
-  AstDumper dumper(cout);
-  boost::apply_visitor(dumper, ast._content);
+inline std::ostream& operator<< (std::ostream& cout, const Ast& ast)
+{
+  AstJsonWriter writer(cout);
+  writer.write(ast);
   return cout;
 }
 
 
-/* Forward declaration.  */
-std::istream& operator>> (std::istream& is, AstPtr& val);
+/* Write AST to OUT as JSON without any whitespace.  */
+inline void write_compact_json(std::ostream& out, const Ast& ast)
+{
+  AstJsonWriter writer(out, true);
+  writer.write(ast);
+}
+
 
-std::istream& operator>> (std::istream& is, AstNone& val)
+/* Reads an AST from JSON in a contiguous buffer, for example a
+   memory-mapped file (see read_json_file).  Strings are copied in runs
+   between escapes, straight into the nodes, and all escapes of JSON
+   are supported, including \uXXXX with surrogate pairs (converted to
+   UTF-8).  Exceptions are read from the form the writer uses, like
+   FailedToken("message").  Errors throw std::invalid_argument.  */
+class AstJsonReader
 {
-  char ch;
-  is >> ch;
-  if (ch != 'n')
-    throw std::invalid_argument("null expected");
+public:
+  AstJsonReader(const char *data, size_t size)
+    : _begin(data), _ptr(data), _end(data + size)
+  {
+  }
 
-  is >> ch;
-  if (ch != 'u')
-    throw std::invalid_argument("null expected");
+  const char *_begin;
+  const char *_ptr;
+  const char *_end;
 
-  is >> ch;
-  if (ch != 'l')
-    throw std::invalid_argument("null expected");
+  /* The offset of the next character.  */
+  size_t pos() const
+  {
+    return _ptr - _begin;
+  }
 
-  is >> ch;
-  if (ch != 'l')
-    throw std::invalid_argument("null expected");
+  /* Read the next AST, skipping the whitespace before it.  */
+  AstPtr read()
+  {
+    skip_ws();
+    return read_value();
+  }
 
-  return is;
-}
+  /* Skip the whitespace after the last AST and fail if there is
+     anything else.  */
+  void expect_end()
+  {
+    skip_ws();
+    if (_ptr != _end)
+      error("end of input expected");
+  }
 
-std::istream& operator>> (std::istream& is, AstString& val)
-{
-  char ch;
+private:
+  void error(const char *msg) const
+  {
+    throw std::invalid_argument(std::string(msg) + " at offset "
+				+ std::to_string(pos()));
+  }
 
-  if (is.peek() != '"')
-    throw std::invalid_argument("quote expected");
-  is >> ch;
+  void skip_ws()
+  {
+    while (_ptr < _end && (*_ptr == ' ' || *_ptr == '\n' || *_ptr == '\t'
+			   || *_ptr == '\r'))
+      _ptr++;
+  }
 
-  while (! is.eof())
-    {
-      is >> ch;
+  void expect(char chr, const char *msg)
+  {
+    if (_ptr == _end || *_ptr != chr)
+      error(msg);
+    _ptr++;
+  }
 
-      if (ch == '"')
-	return is;
-      else if (ch == '\\')
+  AstPtr read_value()
+  {
+    if (_ptr == _end)
+      error("AST expected");
+    switch (*_ptr)
+      {
+      case '"':
 	{
-	  is >> ch;
-	  if (ch == 'b')
-	    val += '\b';
-	  else if (ch == 'f')
-	    val += '\f';
-	  else if (ch == 'n')
-	    val += '\n';
-	  else if (ch == 'r')
-	    val += '\r';
-	  else if (ch == 't')
-	    val += '\t';
-	  else if (ch == 'u')
-	    throw std::invalid_argument("unicode support not implemented yet");
-	  else
-	    val += ch;
+	  AstPtr ast = std::make_shared<Ast>(AstString());
+	  read_string(ast->the_string());
+	  return ast;
 	}
-      else
-	val += ch;
-    }
-  throw std::invalid_argument("EOF in string");
-}
+      case '[':
+	{
+	  AstPtr ast = std::make_shared<Ast>(AstList());
+	  read_list(ast->the_list());
+	  return ast;
+	}
+      case '{':
+	{
+	  AstPtr ast = std::make_shared<Ast>(AstMap());
+	  read_map(*ast->as_map());
+	  return ast;
+	}
+      case 'n':
+	if (_end - _ptr < 4 || memcmp(_ptr, "null", 4))
+	  error("null expected");
+	_ptr += 4;
+	return std::make_shared<Ast>();
+      case 'F':
+	return std::make_shared<Ast>(read_exception());
+      default:
+	error("AST expected");
+      }
+    return AstPtr();
+  }
 
-std::istream& operator>> (std::istream& is, AstList& val)
-{
-  char ch;
+  void read_list(AstList& list)
+  {
+    _ptr++;
+    skip_ws();
+    if (_ptr < _end && *_ptr == ']')
+      {
+	_ptr++;
+	return;
+      }
+    while (true)
+      {
+	list.push_back(read());
+	skip_ws();
+	if (_ptr == _end)
+	  error("EOF in list");
+	if (*_ptr++ == ']')
+	  return;
+	if (_ptr[-1] != ',')
+	  error("expected comma");
+      }
+  }
 
-  if (is.peek() != '[')
-    throw std::invalid_argument("list expected");
-  is >> ch >> std::ws;
+  void read_map(AstMap& map)
+  {
+    _ptr++;
+    skip_ws();
+    if (_ptr < _end && *_ptr == '}')
+      {
+	_ptr++;
+	return;
+      }
+    while (true)
+      {
+	std::string key;
+	if (_ptr == _end || *_ptr != '"')
+	  error("quote expected");
+	read_string(key);
+	skip_ws();
+	expect(':', "expected colon");
+	AstPtr value = read();
+
+	/* FIXME: Maybe override in AstMap.  */
+	map._order.push_back(key);
+	map[std::move(key)] = std::move(value);
+
+	skip_ws();
+	if (_ptr == _end)
+	  error("EOF in map");
+	if (*_ptr++ == '}')
+	  return;
+	if (_ptr[-1] != ',')
+	  error("expected comma");
+	skip_ws();
+      }
+  }
 
-  while (! is.eof() )
-    {
-      if (is.peek() == ']')
-	{
-	  is >> ch;
-	  return is;
-	}
+  AstException read_exception()
+  {
+    const char *paren = static_cast<const char*>(memchr(_ptr, '(', _end - _ptr));
+    if (! paren)
+      error("opening parenthesis expected");
+    std::string type(_ptr, paren);
+    _ptr = paren + 1;
+
+    std::string msg;
+    if (_ptr == _end || *_ptr != '"')
+      error("quote expected");
+    read_string(msg);
+    expect(')', "closing parenthesis expected");
+
+    std::shared_ptr<FailedParseBase> exc = make_failed_parse(type, msg);
+    if (exc)
+      return AstException(exc);
+    error("unknown exception");
+    return AstException();
+  }
 
-      AstPtr ast = std::make_shared<Ast>();
-      is >> ast >> std::ws;
-      val.push_back(ast);
+  unsigned int read_hex4()
+  {
+    if (_end - _ptr < 4)
+      error("EOF in unicode escape");
+    unsigned int code = 0;
+    for (int i = 0; i < 4; i++)
+      {
+	char chr = *_ptr++;
+	code <<= 4;
+	if (chr >= '0' && chr <= '9')
+	  code |= chr - '0';
+	else if (chr >= 'a' && chr <= 'f')
+	  code |= chr - 'a' + 10;
+	else if (chr >= 'A' && chr <= 'F')
+	  code |= chr - 'A' + 10;
+	else
+	  error("invalid unicode escape");
+      }
+    return code;
+  }
 
-      ch = is.peek();
-      if (ch == ',')
-	is >> ch >> std::ws;
-      if (ch != ',' && ch != ']')
-	throw std::invalid_argument("expected comma");
-    }
-  throw std::invalid_argument("EOF in list");
-}
+  static void append_utf8(std::string& out, unsigned int code)
+  {
+    if (code < 0x80)
+      out += char(code);
+    else if (code < 0x800)
+      {
+	out += char(0xc0 | (code >> 6));
+	out += char(0x80 | (code & 0x3f));
+      }
+    else if (code < 0x10000)
+      {
+	out += char(0xe0 | (code >> 12));
+	out += char(0x80 | ((code >> 6) & 0x3f));
+	out += char(0x80 | (code & 0x3f));
+      }
+    else
+      {
+	out += char(0xf0 | (code >> 18));
+	out += char(0x80 | ((code >> 12) & 0x3f));
+	out += char(0x80 | ((code >> 6) & 0x3f));
+	out += char(0x80 | (code & 0x3f));
+      }
+  }
 
-std::istream& operator>> (std::istream& is, AstMap& val)
+  /* Read a string starting at the opening quote into OUT.  */
+  void read_string(std::string& out)
+  {
+    _ptr++;
+    while (true)
+      {
+	const char *run = _ptr;
+	while (_ptr < _end && *_ptr != '"' && *_ptr != '\\')
+	  _ptr++;
+	out.append(run, _ptr - run);
+	if (_ptr == _end)
+	  error("EOF in string");
+	if (*_ptr++ == '"')
+	  return;
+
+	if (_ptr == _end)
+	  error("EOF in string");
+	char chr = *_ptr++;
+	switch (chr)
+	  {
+	  case 'b':
+	    out += '\b';
+	    break;
+	  case 'f':
+	    out += '\f';
+	    break;
+	  case 'n':
+	    out += '\n';
+	    break;
+	  case 'r':
+	    out += '\r';
+	    break;
+	  case 't':
+	    out += '\t';
+	    break;
+	  case 'u':
+	    {
+	      unsigned int code = read_hex4();
+	      /* A high surrogate followed by a low one is a pair.  A
+		 lone surrogate is kept as it is.  */
+	      if (code >= 0xd800 && code < 0xdc00 && _end - _ptr >= 6
+		  && _ptr[0] == '\\' && _ptr[1] == 'u')
+		{
+		  const char *low_start = _ptr;
+		  _ptr += 2;
+		  unsigned int low = read_hex4();
+		  if (low >= 0xdc00 && low < 0xe000)
+		    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+		  else
+		    _ptr = low_start;
+		}
+	      append_utf8(out, code);
+	      break;
+	    }
+	  default:
+	    /* \", \\, \/ and unknown escapes.  */
+	    out += chr;
+	  }
+      }
+  }
+};
+
+
+/* A read-only memory mapping of a whole file.  */
+class MappedFile
 {
-  char ch;
+public:
+  explicit MappedFile(const std::string& filename)
+    : _data(nullptr), _size(0)
+  {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::invalid_argument("can not open " + filename);
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+      {
+	close(fd);
+	throw std::invalid_argument("can not stat " + filename);
+      }
+    _size = st.st_size;
+    if (_size > 0)
+      {
+	void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	  {
+	    close(fd);
+	    throw std::invalid_argument("can not map " + filename);
+	  }
+	_data = static_cast<const char*>(data);
+      }
+    close(fd);
+  }
 
-  if (is.peek() != '{')
-    throw std::invalid_argument("map expected");
-  is >> ch >> std::ws;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
 
-  while (! is.eof())
-    {
-      if (is.peek() == '}')
-	{
-	  is >> ch;
-	  return is;
-	}
+  ~MappedFile()
+  {
+    if (_data)
+      munmap(const_cast<char*>(_data), _size);
+  }
 
-      AstString key;
-      is >> key >> std::ws;
+  const char* data() const
+  {
+    return _data;
+  }
 
-      if (is.peek() != ':')
-	throw std::invalid_argument("expected colon");
-      is >> ch >> std::ws;
+  size_t size() const
+  {
+    return _size;
+  }
 
-      AstPtr ast = std::make_shared<Ast>();
-      is >> ast >> std::ws;
+private:
+  const char *_data;
+  size_t _size;
+};
 
-      /* FIXME: Maybe override in AstMap.  */
-      val._order.push_back(key);
-      val[key] = ast;
 
-      ch = is.peek();
-      if (ch == ',')
-	is >> ch >> std::ws;
-      if (ch != ',' && ch != '}')
-	throw std::invalid_argument("expected comma");
-    }
-  throw std::invalid_argument("EOF in list");
+/* Read the AST in the JSON file FILENAME.  */
+inline AstPtr read_json_file(const std::string& filename)
+{
+  MappedFile file(filename);
+  AstJsonReader reader(file.data(), file.size());
+  AstPtr ast = reader.read();
+  reader.expect_end();
+  return ast;
 }
 
-std::istream& operator>> (std::istream& is, AstException& exc)
+
+/* Read an AST from a stream into VAL, which may be a null pointer.
+   The rest of the stream is read into memory and parsed with
+   AstJsonReader.  If the stream can seek, it is then positioned after
+   the AST, otherwise the rest is consumed.  */
+inline std::istream& operator>> (std::istream& is, AstPtr& val)
 {
-#define MAX_TOKEN 40
-  char token[MAX_TOKEN];
-  is.getline(token, MAX_TOKEN, '(');
-  /* Paranoia.  */
-  token[MAX_TOKEN - 1] = '\0';
-  /* FIXME: Report better error on invalid input, in particular if
-     opening parenthesis is missing.  */
-
-  AstString msg;
-  is >> msg;
-
-  if (is.peek() != ')')
-    throw std::invalid_argument("closing parenthesis expected");
-  is.ignore(1);
-
-  if (!strcmp(token, "FailedParse"))
-    exc._exc = std::make_shared<FailedParse>(msg);
-  else if (!strcmp(token, "FailedToken"))
-    exc._exc = std::make_shared<FailedToken>(msg);
-  else if (!strcmp(token, "FailedPattern"))
-    exc._exc = std::make_shared<FailedPattern>(msg);
-  else if (!strcmp(token, "FailedLookahead"))
-    exc._exc = std::make_shared<FailedLookahead>(msg);
-  else if (!strcmp(token, "FailedSemantics"))
-    exc._exc = std::make_shared<FailedSemantics>(msg);
+  std::streampos start = is.tellg();
+  std::string text((std::istreambuf_iterator<char>(is)),
+		   std::istreambuf_iterator<char>());
+  AstJsonReader reader(text.data(), text.size());
+  AstPtr ast = reader.read();
+  if (start != std::streampos(-1))
+    {
+      is.clear();
+      is.seekg(start + std::streamoff(reader.pos()));
+    }
+
+  if (val)
+    val->_content = std::move(ast->_content);
   else
-    throw std::invalid_argument("unknown exception");
+    val = ast;
+  return is;
+}
 
+/* Read an AST of type T.  */
+template <typename T>
+inline std::istream& ast_read_content(std::istream& is, T& val, const char *expected)
+{
+  AstPtr ast;
+  is >> ast;
+  T* content = boost::get<T>(&ast->_content);
+  if (! content)
+    throw std::invalid_argument(expected);
+  val = std::move(*content);
   return is;
 }
 
+inline std::istream& operator>> (std::istream& is, AstNone& val)
+{
+  return ast_read_content(is, val, "null expected");
+}
 
-std::istream& operator>> (std::istream& is, AstPtr& val)
+inline std::istream& operator>> (std::istream& is, AstString& val)
 {
-  char ch = is.peek();
+  return ast_read_content(is, val, "quote expected");
+}
 
-  if (ch == '"')
-    {
-      AstString str;
-      is >> str;
-      val->_content = str;
-    }
-  else if (ch == '[')
-    {
-      AstList list;
-      is >> list;
-      val->_content = list;
-    }
-  else if (ch == '{')
-    {
-      AstMap map;
-      is >> map;
-      val->_content = map;
-    }
-  else if (ch == 'F')
-    {
-      AstException exc;
-      is >> exc;
-      val->_content = exc;
-    }
-  else if (ch == 'n')
-    {
-      AstNone none;
-      is >> none;
-      val->_content = none;
-    }
-  else
-    throw std::invalid_argument("AST expected");
+inline std::istream& operator>> (std::istream& is, AstList& val)
+{
+  return ast_read_content(is, val, "list expected");
+}
 
-  return is;
+inline std::istream& operator>> (std::istream& is, AstMap& val)
+{
+  return ast_read_content(is, val, "map expected");
 }
-    
+
+inline std::istream& operator>> (std::istream& is, AstException& exc)
+{
+  return ast_read_content(is, exc, "exception expected");
+}
+
 
 #endif /* _GRAKOPP_AST_IO_HPP */
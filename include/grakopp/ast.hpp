@@ -10,12 +10,14 @@
 #ifndef _GRAKOPP_AST_HPP
 #define _GRAKOPP_AST_HPP 1
 
+#include <cstdint>
 #include <string>
 #include <sstream>
 #include <list>
 #include <map>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include <boost/variant.hpp>
 
@@ -120,21 +122,96 @@ public:
        one derived type, so use dynamic_cast for the argument.  */
     return false;
   }
+
+  /* Serialization for the binary format (see ast-binary.hpp).  If the
+     extension can be restored by a loader registered for a tag, set
+     TAG and DATA and return true.  Otherwise, only the output is
+     stored.  */
+  virtual bool serialize(std::string& /* tag */, std::string& /* data */) const
+  {
+    return false;
+  }
 };
 
 /* The reason we use a pointer here is that we need polymorphism.  */
 using AstExtension = std::shared_ptr<AstExtensionType>;
 
 
+/* The number of AST nodes allocated and freed by a thread, and the
+   most that were alive at once (see Parser::stats).  The counters are
+   per thread, so that counting costs no synchronization.  Still, it
+   costs a thread-local update in every constructor and destructor of
+   Ast, so the nodes are only counted if compiled with
+   -DGRAKOPP_AST_COUNTERS (or -DGRAKOPP_PROFILE).  Otherwise, the
+   counters stay 0.  */
+class AstCounters
+{
+public:
+#if defined(GRAKOPP_AST_COUNTERS) || defined(GRAKOPP_PROFILE)
+  static constexpr bool enabled = true;
+#else
+  static constexpr bool enabled = false;
+#endif
+
+  uint64_t _allocated;
+  uint64_t _freed;
+  uint64_t _high_water;
+
+  static AstCounters& get()
+  {
+    static thread_local AstCounters counters;
+    return counters;
+  }
+
+  uint64_t live() const
+  {
+    /* A node may be freed by another thread than the one that
+       allocated it.  */
+    return _allocated > _freed ? _allocated - _freed : 0;
+  }
+
+  void allocated()
+  {
+    _allocated++;
+    if (live() > _high_water)
+      _high_water = live();
+  }
+
+  void freed()
+  {
+    _freed++;
+  }
+
+  static void count_allocated()
+  {
+    if (enabled)
+      get().allocated();
+  }
+
+  static void count_freed()
+  {
+    if (enabled)
+      get().freed();
+  }
+};
+
+
 class Ast
 {
 public:
-  Ast() : _content(AstNone()), _cut(false) {}
-  Ast(const AstString& str) : _content(str), _cut(false) {}
-  Ast(const AstList& list) : _content(list), _cut(false) {}
-  Ast(const AstMap& map) : _content(map), _cut(false) {}
-  Ast(const AstException& exc) : _content(exc), _cut(false) {}
-  Ast(const AstExtension& ext) : _content(ext), _cut(false) {}
+  Ast() : _content(AstNone()), _cut(false) { AstCounters::count_allocated(); }
+  Ast(const AstString& str) : _content(str), _cut(false) { AstCounters::count_allocated(); }
+  Ast(const AstList& list) : _content(list), _cut(false) { AstCounters::count_allocated(); }
+  Ast(const AstMap& map) : _content(map), _cut(false) { AstCounters::count_allocated(); }
+  Ast(const AstException& exc) : _content(exc), _cut(false) { AstCounters::count_allocated(); }
+  Ast(const AstExtension& ext) : _content(ext), _cut(false) { AstCounters::count_allocated(); }
+  Ast(const Ast& ast) : _content(ast._content), _cut(ast._cut) { AstCounters::count_allocated(); }
+  /* The destructor counts moved-from nodes, too, so the move
+     constructor counts like the others.  */
+  Ast(Ast&& ast) : _content(std::move(ast._content)), _cut(ast._cut) { AstCounters::count_allocated(); }
+  Ast& operator=(const Ast& ast) = default;
+  Ast& operator=(Ast&& ast) = default;
+  ~Ast() { AstCounters::count_freed(); }
 
   /* Payload variants.  */
   boost::variant<AstNone, AstString, AstList, AstMap, AstException, AstExtension> _content;
@@ -12,14 +12,19 @@
 
 #include <features.h>
 #include <string>
+#include <algorithm>
+#include <iterator>
 #include <cctype>
 #include <fstream>
 #include <sstream>
 #include <cerrno>
 #include <unordered_map>
+#include <memory>
 
 #include <boost/optional.hpp>
 
+#include "probes.hpp"
+
 /* Use std::regex, except where it is not available (then import
    boost::regex into the std namespace).  */
 
@@ -51,26 +56,110 @@ typedef char CHAR_T;
 #define CHAR_NULL ((CHAR_T) 0) /* Sort of.  */
 
 
+/* Iterator over a text that remembers the furthest position it was
+   dereferenced at, so we can tell how far a regular expression looked
+   ahead.  */
+class HorizonIterator
+{
+public:
+  using base_t = std::string::const_iterator;
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = CHAR_T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const CHAR_T*;
+  using reference = const CHAR_T&;
+
+  HorizonIterator() : _furthest(nullptr) {}
+  HorizonIterator(base_t it, base_t* furthest) : _it(it), _furthest(furthest) {}
+
+  reference operator*() const
+  {
+    if (_it >= *_furthest)
+      *_furthest = _it + 1;
+    return *_it;
+  }
+
+  pointer operator->() const
+  {
+    return &**this;
+  }
+
+  HorizonIterator& operator++() { ++_it; return *this; }
+  HorizonIterator operator++(int) { HorizonIterator old(*this); ++_it; return old; }
+  HorizonIterator& operator--() { --_it; return *this; }
+  HorizonIterator operator--(int) { HorizonIterator old(*this); --_it; return old; }
+  bool operator==(const HorizonIterator& other) const { return _it == other._it; }
+  bool operator!=(const HorizonIterator& other) const { return _it != other._it; }
+
+  base_t _it;
+  base_t* _furthest;
+};
+
+
 class Buffer;
 using BufferPtr = std::shared_ptr<Buffer>;
 
+/* A buffer holds the input text together with the cursor and the
+   tokenizer settings of the parser it is attached to.  It is owned by
+   one parser at a time: parsers running concurrently need a buffer
+   each (see grakopp/pool.hpp).  */
 class Buffer
 {
 public:
-  std::string _text;
+  /* The text may be shared with other buffers (see share()), which
+     then only differ in their cursor and tokenizer settings.  */
+  std::shared_ptr<std::string> _data;
   size_t _pos;
   std::string _whitespace;
   bool _nameguard;
 
+  /* One past the furthest position that was examined, see see().
+     Regular expressions are only tracked if _track_horizon is set,
+     because that needs a slower code path.  */
+  mutable size_t _horizon;
+  bool _track_horizon;
+
   Buffer()
-    : _pos(0), _whitespace(),
-      _nameguard(false)
+    : _data(std::make_shared<std::string>()), _pos(0), _whitespace(),
+      _nameguard(false), _horizon(0), _track_horizon(false)
+  {
+  }
+
+  /* Record that the text up to (excluding) END was looked at.  */
+  void see(size_t end) const
+  {
+    if (end > _horizon)
+      _horizon = end;
+  }
+
+  const std::string& text() const
   {
+    return *_data;
   }
 
   void from_string(const std::string& text)
   {
-    _text = text;
+    /* Reuse the allocation, unless another buffer still sees it.  */
+    if (_data.use_count() == 1)
+      *_data = text;
+    else
+      _data = std::make_shared<std::string>(text);
+    GRAKOPP_PROBE1(buffer__load, _data->size());
+  }
+
+  /* Use the text of BUFFER without copying it.  */
+  void share(const Buffer& buffer)
+  {
+    _data = buffer._data;
+  }
+
+  /* Replace REMOVED characters at OFFSET by INSERTED.  */
+  void replace(size_t offset, size_t removed, const std::string& inserted)
+  {
+    if (_data.use_count() != 1)
+      _data = std::make_shared<std::string>(*_data);
+    _data->replace(offset, removed, inserted);
+    GRAKOPP_PROBE3(buffer__replace, offset, removed, inserted.size());
   }
 
   void from_file(const std::string& filename)
@@ -81,7 +170,8 @@ public:
 	std::ostringstream contents;
 	contents << in.rdbuf();
 	in.close();
-	_text = contents.str();
+	_data = std::make_shared<std::string>(contents.str());
+	GRAKOPP_PROBE1(buffer__load, _data->size());
 	return;
       }
     throw(errno);
@@ -89,19 +179,20 @@ public:
 
   size_t len() const
   {
-    return _text.length();
+    return text().length();
   }
 
   bool atend() const
   {
+    see(_pos + 1);
     return _pos >= len();
   }
 
   bool ateol() const
   {
     return atend()
-      || _text[_pos] == '\r'
-      || _text[_pos] == '\n';
+      || text()[_pos] == '\r'
+      || text()[_pos] == '\n';
   }
 
   CHAR_T current() const
@@ -109,14 +200,15 @@ public:
     if (atend())
       return CHAR_NULL;
     else
-      return _text[_pos];
+      return text()[_pos];
   }
 
   CHAR_T at(size_t pos) const
   {
+    see(pos + 1);
     if (pos >= len())
       return CHAR_NULL;
-    return _text[pos];
+    return text()[pos];
   }
 
   CHAR_T peek(size_t off) const
@@ -128,7 +220,7 @@ public:
   {
     if (atend())
       return CHAR_NULL;
-    return _text[_pos++];
+    return text()[_pos++];
   }
 
   void go_to(size_t pos)
@@ -157,9 +249,18 @@ public:
 	/* FIXME: eatcomments.  */
 	if (_whitespace.length() > 0)
 	  {
-	    size_t new_pos = _text.find_first_not_of(_whitespace, _pos);
+	    size_t new_pos = text().find_first_not_of(_whitespace, _pos);
 	    if (new_pos != std::string::npos)
-	      _pos = new_pos;
+	      {
+		see(new_pos + 1);
+		_pos = new_pos;
+	      }
+	    else
+	      {
+		/* Only whitespace is left.  */
+		see(len() + 1);
+		_pos = len();
+	      }
 	  }
       }
     while (pos != _pos);
@@ -169,8 +270,9 @@ public:
   {
     size_t pos = _pos;
     size_t length = len();
-    while (pos < length && _text[pos] != ch)
+    while (pos < length && text()[pos] != ch)
       ++pos;
+    see(pos + 1);
     go_to(pos);
     return pos;
   }
@@ -206,7 +308,8 @@ public:
     if (len == 0)
       return true;
 
-    bool eq = (_text.compare(_pos, len, token) == 0);
+    see(_pos + len);
+    bool eq = (text().compare(_pos, len, token) == 0);
     if (!eq)
       return false;
 
@@ -218,7 +321,7 @@ public:
 	if (token_first_is_alpha && follow_is_alpha)
 	  {
 	    /* Check if the token is alphanumeric.  */
-	    auto begin = _text.cbegin() + _pos;
+	    auto begin = text().cbegin() + _pos;
 	    auto end = begin + len;
 
 	    bool token_is_alnum = find_if(begin, end, 
@@ -232,21 +335,23 @@ public:
     return true;
   }
 
-  boost::optional<std::string> matchre(std::string pattern)
+  /* Compiled regular expressions are cached per thread, so that
+     several parsers can run concurrently without locking.  */
+  static const std::regex& compile_re(const std::string& pattern)
   {
-    boost::optional<std::string> maybe_token;
+    static thread_local std::unordered_map<std::string, std::regex> _lookup;
+    auto el = _lookup.find(pattern);
+    if (el == _lookup.end())
+      el = _lookup.emplace(pattern, std::regex(pattern)).first;
+    return el->second;
+  }
 
-    /* FIXME: Not thread-safe.  */
-    static std::unordered_map<std::string, std::regex *>_lookup;
-    std::regex *rep;
-    if (_lookup.count(pattern) == 0)
-      {
-	rep = new std::regex(pattern);
-	_lookup[pattern] = rep;
-      }
-    else
-      rep = _lookup[pattern];
-    std::regex& re = *rep;
+  /* Like matchre, but only return the length of the match, which
+     saves building the token.  */
+  boost::optional<size_t> matchre_length(const std::string& pattern)
+  {
+    boost::optional<size_t> maybe_length;
+    const std::regex& re = compile_re(pattern);
 
     /* Multiline is the default.  */
     std::regex_constants::match_flag_type flags = std::regex_constants::match_continuous;
@@ -256,15 +361,44 @@ public:
     flags |= std::regex_constants::match_not_dot_newline;
 #endif
 
-    std::smatch match;
-    int cnt = std::regex_search(_text.cbegin() + _pos, _text.cend(), match, re, flags);
+    if (_track_horizon)
+      {
+	/* The regex may look at any character up to the end.  */
+	size_t start = _pos;
+	HorizonIterator::base_t furthest = text().cbegin() + _pos;
+	HorizonIterator begin(furthest, &furthest);
+	HorizonIterator end(text().cend(), &furthest);
+	std::match_results<HorizonIterator> match;
+	int cnt = std::regex_search(begin, end, match, re, flags);
+	if (cnt > 0)
+	  {
+	    maybe_length = match[0].length();
+	    _pos += match[0].length();
+	  }
+	/* Reaching the end means depending on the length, too.  */
+	size_t horizon = std::max<size_t>(furthest - text().cbegin(), start + 1);
+	see(horizon >= len() ? len() + 1 : horizon);
+	return maybe_length;
+      }
+
+    std::match_results<std::string::const_iterator> match;
+    int cnt = std::regex_search(text().cbegin() + _pos, text().cend(), match, re, flags);
     if (cnt > 0)
       {
-	maybe_token = match[0];
+	maybe_length = match[0].length();
 	_pos += match[0].length();
       }
 
-    return maybe_token;
+    return maybe_length;
+  }
+
+  boost::optional<std::string> matchre(const std::string& pattern)
+  {
+    size_t start = _pos;
+    boost::optional<size_t> maybe_length = matchre_length(pattern);
+    if (! maybe_length)
+      return boost::optional<std::string>();
+    return text().substr(start, *maybe_length);
   }
 
 };
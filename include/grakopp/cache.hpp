@@ -0,0 +1,308 @@
+/* grakopp/cache.hpp - Grako++ persistent parse cache header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_CACHE_HPP
+#define _GRAKOPP_CACHE_HPP 1
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "buffer.hpp"
+#include "ast.hpp"
+#include "ast-binary.hpp"
+
+
+/* SHA-256 (FIPS 180-4), for keys that must not collide.  */
+class Sha256
+{
+  uint32_t _state[8];
+  unsigned char _block[64];
+  size_t _used;
+  uint64_t _length;
+
+  static uint32_t rotr(uint32_t x, int n)
+  {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  void compress(const unsigned char* block)
+  {
+    static const uint32_t k[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+      0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+      0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+      0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+      0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+      0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+      0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+      0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+      0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+      w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16)
+	| (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+    for (int i = 16; i < 64; i++)
+      {
+	uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+	uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+	w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+    uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+    for (int i = 0; i < 64; i++)
+      {
+	uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+	uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + k[i] + w[i];
+	uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+	uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+	h = g;
+	g = f;
+	f = e;
+	e = d + t1;
+	d = c;
+	c = b;
+	b = a;
+	a = t1 + t2;
+      }
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+    _state[4] += e;
+    _state[5] += f;
+    _state[6] += g;
+    _state[7] += h;
+  }
+
+public:
+  Sha256()
+    : _state { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	       0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+      _used(0), _length(0)
+  {
+  }
+
+  void update(const char* data, size_t size)
+  {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    _length += size;
+    if (_used > 0)
+      {
+	size_t count = std::min(size, sizeof(_block) - _used);
+	memcpy(_block + _used, bytes, count);
+	_used += count;
+	bytes += count;
+	size -= count;
+	if (_used < sizeof(_block))
+	  return;
+	compress(_block);
+	_used = 0;
+      }
+    for (; size >= sizeof(_block); bytes += sizeof(_block), size -= sizeof(_block))
+      compress(bytes);
+    memcpy(_block, bytes, size);
+    _used = size;
+  }
+
+  void update(const std::string& data)
+  {
+    update(data.data(), data.size());
+  }
+
+  /* The digest as 64 hex digits.  The object can't be updated
+     afterwards.  */
+  std::string hexdigest()
+  {
+    uint64_t bits = _length * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t count = (_used < 56 ? 56 : 120) - _used;
+    for (int i = 0; i < 8; i++)
+      pad[count + i] = (unsigned char) (bits >> (56 - 8 * i));
+    update(reinterpret_cast<const char*>(pad), count + 8);
+
+    std::string digest;
+    char hex[9];
+    for (uint32_t word: _state)
+      {
+	snprintf(hex, sizeof(hex), "%08x", (unsigned int) word);
+	digest += hex;
+      }
+    return digest;
+  }
+};
+
+
+/* A directory of parse results, indexed by a SHA-256 digest of
+   everything that determines the result: the grammar version, the
+   start rule, the tokenizer settings and the text.  The digest names
+   the file, and the file repeats it, so that a lookup can check that
+   it read the right file.  Only successful parses are stored.  Files
+   are written under a temporary name and renamed into place, so
+   concurrent writers and readers never see partial results.  */
+class ParseCache
+{
+  std::string _directory;
+
+  /* Each part is preceded by its length, so that concatenations
+     don't collide.  */
+  static void add_part(Sha256& digest, const std::string& part)
+  {
+    digest.update(std::to_string(part.size()) + ":");
+    digest.update(part);
+  }
+
+  static bool cacheable(const Ast& ast)
+  {
+    /* Extension types can't be read back.  */
+    if (ast.as_extension() || ast.as_exception())
+      return false;
+    const AstList* list = ast.as_list();
+    if (list)
+      for (auto& child: *list)
+	if (! cacheable(*child))
+	  return false;
+    const AstMap* map = ast.as_map();
+    if (map)
+      for (auto& el: *map)
+	if (! cacheable(*el.second))
+	  return false;
+    return true;
+  }
+
+  std::string filename(const std::string& identity) const
+  {
+    return _directory + "/" + identity + ".ast";
+  }
+
+public:
+  ParseCache(const std::string& directory)
+    : _directory(directory)
+  {
+    /* Failure shows up as cache misses and failed stores.  */
+    mkdir(_directory.c_str(), 0777);
+  }
+
+  /* The digest of everything that determines the result of RULE on
+     BUFFER, including the start position in the buffer.  The text is
+     hashed in place, not copied.  */
+  static std::string identity(const Buffer& buffer, const std::string& version,
+			      const std::string& rule)
+  {
+    Sha256 digest;
+    add_part(digest, version);
+    add_part(digest, rule);
+    add_part(digest, buffer._whitespace);
+    add_part(digest, buffer._nameguard ? "1" : "0");
+    add_part(digest, std::to_string(buffer._pos));
+    add_part(digest, buffer.text());
+    return digest.hexdigest();
+  }
+
+  /* Return the AST stored for IDENTITY and set POS to the end
+     position of the parse, or return a null pointer.  */
+  AstPtr lookup(const std::string& identity, size_t& pos) const
+  {
+    try
+      {
+	MappedFile file(filename(identity));
+	if (file.size() == 0)
+	  return AstPtr();
+	const char *header_end = static_cast<const char*>
+	  (memchr(file.data(), '\n', file.size()));
+	if (! header_end)
+	  return AstPtr();
+
+	std::string header(file.data(), header_end);
+	int version;
+	char digest[65];
+	if (sscanf(header.c_str(), "grakopp-cache %d %zu %64s",
+		   &version, &pos, digest) != 3
+	    || version != 4
+	    || identity != digest)
+	  return AstPtr();
+
+	size_t offset = header_end + 1 - file.data();
+	AstBinary binary(file.data() + offset, file.size() - offset);
+	return binary.load();
+      }
+    catch (const std::invalid_argument& exc)
+      {
+	return AstPtr();
+      }
+  }
+
+  bool store(const std::string& identity, const AstPtr& ast, size_t pos) const
+  {
+    if (! cacheable(*ast))
+      return false;
+
+    std::string name = filename(identity);
+    static std::atomic<unsigned int> counter(0);
+    std::ostringstream tmpname;
+    tmpname << name << ".tmp." << getpid() << "." << counter++;
+
+    {
+      std::ofstream out(tmpname.str(), std::ios::out | std::ios::binary);
+      out << "grakopp-cache 4 " << pos << " " << identity << "\n";
+      write_binary(out, *ast);
+      out.close();
+      if (! out)
+	{
+	  unlink(tmpname.str().c_str());
+	  return false;
+	}
+    }
+    if (rename(tmpname.str().c_str(), name.c_str()) != 0)
+      {
+	unlink(tmpname.str().c_str());
+	return false;
+      }
+    return true;
+  }
+};
+
+
+/* Invoke RULE (named NAME) on the buffer of PARSER, unless the result
+   is in CACHE already.  The generated parsers provide version__().  */
+template <typename _Parser>
+AstPtr cached_call(ParseCache& cache, _Parser& parser,
+		   typename _Parser::rule_method_t rule, const std::string& name)
+{
+  Buffer& buffer = *parser._buffer;
+  std::string identity = ParseCache::identity(buffer, _Parser::version__(), name);
+
+  size_t pos;
+  AstPtr ast = cache.lookup(identity, pos);
+  if (ast)
+    {
+      buffer.go_to(pos);
+      return ast;
+    }
+
+  ast = (parser.*rule)();
+  if (! ast->as_exception())
+    cache.store(identity, ast, buffer._pos);
+  return ast;
+}
+
+#endif /* _GRAKOPP_CACHE_HPP */
@@ -0,0 +1,583 @@
+/* grakopp/events.hpp - Grako++ parse events header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_EVENTS_HPP
+#define _GRAKOPP_EVENTS_HPP 1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "ast-io.hpp"
+
+
+/* In event mode, a rule does not build an AST, but reports what it
+   matches to a handler, like a SAX parser: the start and end of the
+   rules, the named elements and the closures, and the tokens and
+   patterns in between, in the order of the input.  The generated
+   parsers provide an event emitter for every rule _NAME_() as the
+   overload _NAME_(EmitEvents()), see Parser::set_event_handler.
+
+   The names are the string literals of the generated parser, so they
+   stay valid.  The text of a token points into the buffer.  The end
+   events are only reported if the rule, element or closure matched.
+   If the parse fails, the handler may have seen the events before
+   the failure, but never those of an alternative that was given up
+   for another one.  */
+class ParseEventHandler
+{
+public:
+  virtual ~ParseEventHandler() {}
+
+  virtual void rule_start(const char* /* name */, size_t /* pos */) {}
+  virtual void rule_end(const char* /* name */, size_t /* pos */) {}
+  /* A named element NAME:exp, or NAME+:exp if LIST is set.  The
+     overrides @:exp and @+:exp are named "@".  */
+  virtual void field_start(const char* /* name */, bool /* list */) {}
+  virtual void field_end(const char* /* name */) {}
+  /* A closure, which is a list in the AST.  */
+  virtual void list_start(size_t /* pos */) {}
+  virtual void list_end(size_t /* pos */) {}
+  /* A token or the text matched by a pattern.  */
+  virtual void token(const char* /* text */, size_t /* length */,
+		     size_t /* pos */) {}
+};
+
+
+class ParseEvent
+{
+public:
+  enum Kind
+  {
+    RULE_START,
+    RULE_END,
+    FIELD_START,
+    FIELD_END,
+    LIST_START,
+    LIST_END,
+    TOKEN,
+    /* Only in the replays of ParseEventQueue: the replay of another
+       rule, from _pos to _length.  */
+    REPLAY
+  };
+
+  ParseEvent(Kind kind, const char* name, size_t pos, size_t length=0)
+    : _kind(kind), _name(name), _pos(pos), _length(length)
+  {
+  }
+
+  Kind _kind;
+  /* The name of a rule or element, or the text of a token.  */
+  const char* _name;
+  size_t _pos;
+  /* The length of a token, or 1 for a named list element.  */
+  size_t _length;
+
+  void send(ParseEventHandler& handler) const
+  {
+    switch (_kind)
+      {
+      case RULE_START:
+	handler.rule_start(_name, _pos);
+	break;
+      case RULE_END:
+	handler.rule_end(_name, _pos);
+	break;
+      case FIELD_START:
+	handler.field_start(_name, _length != 0);
+	break;
+      case FIELD_END:
+	handler.field_end(_name);
+	break;
+      case LIST_START:
+	handler.list_start(_pos);
+	break;
+      case LIST_END:
+	handler.list_end(_pos);
+	break;
+      case TOKEN:
+	handler.token(_name, _length, _pos);
+	break;
+      case REPLAY:
+	break;
+      }
+  }
+};
+
+
+/* The events of a parse on their way to the handler.  The generated
+   emitters open a speculation with begin before an option of a
+   choice, an optional element or an iteration of a closure, and
+   close it with end, which keeps its events if it matched and drops
+   them if not.  While a speculation is open, the events are kept
+   here, and once none is, they are sent to the handler.
+
+   A cut commits the innermost speculation: if it fails after the
+   cut, so does the choice, optional element or closure, instead of
+   trying the next alternative.  So once all open speculations are
+   cut, a failure fails the whole parse, and the events are sent right
+   away.  Like in the recognizers, a cut inside a named element only
+   commits the speculations inside it, so the element is a barrier
+   for cuts.  What is kept is thus bounded by the speculations that
+   are not cut: with a grammar that cuts after the opening token of
+   its nested structures (like '{' ~ in JSON), by the nesting depth
+   of the input and not by its size.  _high_water is the most events
+   kept at once.  Without a handler, the events are dropped and the
+   emitters work like the recognizers.
+
+   A rule that matches while its events are kept can be memoized with
+   its events: end_rule copies them to _replays, and replay adds them
+   again when the rule is called at the same position after
+   backtracking.  The replays of the memoized rules inside it are
+   referenced, not copied, so every event is copied once.  A rule is
+   not memoized if some of its events were sent already, or if a cut
+   in it committed a speculation of its caller, as a replay does not
+   repeat the cut.  Once no speculation is open, the parse can not
+   backtrack, so _replays is emptied and the memoized replays expire
+   (with _generation).  */
+class ParseEventQueue
+{
+public:
+  enum Scope
+  {
+    SPECULATION,
+    CUT,
+    BARRIER
+  };
+
+  /* The events of a memoized rule, see end_rule.  */
+  struct Replay
+  {
+    size_t _generation;
+    size_t _begin;
+    size_t _end;
+  };
+
+  ParseEventQueue()
+    : _handler(nullptr), _sent(0), _open(0), _high_water(0), _generation(0)
+  {
+  }
+
+  ParseEventHandler* _handler;
+  std::vector<ParseEvent> _events;
+  /* The number of events that came before _events.  */
+  size_t _sent;
+  /* The open scopes, innermost last, with the number of events
+     before them, and the number of speculations among them that are
+     not cut.  */
+  std::vector<std::pair<Scope, size_t> > _scopes;
+  size_t _open;
+  size_t _high_water;
+
+  /* The rules being parsed, innermost last, with the number of events
+     before them, and the lowest such number of a speculation they
+     cut.  */
+  std::vector<std::pair<size_t, size_t> > _rules;
+  /* The memoized rules whose events are kept, in input order.  */
+  struct Recorded
+  {
+    size_t _begin;
+    size_t _end;
+    Replay _replay;
+  };
+  std::vector<Recorded> _recorded;
+  std::vector<ParseEvent> _replays;
+  size_t _generation;
+
+  void clear()
+  {
+    _events.clear();
+    _sent = 0;
+    _scopes.clear();
+    _open = 0;
+    _high_water = 0;
+    _rules.clear();
+    _recorded.clear();
+    _replays.clear();
+    _generation++;
+  }
+
+  /* Forget all replays, for example because the text of the tokens
+     changed.  */
+  void expire()
+  {
+    _recorded.clear();
+    _replays.clear();
+    _generation++;
+  }
+
+  void add(ParseEvent::Kind kind, const char* name, size_t pos, size_t length=0)
+  {
+    if (! _handler)
+      return;
+    if (_open == 0)
+      {
+	ParseEvent(kind, name, pos, length).send(*_handler);
+	_sent++;
+      }
+    else
+      {
+	_events.emplace_back(kind, name, pos, length);
+	if (_events.size() > _high_water)
+	  _high_water = _events.size();
+      }
+  }
+
+  void begin()
+  {
+    _scopes.emplace_back(SPECULATION, _sent + _events.size());
+    _open++;
+  }
+
+  void end(bool keep)
+  {
+    std::pair<Scope, size_t> scope = _scopes.back();
+    _scopes.pop_back();
+    if (scope.first == SPECULATION)
+      _open--;
+
+    if (! keep)
+      {
+	/* If some of the events were sent already, the speculation
+	   was cut and the whole parse fails.  */
+	size_t start = std::max(scope.second, _sent);
+	_events.erase(_events.begin() + (start - _sent), _events.end());
+	while (! _recorded.empty() && _recorded.back()._begin >= start)
+	  _recorded.pop_back();
+      }
+    else if (_open == 0)
+      flush();
+  }
+
+  void cut()
+  {
+    if (_scopes.empty() || _scopes.back().first != SPECULATION)
+      return;
+    _scopes.back().first = CUT;
+    _open--;
+    if (! _rules.empty())
+      _rules.back().second = std::min(_rules.back().second,
+				      _scopes.back().second);
+    if (_open == 0)
+      flush();
+  }
+
+  void begin_rule()
+  {
+    size_t mark = _sent + _events.size();
+    _rules.emplace_back(mark, mark);
+  }
+
+  /* End the innermost rule.  Returns true and sets REPLAY if the rule
+     matched and can be memoized with its events.  */
+  bool end_rule(bool ok, Replay& replay)
+  {
+    std::pair<size_t, size_t> rule = _rules.back();
+    _rules.pop_back();
+    if (! _rules.empty())
+      _rules.back().second = std::min(_rules.back().second, rule.second);
+    if (! ok || ! _handler || rule.first < _sent || rule.second < rule.first)
+      return false;
+
+    /* Copy the events, and reference the memoized rules among them.  */
+    size_t end = _sent + _events.size();
+    size_t first = _recorded.size();
+    while (first > 0 && _recorded[first - 1]._begin >= rule.first)
+      first--;
+    replay = Replay { _generation, _replays.size(), 0 };
+    size_t pos = rule.first;
+    for (size_t i = first; i < _recorded.size(); i++)
+      {
+	const Recorded& inner = _recorded[i];
+	copy(pos, inner._begin);
+	_replays.emplace_back(ParseEvent::REPLAY, nullptr,
+			      inner._replay._begin, inner._replay._end);
+	pos = inner._end;
+      }
+    copy(pos, end);
+    replay._end = _replays.size();
+
+    _recorded.resize(first);
+    _recorded.push_back(Recorded { rule.first, end, replay });
+    return true;
+  }
+
+  /* Add the events of a memoized rule again.  Returns false if the
+     replay expired.  */
+  bool replay(const Replay& replay)
+  {
+    if (replay._generation != _generation || ! _handler)
+      return false;
+    size_t begin = _sent + _events.size();
+    add_replay(replay._begin, replay._end);
+    size_t end = _sent + _events.size();
+    if (begin >= _sent)
+      _recorded.push_back(Recorded { begin, end, replay });
+    return true;
+  }
+
+  /* The memory used by the replays.  */
+  size_t replay_bytes() const
+  {
+    return _replays.capacity() * sizeof(ParseEvent)
+      + _recorded.capacity() * sizeof(Recorded);
+  }
+
+  void begin_barrier()
+  {
+    _scopes.emplace_back(BARRIER, _sent + _events.size());
+  }
+
+  void end_barrier()
+  {
+    _scopes.pop_back();
+  }
+
+private:
+  void flush()
+  {
+    if (_handler)
+      for (const ParseEvent& event: _events)
+	event.send(*_handler);
+    _sent += _events.size();
+    _events.clear();
+    expire();
+  }
+
+  /* Copy the kept events from BEGIN to END (counted like _sent) to
+     the replays.  */
+  void copy(size_t begin, size_t end)
+  {
+    _replays.insert(_replays.end(), _events.begin() + (begin - _sent),
+		    _events.begin() + (end - _sent));
+  }
+
+  void add_replay(size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; i++)
+      {
+	const ParseEvent& event = _replays[i];
+	if (event._kind == ParseEvent::REPLAY)
+	  add_replay(event._pos, event._length);
+	else
+	  add(event._kind, event._name, event._pos, event._length);
+      }
+  }
+};
+
+
+/* Writes the events as text, one per line and indented by nesting,
+   for the --events option of the generated parsers:
+
+     rule NAME POS ... end NAME POS
+     field NAME ... end NAME (NAME+ for a list element)
+     list POS ... end list POS
+     token POS "TEXT"
+
+   The text of a token is quoted like a JSON string.  */
+class ParseEventPrinter : public ParseEventHandler
+{
+public:
+  explicit ParseEventPrinter(std::ostream& out)
+    : _out(out), _level(0)
+  {
+  }
+
+  std::ostream& _out;
+  int _level;
+
+  void rule_start(const char* name, size_t pos) override
+  {
+    indent() << "rule " << name << " " << pos << "\n";
+    _level++;
+  }
+
+  void rule_end(const char* name, size_t pos) override
+  {
+    _level--;
+    indent() << "end " << name << " " << pos << "\n";
+  }
+
+  void field_start(const char* name, bool list) override
+  {
+    indent() << "field " << name << (list ? "+" : "") << "\n";
+    _level++;
+  }
+
+  void field_end(const char* name) override
+  {
+    _level--;
+    indent() << "end " << name << "\n";
+  }
+
+  void list_start(size_t pos) override
+  {
+    indent() << "list " << pos << "\n";
+    _level++;
+  }
+
+  void list_end(size_t pos) override
+  {
+    _level--;
+    indent() << "end list " << pos << "\n";
+  }
+
+  void token(const char* text, size_t length, size_t pos) override
+  {
+    std::string quoted;
+    AstJsonWriter::escape(quoted, text, length);
+    indent() << "token " << pos << " " << quoted << "\n";
+  }
+
+private:
+  std::ostream& indent()
+  {
+    for (int i = 0; i < _level; i++)
+      _out << "  ";
+    return _out;
+  }
+};
+
+
+/* Checks the events of a parse against the AST of the same parse, for
+   the --events --test options of the generated parsers.  The starts
+   and ends must be nested and match, the tokens must follow each
+   other in the input within their rules, and every string and key in
+   the AST must have been reported as a token or field.  This notices
+   events of alternatives that were given up, and events that got
+   lost.  The AST has no closure iterations and groups, so it can not
+   be rebuilt from the events exactly.  */
+class ParseEventChecker : public ParseEventHandler
+{
+public:
+  ParseEventChecker()
+    : _pos(0)
+  {
+  }
+
+  /* The first problem found, or empty.  */
+  std::string _error;
+  /* The end of the last token, or the start of the innermost rule.  */
+  size_t _pos;
+  /* The open rules, fields and lists (with a null name).  */
+  std::vector<std::pair<ParseEvent::Kind, const char*> > _open;
+  std::multiset<std::string> _tokens;
+  std::set<std::string> _fields;
+
+  void rule_start(const char* name, size_t pos) override
+  {
+    at(pos, name);
+    _open.emplace_back(ParseEvent::RULE_START, name);
+  }
+
+  void rule_end(const char* name, size_t pos) override
+  {
+    at(pos, name);
+    close(ParseEvent::RULE_START, name);
+  }
+
+  void field_start(const char* name, bool) override
+  {
+    _fields.insert(name);
+    _open.emplace_back(ParseEvent::FIELD_START, name);
+  }
+
+  void field_end(const char* name) override
+  {
+    close(ParseEvent::FIELD_START, name);
+  }
+
+  void list_start(size_t pos) override
+  {
+    at(pos, "list");
+    _open.emplace_back(ParseEvent::LIST_START, nullptr);
+  }
+
+  void list_end(size_t pos) override
+  {
+    at(pos, "list");
+    close(ParseEvent::LIST_START, nullptr);
+  }
+
+  void token(const char* text, size_t length, size_t pos) override
+  {
+    at(pos, "token");
+    _pos = pos + length;
+    _tokens.insert(std::string(text, length));
+  }
+
+  /* Returns the first problem with the events of a parse that
+     returned MATCHED and EXPECTED, or an empty string.  */
+  std::string check(bool matched, const Ast& expected)
+  {
+    if (expected.as_exception())
+      return matched ? "events matched, the AST failed" : "";
+    if (! matched)
+      return "events failed, the AST matched";
+    if (_error.empty() && ! _open.empty())
+      _error = "unclosed event";
+    if (_error.empty())
+      covers(expected);
+    return _error;
+  }
+
+private:
+  void at(size_t pos, const char* what)
+  {
+    if (pos < _pos && _error.empty())
+      _error = std::string(what) + " at " + std::to_string(pos)
+	+ " before " + std::to_string(_pos);
+    _pos = pos;
+  }
+
+  void close(ParseEvent::Kind kind, const char* name)
+  {
+    if (_open.empty() || _open.back().first != kind
+	|| (name && strcmp(_open.back().second, name) != 0))
+      {
+	if (_error.empty())
+	  _error = std::string("unmatched end of ") + (name ? name : "list");
+	return;
+      }
+    _open.pop_back();
+  }
+
+  void covers(const Ast& ast)
+  {
+    if (const AstString* str = ast.as_string())
+      {
+	auto token = _tokens.find(*str);
+	if (token == _tokens.end())
+	  _error = "no token for " + *str;
+	else
+	  _tokens.erase(token);
+      }
+    else if (const AstList* list = ast.as_list())
+      {
+	for (auto& child: *list)
+	  covers(*child);
+      }
+    else if (const AstMap* map = ast.as_map())
+      {
+	for (auto& pair: *map)
+	  {
+	    if (! _fields.count(pair.first))
+	      _error = "no field for " + pair.first;
+	    covers(*pair.second);
+	  }
+      }
+  }
+};
+
+#endif /* GRAKOPP_EVENTS_HPP */
@@ -10,6 +10,8 @@
 #ifndef _GRAKOPP_EXCEPTIONS_HPP
 #define _GRAKOPP_EXCEPTIONS_HPP 1
 
+#include <cstring>
+#include <memory>
 #include <string>
 #include <iostream>
 #include <boost/algorithm/string/replace.hpp>
@@ -137,7 +139,7 @@ public:
 
 class FailedLookahead : public FailedParseBase
 {
-  const std::string& _msg;
+  const std::string _msg;
 public:
   FailedLookahead(const std::string& msg) : FailedParseBase(), _msg(msg) {}
 
@@ -161,7 +163,7 @@ public:
 
 class FailedSemantics : public FailedParseBase
 {
-  const std::string& _msg;
+  const std::string _msg;
 public:
   FailedSemantics(const std::string& msg) : FailedParseBase(), _msg(msg) {}
 
@@ -183,4 +185,23 @@ public:
   void _throw() { throw *this; }
 };
 
+
+/* Make the exception of type TYPE (as returned by type()) from
+   INITIALIZER, or return a null pointer if the type is unknown.  */
+inline std::shared_ptr<FailedParseBase> make_failed_parse(const std::string& type,
+							   const std::string& initializer)
+{
+  if (type == "FailedParse")
+    return std::make_shared<FailedParse>(initializer);
+  else if (type == "FailedToken")
+    return std::make_shared<FailedToken>(initializer);
+  else if (type == "FailedPattern")
+    return std::make_shared<FailedPattern>(initializer);
+  else if (type == "FailedLookahead")
+    return std::make_shared<FailedLookahead>(initializer);
+  else if (type == "FailedSemantics")
+    return std::make_shared<FailedSemantics>(initializer);
+  return std::shared_ptr<FailedParseBase>();
+}
+
 #endif /* GRAKOPP_EXCEPTIONS_HPP */
@@ -14,7 +14,10 @@
 #include "exceptions.hpp"
 #include "ast.hpp"
 #include "parser.hpp"
+#include "state.hpp"
 
 #define RETURN_IF_EXC(ast) if (ast->as_exception()) return ast
+#define GOTO_IF_EXC(ast, label) if (ast->as_exception()) goto label
+#define GOTO_IF_FAIL(result, label) if (! result) goto label
 
 #endif /* GRAKOPP_GRAKOPP_HPP */
@@ -0,0 +1,581 @@
+/* grakopp/memo.hpp - Grako++ memoization cache header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_MEMO_HPP
+#define _GRAKOPP_MEMO_HPP 1
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+/* True if std::hash is implemented for T.  */
+template <typename T, typename = void>
+struct memo_hashable : std::false_type
+{
+};
+
+template <typename T>
+struct memo_hashable<T, decltype(void(std::hash<T>()(std::declval<const T&>())))>
+  : std::true_type
+{
+};
+
+
+/* The hash of the state in a memoization key, which is compared
+   first.  States without std::hash all have the same hash, and are
+   compared with operator<.  */
+template <typename State, bool Hashable = memo_hashable<State>::value>
+struct memo_state_traits
+{
+  static size_t hash(const State&)
+  {
+    return 0;
+  }
+
+  static bool equal(const State& left, const State& right)
+  {
+    return !(left < right) && !(right < left);
+  }
+};
+
+template <typename State>
+struct memo_state_traits<State, true>
+{
+  static size_t hash(const State& state)
+  {
+    return std::hash<State>()(state);
+  }
+
+  static bool equal(const State& left, const State& right)
+  {
+    return left == right;
+  }
+};
+
+
+/* The memory of the caches is estimated (see Parser::stats).  A node
+   of a std::map or std::unordered_map takes about four pointers in
+   addition to its value, and a string takes its capacity on the heap,
+   unless it is short enough to be stored in the string itself.  */
+static constexpr size_t memo_node_overhead = 4 * sizeof(void*);
+
+inline size_t string_heap_bytes(const std::string& str)
+{
+  const char *data = str.data();
+  const char *self = reinterpret_cast<const char*>(&str);
+  if (data >= self && data < self + sizeof(str))
+    return 0;
+  return str.capacity() + 1;
+}
+
+
+/* The memoization cache of a parser, which maps a position, a rule
+   name and a state to VALUE.  There is one bucket per position,
+   ordered by position, so that the cut operator can drop all results
+   before a position at once.  Only a few rules are tried at each
+   position, so the buckets are small arrays, searched by the hash of
+   the state and the rule name.  States are never compared with
+   operator< if they can be hashed.  */
+template <typename State, typename Value>
+class MemoTable
+{
+public:
+  using key_type = std::pair<std::string, State>;
+  using mapped_type = Value;
+  using traits = memo_state_traits<State>;
+
+private:
+  struct Entry
+  {
+    Entry(size_t hash, key_type&& key, Value&& value, uint64_t used)
+      : _hash(hash), _key(std::move(key)), _value(std::move(value)),
+	_used(used)
+    {
+    }
+
+    size_t _hash;
+    key_type _key;
+    Value _value;
+    /* When the entry was last inserted or found, for evict_unused.  */
+    uint64_t _used;
+  };
+
+  using bucket_type = std::vector<Entry>;
+
+  std::map<size_t, bucket_type> _buckets;
+  size_t _size;
+  uint64_t _clock;
+  /* The estimated memory of the cache, and the high-water marks of
+     it and the size since the last clear.  */
+  size_t _bytes;
+  size_t _high_water;
+  size_t _bytes_high_water;
+
+  static size_t hash(const key_type& key)
+  {
+    return traits::hash(key.second);
+  }
+
+  static size_t bucket_bytes(const bucket_type& bucket)
+  {
+    size_t bytes = memo_node_overhead + sizeof(std::pair<const size_t, bucket_type>)
+      + bucket.capacity() * sizeof(Entry);
+    for (const Entry& entry: bucket)
+      bytes += string_heap_bytes(entry._key.first);
+    return bytes;
+  }
+
+  void update_high_water()
+  {
+    _high_water = std::max(_high_water, _size);
+    _bytes_high_water = std::max(_bytes_high_water, _bytes);
+  }
+
+  Entry* find_entry(bucket_type& bucket, size_t hash, const key_type& key)
+  {
+    for (Entry& entry: bucket)
+      if (entry._hash == hash && entry._key.first == key.first
+	  && traits::equal(entry._key.second, key.second))
+	return &entry;
+    return nullptr;
+  }
+
+public:
+  MemoTable()
+    : _size(0), _clock(0), _bytes(0), _high_water(0), _bytes_high_water(0)
+  {
+  }
+
+  size_t size() const
+  {
+    return _size;
+  }
+
+  size_t bytes() const
+  {
+    return _bytes;
+  }
+
+  size_t high_water() const
+  {
+    return _high_water;
+  }
+
+  size_t bytes_high_water() const
+  {
+    return _bytes_high_water;
+  }
+
+  void clear()
+  {
+    _buckets.clear();
+    _size = 0;
+    _bytes = 0;
+    _high_water = 0;
+    _bytes_high_water = 0;
+  }
+
+  /* Drop all results like clear, but keep the buckets at the lowest
+     positions, with the capacity of their arrays, as long as they
+     take at most HIGH_WATER bytes.  The next parse with the same
+     parser likely memoizes at the same positions, and then does not
+     allocate them again.  The other buckets are freed, so that a
+     large document does not keep its memory alive.  */
+  void clear(size_t high_water)
+  {
+    size_t kept = 0;
+    auto bucket = _buckets.begin();
+    for (; bucket != _buckets.end(); bucket++)
+      {
+	bucket_type& entries = bucket->second;
+	entries.clear();
+	size_t bytes = bucket_bytes(entries);
+	if (kept + bytes > high_water)
+	  break;
+	kept += bytes;
+      }
+    _buckets.erase(bucket, _buckets.end());
+    _size = 0;
+    _bytes = kept;
+    _high_water = 0;
+    _bytes_high_water = kept;
+  }
+
+  /* Returns the value for KEY at POS, or a null pointer.  */
+  Value* find(size_t pos, const key_type& key)
+  {
+    auto bucket = _buckets.find(pos);
+    if (bucket == _buckets.end())
+      return nullptr;
+    Entry *entry = find_entry(bucket->second, hash(key), key);
+    if (! entry)
+      return nullptr;
+    entry->_used = _clock++;
+    return &entry->_value;
+  }
+
+  void insert(size_t pos, key_type key, Value value)
+  {
+    size_t buckets = _buckets.size();
+    bucket_type& bucket = _buckets[pos];
+    if (_buckets.size() != buckets)
+      _bytes += memo_node_overhead + sizeof(std::pair<const size_t, bucket_type>);
+    size_t key_hash = hash(key);
+    Entry *entry = find_entry(bucket, key_hash, key);
+    if (entry)
+      {
+	entry->_value = std::move(value);
+	entry->_used = _clock++;
+      }
+    else
+      {
+	size_t capacity = bucket.capacity();
+	bucket.emplace_back(key_hash, std::move(key), std::move(value), _clock++);
+	_bytes += (bucket.capacity() - capacity) * sizeof(Entry)
+	  + string_heap_bytes(bucket.back()._key.first);
+	_size++;
+	update_high_water();
+      }
+  }
+
+  /* Drop all results at positions up to and including POS.  Returns
+     the number of dropped results.  */
+  size_t erase_through(size_t pos)
+  {
+    size_t erased = 0;
+    auto end = _buckets.upper_bound(pos);
+    for (auto bucket = _buckets.begin(); bucket != end; bucket++)
+      {
+	erased += bucket->second.size();
+	_bytes -= bucket_bytes(bucket->second);
+      }
+    _buckets.erase(_buckets.begin(), end);
+    _size -= erased;
+    return erased;
+  }
+
+  /* Drop the results at the lowest positions until at most SIZE
+     are left.  Returns the number of dropped results.  */
+  size_t evict_lowest(size_t size)
+  {
+    size_t evicted = 0;
+    while (_size > size)
+      {
+	auto bucket = _buckets.begin();
+	evicted += bucket->second.size();
+	_size -= bucket->second.size();
+	_bytes -= bucket_bytes(bucket->second);
+	_buckets.erase(bucket);
+      }
+    return evicted;
+  }
+
+  /* Drop the least recently used results until SIZE are left.
+     Returns the number of dropped results.  */
+  size_t evict_unused(size_t size)
+  {
+    if (_size <= size)
+      return 0;
+
+    std::vector<uint64_t> used;
+    used.reserve(_size);
+    for (auto& bucket: _buckets)
+      for (auto& entry: bucket.second)
+	used.push_back(entry._used);
+    /* Every entry has a different time, so exactly the entries before
+       the SIZE last ones are dropped.  */
+    auto keep = used.end() - size;
+    std::nth_element(used.begin(), keep, used.end());
+    uint64_t oldest = size ? *keep : _clock;
+
+    size_t evicted = 0;
+    for (auto bucket = _buckets.begin(); bucket != _buckets.end(); )
+      {
+	bucket_type& entries = bucket->second;
+	size_t before = entries.size();
+	_bytes -= bucket_bytes(entries);
+	entries.erase(std::remove_if(entries.begin(), entries.end(),
+				     [oldest] (const Entry& entry) {
+				       return entry._used < oldest;
+				     }), entries.end());
+	evicted += before - entries.size();
+	if (entries.empty())
+	  bucket = _buckets.erase(bucket);
+	else
+	  {
+	    _bytes += bucket_bytes(entries);
+	    bucket++;
+	  }
+      }
+    _size -= evicted;
+    return evicted;
+  }
+
+  /* Adjust the table to an edit of the text that replaced the
+     characters from OFFSET to END, which moved the text behind them
+     by DELTA (modulo the size of size_t).  The results from OFFSET to
+     END are dropped, and so are those before OFFSET for which
+     KEEP(value) is false.  The results behind END are moved to their
+     new positions, after MOVE(value) adjusted them.  The other
+     results stay in place, and the moved ones are not copied, so this
+     takes time in proportion to the results that change, plus one
+     test per result before OFFSET.  */
+  template <typename Keep, typename Move>
+  void edit(size_t offset, size_t end, size_t delta, Keep keep, Move move)
+  {
+    auto first = _buckets.lower_bound(offset);
+    for (auto bucket = _buckets.begin(); bucket != first; )
+      {
+	bucket_type& entries = bucket->second;
+	auto kept = std::remove_if(entries.begin(), entries.end(),
+				   [&keep] (const Entry& entry) {
+				     return ! keep(entry._value);
+				   });
+	if (kept == entries.end())
+	  {
+	    bucket++;
+	    continue;
+	  }
+	_size -= entries.end() - kept;
+	_bytes -= bucket_bytes(entries);
+	entries.erase(kept, entries.end());
+	if (entries.empty())
+	  bucket = _buckets.erase(bucket);
+	else
+	  {
+	    _bytes += bucket_bytes(entries);
+	    bucket++;
+	  }
+      }
+
+    auto last = _buckets.lower_bound(end);
+    for (auto bucket = first; bucket != last; bucket++)
+      {
+	_size -= bucket->second.size();
+	_bytes -= bucket_bytes(bucket->second);
+      }
+    last = _buckets.erase(first, last);
+    if (delta == 0)
+      return;
+
+    /* All new positions are at or behind OFFSET, so the moved buckets
+       go to the end in the same order.  */
+    std::vector<std::pair<size_t, bucket_type> > moved;
+    moved.reserve(std::distance(last, _buckets.end()));
+    for (auto bucket = last; bucket != _buckets.end(); bucket++)
+      {
+	for (Entry& entry: bucket->second)
+	  move(entry._value);
+	moved.emplace_back(bucket->first + delta, std::move(bucket->second));
+      }
+    _buckets.erase(last, _buckets.end());
+    for (auto& bucket: moved)
+      _buckets.emplace_hint(_buckets.end(), bucket.first, std::move(bucket.second));
+  }
+
+  /* Call FUNC(pos, key, value) for all results, in order of
+     position.  */
+  template <typename Func>
+  void for_each(Func func) const
+  {
+    for (auto& bucket: _buckets)
+      for (auto& entry: bucket.second)
+	func(bucket.first, entry._key, entry._value);
+  }
+};
+
+
+/* A map from rule names and states to VALUE, hashed like the keys of
+   MemoTable.  */
+template <typename State, typename Value,
+	  bool Hashable = memo_hashable<State>::value>
+struct memo_key_map
+{
+  using type = std::map<std::pair<std::string, State>, Value>;
+};
+
+template <typename State, typename Value>
+struct memo_key_map<State, Value, true>
+{
+  struct hash
+  {
+    size_t operator()(const std::pair<std::string, State>& key) const
+    {
+      size_t seed = std::hash<std::string>()(key.first);
+      return seed ^ (std::hash<State>()(key.second) + 0x9e3779b9
+		     + (seed << 6) + (seed >> 2));
+    }
+  };
+
+  using type = std::unordered_map<std::pair<std::string, State>, Value, hash>;
+};
+
+
+/* The memoized failures of a parser.  Most results in the cache are
+   failures, and all that is needed to replay one is whether the rule
+   failed after a cut.  So instead of an entry in a MemoTable, a
+   failure takes two bits in a bitmap of the positions, one per rule
+   name and state.  The bitmaps are sparse, in chunks of 64
+   positions.  */
+template <typename State>
+class FailureTable
+{
+public:
+  using key_type = std::pair<std::string, State>;
+
+  /* The bits returned by find.  */
+  enum
+  {
+    FAILED = 1,
+    CUT = 2
+  };
+
+private:
+  struct Chunk
+  {
+    Chunk() : _failed(0), _cut(0) {}
+
+    uint64_t _failed;
+    uint64_t _cut;
+  };
+
+  using bitmap_type = std::map<size_t, Chunk>;
+
+  typename memo_key_map<State, bitmap_type>::type _bitmaps;
+  size_t _size;
+  /* The number of chunks, and the high-water marks of it and the size
+     since the last clear.  */
+  size_t _chunks;
+  size_t _high_water;
+  size_t _chunks_high_water;
+
+  size_t bytes(size_t chunks) const
+  {
+    return _bitmaps.size() * (memo_node_overhead + sizeof(std::pair<key_type, bitmap_type>))
+      + chunks * (memo_node_overhead + sizeof(std::pair<const size_t, Chunk>));
+  }
+
+public:
+  FailureTable()
+    : _size(0), _chunks(0), _high_water(0), _chunks_high_water(0)
+  {
+  }
+
+  /* The number of failures.  */
+  size_t size() const
+  {
+    return _size;
+  }
+
+  /* The estimated memory of the bitmaps (the rule names are not
+     counted).  */
+  size_t bytes() const
+  {
+    return bytes(_chunks);
+  }
+
+  size_t high_water() const
+  {
+    return _high_water;
+  }
+
+  size_t bytes_high_water() const
+  {
+    return bytes(_chunks_high_water);
+  }
+
+  void clear()
+  {
+    _bitmaps.clear();
+    _size = 0;
+    _chunks = 0;
+    _high_water = 0;
+    _chunks_high_water = 0;
+  }
+
+  /* Returns FAILED, possibly with CUT, if KEY failed at POS, and 0
+     otherwise.  */
+  int find(size_t pos, const key_type& key) const
+  {
+    auto bitmap = _bitmaps.find(key);
+    if (bitmap == _bitmaps.end())
+      return 0;
+    auto chunk = bitmap->second.find(pos / 64);
+    if (chunk == bitmap->second.end())
+      return 0;
+    uint64_t bit = uint64_t(1) << (pos % 64);
+    if (! (chunk->second._failed & bit))
+      return 0;
+    return FAILED | ((chunk->second._cut & bit) ? CUT : 0);
+  }
+
+  void insert(size_t pos, const key_type& key, bool cut)
+  {
+    bitmap_type& bitmap = _bitmaps[key];
+    size_t chunks = bitmap.size();
+    Chunk& chunk = bitmap[pos / 64];
+    _chunks += bitmap.size() - chunks;
+    _chunks_high_water = std::max(_chunks_high_water, _chunks);
+    uint64_t bit = uint64_t(1) << (pos % 64);
+    if (! (chunk._failed & bit))
+      _high_water = std::max(_high_water, ++_size);
+    chunk._failed |= bit;
+    if (cut)
+      chunk._cut |= bit;
+    else
+      chunk._cut &= ~bit;
+  }
+
+  /* Drop all failures at positions up to and including POS.  Returns
+     the number of dropped failures.  */
+  size_t erase_through(size_t pos)
+  {
+    size_t size = _size;
+    size_t last = pos / 64;
+    /* The bits of the positions up to POS in the last chunk.  */
+    uint64_t mask = (pos % 64 == 63) ? ~uint64_t(0)
+      : (uint64_t(1) << (pos % 64 + 1)) - 1;
+
+    for (auto bitmap = _bitmaps.begin(); bitmap != _bitmaps.end(); )
+      {
+	bitmap_type& chunks = bitmap->second;
+	auto chunk = chunks.begin();
+	while (chunk != chunks.end() && chunk->first <= last)
+	  {
+	    uint64_t dropped = chunk->first < last ? ~uint64_t(0) : mask;
+	    _size -= __builtin_popcountll(chunk->second._failed & dropped);
+	    chunk->second._failed &= ~dropped;
+	    chunk->second._cut &= ~dropped;
+	    if (chunk->second._failed)
+	      chunk++;
+	    else
+	      {
+		chunk = chunks.erase(chunk);
+		_chunks--;
+	      }
+	  }
+	if (chunks.empty())
+	  bitmap = _bitmaps.erase(bitmap);
+	else
+	  bitmap++;
+      }
+    return size - _size;
+  }
+};
+
+#endif /* GRAKOPP_MEMO_HPP */
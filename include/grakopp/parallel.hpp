@@ -0,0 +1,396 @@
+/* grakopp/parallel.hpp - Grako++ parallel record parsing header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_PARALLEL_HPP
+#define _GRAKOPP_PARALLEL_HPP 1
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "buffer.hpp"
+#include "ast.hpp"
+#include "pool.hpp"
+
+
+/* A fixed set of worker threads with one task queue each.  Workers
+   take tasks from the back of their own queue and steal from the
+   front of the other queues when they run dry.  Tasks are submitted
+   as part of a batch, and wait() returns when the tasks of its batch
+   are finished, so independent callers do not wait for each other.
+   A thread that waits runs queued tasks in the meantime, so a task
+   may itself submit a batch and wait for it without deadlocking the
+   pool.  */
+class WorkStealingPool
+{
+public:
+  using task_t = std::function<void ()>;
+
+  /* The tasks of one caller.  */
+  class Batch
+  {
+  public:
+    Batch() : _pending(0) {}
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+  private:
+    friend class WorkStealingPool;
+
+    /* Submitted and not yet finished tasks, guarded by the mutex of
+       the pool.  */
+    size_t _pending;
+  };
+
+  WorkStealingPool(unsigned int threads=std::thread::hardware_concurrency())
+    : _next(0), _queued(0), _stop(false)
+  {
+    if (threads == 0)
+      threads = 1;
+    for (unsigned int i = 0; i < threads; i++)
+      _queues.emplace_back(new Queue());
+    for (unsigned int i = 0; i < threads; i++)
+      _threads.emplace_back([this, i] () { run(i); });
+  }
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  ~WorkStealingPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cond.notify_all();
+    for (auto& thread: _threads)
+      thread.join();
+  }
+
+  size_t threads() const
+  {
+    return _threads.size();
+  }
+
+  void submit(Batch& batch, task_t task)
+  {
+    Queue& queue = *_queues[_next++ % _queues.size()];
+    {
+      std::lock_guard<std::mutex> lock(queue._mutex);
+      queue._tasks.push_back(Job { std::move(task), &batch });
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _queued++;
+      batch._pending++;
+    }
+    _cond.notify_one();
+    /* A waiting thread may run it.  */
+    _done.notify_all();
+  }
+
+  /* Block until all tasks submitted with BATCH are finished, and run
+     queued tasks (of any batch) while they are not.  */
+  void wait(Batch& batch)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (batch._pending > 0)
+      {
+	if (_queued == 0)
+	  {
+	    _done.wait(lock);
+	    continue;
+	  }
+	_queued--;
+	lock.unlock();
+	execute(_next++ % _queues.size());
+	lock.lock();
+      }
+  }
+
+private:
+  struct Job
+  {
+    task_t _task;
+    Batch* _batch;
+  };
+
+  struct Queue
+  {
+    std::mutex _mutex;
+    std::deque<Job> _tasks;
+  };
+
+  bool pop(size_t self, Job& job)
+  {
+    for (size_t i = 0; i < _queues.size(); i++)
+      {
+	Queue& queue = *_queues[(self + i) % _queues.size()];
+	std::lock_guard<std::mutex> lock(queue._mutex);
+	if (queue._tasks.empty())
+	  continue;
+	if (i == 0)
+	  {
+	    job = std::move(queue._tasks.back());
+	    queue._tasks.pop_back();
+	  }
+	else
+	  {
+	    job = std::move(queue._tasks.front());
+	    queue._tasks.pop_front();
+	  }
+	return true;
+      }
+    return false;
+  }
+
+  /* Run one of the queued tasks.  The caller has claimed it by
+     decrementing _queued.  */
+  void execute(size_t self)
+  {
+    Job job;
+    /* The task we own is in some queue.  */
+    while (! pop(self, job))
+      std::this_thread::yield();
+    job._task();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--job._batch->_pending == 0)
+      _done.notify_all();
+  }
+
+  void run(size_t self)
+  {
+    while (true)
+      {
+	{
+	  std::unique_lock<std::mutex> lock(_mutex);
+	  _cond.wait(lock, [this] () { return _stop || _queued > 0; });
+	  if (_queued == 0)
+	    return;
+	  _queued--;
+	}
+	execute(self);
+      }
+  }
+
+  std::vector<std::unique_ptr<Queue>> _queues;
+  std::vector<std::thread> _threads;
+  std::atomic<size_t> _next;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::condition_variable _done;
+  size_t _queued;
+  bool _stop;
+};
+
+
+/* A record boundary strategy returns the first position at or after
+   POS and before LIMIT where a record may start, or std::string::npos.
+   It only needs to be a good guess: misplaced guesses cost time, not
+   correctness.  The limit is the end of the chunk that asks, so the
+   search never runs through the rest of the buffer.  */
+using record_boundary_t = std::function<size_t (const Buffer& buffer, size_t pos, size_t limit)>;
+
+/* Records start at (or, if AFTER is true, right after) a match of
+   the regular expression PATTERN.  Only matches that end before LIMIT
+   are found.  */
+inline record_boundary_t sync_pattern(const std::string& pattern, bool after=false)
+{
+  return [pattern, after] (const Buffer& buffer, size_t pos, size_t limit) -> size_t {
+    const std::string& text = buffer.text();
+    limit = std::min(limit, text.length());
+    std::smatch match;
+    if (pos >= limit
+	|| ! std::regex_search(text.cbegin() + pos, text.cbegin() + limit,
+			       match, Buffer::compile_re(pattern)))
+      return std::string::npos;
+    size_t found = pos + match.position(0) + (after ? match.length(0) : 0);
+    return found < limit ? found : std::string::npos;
+  };
+}
+
+/* Records start at (or, if AFTER is true, right after) TOKEN.  A token
+   that starts before LIMIT is found even if it extends beyond it.  */
+inline record_boundary_t sync_token(const std::string& token, bool after=false)
+{
+  return [token, after] (const Buffer& buffer, size_t pos, size_t limit) -> size_t {
+    const std::string& text = buffer.text();
+    size_t end = std::min(text.length(), limit + token.length() - 1);
+    if (token.empty() || pos >= limit || pos >= end)
+      return std::string::npos;
+    auto found = std::search(text.cbegin() + pos, text.cbegin() + end,
+			     token.cbegin(), token.cend());
+    if (found == text.cbegin() + end)
+      return std::string::npos;
+    size_t start = (found - text.cbegin()) + (after ? token.length() : 0);
+    return start < limit ? start : std::string::npos;
+  };
+}
+
+
+/* Parses a buffer that consists of a sequence of independent records
+   (all matching the same rule) in parallel.  The buffer is split into
+   chunks of roughly equal size, and each chunk is parsed from its
+   first guessed record boundary on.  The chunks are then stitched
+   together in input order: a chunk whose guessed start does not line
+   up with the end of the records before it is reparsed from the
+   correct position.  */
+template <typename _Parser>
+class RecordParser
+{
+public:
+  using parser_t = _Parser;
+  using rule_method_t = AstPtr (parser_t::*)();
+
+  RecordParser(rule_method_t rule, record_boundary_t boundary,
+	       WorkStealingPool& workers, size_t chunk_size=1 << 20)
+    : _rule(rule), _boundary(boundary), _workers(workers),
+      _chunk_size(chunk_size)
+  {
+  }
+
+  /* Records start where RULE commits to a cut, for grammars without
+     a sync token.  The guess is checked by parsing a record at each
+     position.  The probes overlap, so the parser keeps its memos from
+     one position to the next, and in incremental mode, cuts do not
+     drop them.  So the rules below RULE are parsed only once at each
+     position, and the scan takes time linear in the distance to the
+     boundary instead of quadratic.  */
+  static record_boundary_t cut_boundary(rule_method_t rule)
+  {
+    return [rule] (const Buffer& buffer, size_t pos, size_t limit) -> size_t {
+      BufferPtr probe = std::make_shared<Buffer>();
+      parser_t parser;
+      probe->share(buffer);
+      parser.set_buffer(probe);
+      parser.set_incremental(true);
+      limit = std::min(limit, buffer.len());
+      for (; pos < limit; pos++)
+	{
+	  probe->_pos = pos;
+	  parser._state = typename parser_t::State();
+	  AstPtr ast = (parser.*rule)();
+	  if (! ast->as_exception() && ast->_cut)
+	    return pos;
+	}
+      return std::string::npos;
+    };
+  }
+
+  /* Returns a list of the record ASTs in input order, or the
+     exception of the first record that fails.  */
+  AstPtr parse(const BufferPtr& buffer)
+  {
+    size_t length = buffer->len();
+    size_t chunks = std::max<size_t>(1, length / _chunk_size);
+    std::vector<size_t> limits;
+    for (size_t i = 0; i <= chunks; i++)
+      limits.push_back(length * i / chunks);
+
+    std::vector<std::vector<Record>> results(chunks);
+    WorkStealingPool::Batch batch;
+    for (size_t i = 1; i < chunks; i++)
+      _workers.submit(batch, [this, i, &buffer, &limits, &results] () {
+	  size_t begin = _boundary(*buffer, limits[i], limits[i + 1]);
+	  if (begin < limits[i + 1])
+	    parse_chunk(*buffer, begin, limits[i + 1], results[i]);
+	});
+    /* The first chunk starts at a known boundary, and we don't sit
+       idle while the workers are busy.  */
+    parse_chunk(*buffer, 0, limits[1], results[0]);
+    _workers.wait(batch);
+
+    /* Stitch the chunks together.  */
+    auto handle = _parsers.acquire();
+    parser_t& parser = handle.parse_shared(*buffer);
+    AstPtr records = std::make_shared<Ast>(AstList());
+    AstList& list = records->the_list();
+    size_t pos = skip(parser, 0);
+
+    for (size_t i = 0; i < chunks; i++)
+      {
+	std::vector<Record>& chunk = results[i];
+	auto el = std::lower_bound(chunk.begin(), chunk.end(), pos,
+				   [] (const Record& rec, size_t start) { return rec._start < start; });
+	if (el != chunk.end() && el->_start == pos)
+	  {
+	    for (; el != chunk.end(); el++)
+	      list.push_back(el->_ast);
+	    pos = chunk.back()._next;
+	  }
+
+	/* Parse what the chunk did not cover correctly.  */
+	while (pos < limits[i + 1])
+	  {
+	    parser._buffer->_pos = pos;
+	    AstPtr ast = (parser.*_rule)();
+	    if (ast->as_exception())
+	      return ast;
+	    if (parser._buffer->_pos == pos)
+	      return parser.template _error<FailedParse>("empty record");
+	    list.push_back(ast);
+	    parser._memoization_cache.clear();
+	    pos = skip(parser, parser._buffer->_pos);
+	  }
+      }
+    return records;
+  }
+
+private:
+  struct Record
+  {
+    size_t _start;
+    /* Start of the next record (after whitespace).  */
+    size_t _next;
+    AstPtr _ast;
+  };
+
+  size_t skip(parser_t& parser, size_t pos)
+  {
+    parser._buffer->_pos = pos;
+    parser._buffer->next_token();
+    return parser._buffer->_pos;
+  }
+
+  void parse_chunk(const Buffer& buffer, size_t begin, size_t limit,
+		   std::vector<Record>& records)
+  {
+    auto handle = _parsers.acquire();
+    parser_t& parser = handle.parse_shared(buffer);
+    size_t pos = skip(parser, begin);
+
+    while (pos < limit)
+      {
+	AstPtr ast = (parser.*_rule)();
+	if (ast->as_exception() || parser._buffer->_pos == pos)
+	  return;
+	/* Records are independent, so no memo can be hit again.  */
+	parser._memoization_cache.clear();
+	size_t next = skip(parser, parser._buffer->_pos);
+	records.push_back(Record { pos, next, ast });
+	pos = next;
+      }
+  }
+
+  rule_method_t _rule;
+  record_boundary_t _boundary;
+  WorkStealingPool& _workers;
+  size_t _chunk_size;
+  ParserPool<parser_t> _parsers;
+};
+
+#endif /* _GRAKOPP_PARALLEL_HPP */
@@ -13,58 +13,248 @@
 #include <functional>
 #include <string>
 #include <map>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <cctype>
 #include <cstdint>
 
 #include "exceptions.hpp"
 #include "buffer.hpp"
 #include "ast.hpp"
+#include "memo.hpp"
+#include "events.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 
-/* OPTIMIZATION: Somehow use templating to make grammar rules with
-   lambda better inline-optimizable (sim. to C++ map).  */
 /* OPTIMIZATION: Specialise for void State.  */
 
 class NoSemantics
 {
 };
 
-template <typename _Semantics=NoSemantics, typename _State=intptr_t>
+
+/* In recognizer mode, a rule only reports if it matched, and
+   otherwise works like a rule building an AST that only consists of
+   the cut flag (see Ast::_cut).  The generated parsers provide a
+   recognizer for every rule _NAME_() as the overload
+   _NAME_(Recognize()).  */
+class Recognize
+{
+};
+
+class Recognized
+{
+public:
+  Recognized(bool ok=true) : _ok(ok), _cut(false) {}
+
+  bool _ok;
+  bool _cut;
+
+  explicit operator bool() const
+  {
+    return _ok;
+  }
+
+  /* Like adding ASTs.  */
+  Recognized& operator<<(const Recognized& addend)
+  {
+    if (addend._cut)
+      _cut = true;
+    if (! addend._ok)
+      _ok = false;
+    return *this;
+  }
+};
+
+/* In event mode, a rule reports what it matches to a handler instead
+   of building an AST (see grakopp/events.hpp).  The generated parsers
+   provide an emitter for every rule _NAME_() as the overload
+   _NAME_(EmitEvents()), which returns like the recognizer.  */
+class EmitEvents
+{
+};
+
+template <typename _Semantics=NoSemantics, typename _State=intptr_t,
+	  typename _Profiler=DefaultProfiler>
 class Parser
 {
 public:
   using State = _State;
   using Semantics = _Semantics;
+  using Profiler = _Profiler;
   using semantics_func_t = AstPtr (Semantics::*) (AstPtr&);
 
   Parser(Semantics* semantics=nullptr)
     : _buffer(std::make_shared<Buffer>()),
       _whitespace(" \t\r\n\x0b\x0c"),
       _nameguard_set(false), _nameguard(true),
-      _state(), _semantics(semantics)
-      { }
+      _incremental(false), _state(), _semantics(semantics),
+      _deferred_semantics(false), _deferred_mismatch(false), _call_depth(0),
+      _compact_failures(false), _failure_hit(false), _reparsing(false),
+      _memo_budget(0), _memo_lru(false), _memo_evictions(0),
+      _cut_dropped(0),
+      _adaptive_memo(false), _adaptive_hit_rate(0), _adaptive_min_lookups(0),
+      _error_pos(0), _tracing(nullptr)
+      {
+	_reset_ast_counters();
+      }
 
   BufferPtr _buffer;
   std::string _whitespace;
   bool _nameguard_set;
   bool _nameguard;
+  bool _incremental;
   State _state;
   Semantics *_semantics;
 
-  /* We sort by position first, because we can then optimize the cut
-     operator.  However, if you use an unordered map here, remember to
-     iterate over all items in the cut operator.  */
-  using memo_key_t = std::tuple<size_t, std::string, State>;
-  using memo_value_t = std::tuple<AstPtr, size_t, State>;
-  std::map<memo_key_t, memo_value_t> _memoization_cache;
+  /* With deferred semantics, the semantic actions are not applied to
+     the results of the rules while parsing.  Instead, the results are
+     wrapped in Deferred nodes, and when the outermost rule returns,
+     the actions of the rules in the final parse are run bottom-up
+     (see _run_deferred).  So no time is spent on the actions of
+     alternatives that fail later.  This only works if the semantics
+     do not influence the parse: a failure returned by an action fails
+     the whole parse.
+
+     The caller adds a Deferred node to its AST like a string or an
+     extension, so the AST is the same as with immediate actions only
+     if the action returns one of these.  Lists, maps and empty nodes
+     are merged into the AST of the caller instead.  So if an action
+     returns one of them, its rule is added to _eager_rules, which run
+     their actions right away, and the outermost rule is parsed again
+     (see _finish_deferred).  This happens at most once per rule.  */
+  bool _deferred_semantics;
+  std::unordered_set<std::string> _eager_rules;
+  bool _deferred_mismatch;
+  State _deferred_state;
+  int _call_depth;
+
+  class Deferred : public AstExtensionType
+  {
+  public:
+    Deferred(const std::string& name, semantics_func_t func, const AstPtr& ast)
+      : _name(name), _func(func), _ast(ast)
+    {
+    }
+
+    std::string _name;
+    semantics_func_t _func;
+    AstPtr _ast;
+  };
+
+  /* The memoization cache is indexed by position first, so that the
+     cut operator can drop the results before it (see MemoTable),
+     and then by rule name and state, hashed if std::hash<State> is
+     available.  The value is the AST, the position and the state
+     after the rule, and one past the furthest position the rule
+     looked at (see Buffer::see), which limits the edits it
+     survives.  */
+  using memo_key_t = std::pair<std::string, State>;
+  using memo_value_t = std::tuple<AstPtr, size_t, State, size_t>;
+  MemoTable<State, memo_value_t> _memoization_cache;
+
+  /* The memoization cache of the recognizers, which only keeps if a
+     rule matched and where it ended (the other elements are as in
+     memo_value_t).  */
+  using recognizer_value_t = std::tuple<Recognized, size_t, State, size_t>;
+  MemoTable<State, recognizer_value_t> _recognizer_cache;
+
+  /* The matches of the event emitters, which also keep where their
+     events are kept for a replay (see ParseEventQueue).  */
+  using event_value_t = std::tuple<Recognized, size_t, State, size_t,
+				   ParseEventQueue::Replay>;
+  MemoTable<State, event_value_t> _event_cache;
+
+  /* With compact failures, the failures of rules and recognizers are
+     memoized in these bitmaps instead of the caches above, which takes
+     much less memory.  A memoized failure of a rule does not know its
+     error, so it is replaced by a generic one.  This only matters if
+     the whole parse fails, and then the outermost rule is parsed again
+     without the bitmaps to get the right error (_failure_hit is set
+     if that is necessary).  Not used in incremental mode.  The parse
+     again is not profiled, traced or probed (_reparsing is set), as
+     it only repeats what was already seen.  */
+  bool _compact_failures;
+  bool _failure_hit;
+  bool _reparsing;
+  FailureTable<State> _failure_cache;
+  FailureTable<State> _recognizer_failure_cache;
+
+  /* The maximum number of results in each memoization cache (0 for no
+     limit), see set_memo_budget.  _memo_evictions counts the dropped
+     results.  */
+  size_t _memo_budget;
+  bool _memo_lru;
+  size_t _memo_evictions;
+
+  /* The results and failures dropped by cuts, and the AST counters of
+     the thread at the last reset, see stats.  */
+  uint64_t _cut_dropped;
+  uint64_t _ast_allocated_base;
+  uint64_t _ast_freed_base;
+
+  /* The code generator leaves out the memoization of rules that are
+     cheaper to parse again (see _call).  With adaptive memoization,
+     the parser also stops memoizing a rule if less than
+     _adaptive_hit_rate of its first _adaptive_min_lookups lookups
+     found a result, see set_adaptive_memo.  */
+  class MemoStats
+  {
+  public:
+    MemoStats()
+      : _lookups(0), _hits(0), _memoize(true)
+    {
+    }
+
+    size_t _lookups;
+    size_t _hits;
+    bool _memoize;
+  };
+
+  bool _adaptive_memo;
+  double _adaptive_hit_rate;
+  size_t _adaptive_min_lookups;
+  std::unordered_map<std::string, MemoStats> _memo_stats;
+  std::unordered_map<std::string, MemoStats> _recognizer_memo_stats;
+
+  /* The furthest position at which a recognizer failed to match
+     something, which is where the error is for an input that is not
+     recognized.  */
+  size_t _error_pos;
+
+  /* The events of the emitters, see set_event_handler.  */
+  ParseEventQueue _events;
+
+  /* Counts and times the rules if Profiler is RuleProfiler, see
+     grakopp/profile.hpp.  The profile is kept across reset.  */
+  Profiler _profiler;
+
+  /* The trace buffer, if any, and the one the current parse writes
+     to, which is null if it is not sampled (see set_trace).  */
+  TraceBufferPtr _trace;
+  TraceBuffer *_tracing;
+  /* The indices of the rule names in the trace plus 1 (or 0 if not
+     known yet), by the numbers of the rules, see _trace_rule.  */
+  std::vector<uint32_t> _trace_rules;
 
+  /* The parser configures the tokenizer of the buffer and moves its
+     cursor, so a buffer must not be shared by parsers running at the
+     same time.  Apart from that, a parser has no global state and
+     separate instances can be used from separate threads.  */
   void _update_buffer()
   {
     if (!_buffer)
       return;
     _buffer->_whitespace = _whitespace;
     _buffer->_nameguard = _nameguard;
+    _buffer->_track_horizon = _incremental;
     _buffer->_pos = 0;
+    _buffer->_horizon = 0;
+    _error_pos = 0;
   }
 
   void set_buffer(const BufferPtr& buffer)
@@ -91,10 +281,323 @@ public:
 
   void reset()
   {
-    _memoization_cache.clear();
+    clear(0);
+  }
+
+  /* Like reset, but keep up to HIGH_WATER bytes of each memoization
+     cache allocated for the next parse (see MemoTable::clear), which
+     saves the allocations if the documents are of similar size.  */
+  void clear(size_t high_water)
+  {
+    _memoization_cache.clear(high_water);
+    _recognizer_cache.clear(high_water);
+    _event_cache.clear(high_water);
+    _failure_cache.clear();
+    _recognizer_failure_cache.clear();
+    _call_depth = 0;
+    _failure_hit = false;
+    _memo_evictions = 0;
+    _cut_dropped = 0;
+    _reset_ast_counters();
+    _memo_stats.clear();
+    _recognizer_memo_stats.clear();
+    _events.clear();
+    _state = State();
     _update_buffer();
   }
 
+  /* Send the events of the emitters to HANDLER, see
+     grakopp/events.hpp.  The handler is not owned by the parser.  */
+  void set_event_handler(ParseEventHandler* handler)
+  {
+    _events._handler = handler;
+  }
+
+  /* Record the parse in TRACE, see grakopp/trace.hpp.  A null
+     pointer disables tracing.  */
+  void set_trace(const TraceBufferPtr& trace)
+  {
+    _trace = trace;
+    _tracing = nullptr;
+    _trace_rules.clear();
+  }
+
+  void _trace_event(TraceEvent::Kind kind, const std::string& name,
+		    size_t pos, int flags=0)
+  {
+    if (_tracing)
+      _tracing->record(kind, name, pos, _call_depth, flags);
+  }
+
+  /* Like _trace_event for the rule NAME.  The generated parsers pass
+     the number of the rule in the grammar as RULE, so that its name is
+     looked up in the trace only once.  Other rules pass -1.  */
+  void _trace_rule(TraceEvent::Kind kind, int rule, const std::string& name,
+		   size_t pos, int flags=0)
+  {
+    if (! _tracing)
+      return;
+    if (rule < 0)
+      {
+	_tracing->record(kind, name, pos, _call_depth, flags);
+	return;
+      }
+    if (size_t(rule) >= _trace_rules.size())
+      _trace_rules.resize(rule + 1);
+    uint32_t& id = _trace_rules[rule];
+    if (! id)
+      id = _tracing->intern(name) + 1;
+    _tracing->record(kind, id - 1, pos, _call_depth, flags);
+  }
+
+  void _reset_ast_counters()
+  {
+    AstCounters& counters = AstCounters::get();
+    _ast_allocated_base = counters._allocated;
+    _ast_freed_base = counters._freed;
+    counters._high_water = counters.live();
+  }
+
+  /* Count the nodes of AST and the strings in them, each node once.
+     Deferred nodes keep the AST of their rule alive, too.  */
+  void _count_ast(const AstPtr& ast, std::unordered_set<const Ast*>& seen,
+		  ParserStats& stats) const
+  {
+    if (! seen.insert(ast.get()).second)
+      return;
+    stats._ast_nodes++;
+    stats._ast_bytes += sizeof(Ast) + 2 * sizeof(long);
+    if (const AstString* str = ast->as_string())
+      stats._string_bytes += string_heap_bytes(*str);
+    else if (const AstList* list = ast->as_list())
+      {
+	for (const AstPtr& child: *list)
+	  _count_ast(child, seen, stats);
+      }
+    else if (const AstMap* map = ast->as_map())
+      {
+	for (auto& pair: *map)
+	  {
+	    stats._string_bytes += string_heap_bytes(pair.first);
+	    _count_ast(pair.second, seen, stats);
+	  }
+      }
+    else if (const AstExtension* ext = ast->as_extension())
+      {
+	const Deferred *deferred = dynamic_cast<const Deferred*>(ext->get());
+	if (deferred)
+	  _count_ast(deferred->_ast, seen, stats);
+      }
+  }
+
+  /* A snapshot of the caches and memory, see grakopp/stats.hpp.  This
+     walks the memoized ASTs, so it takes time in proportion to
+     them.  */
+  ParserStats stats() const
+  {
+    ParserStats stats;
+    stats._memo_entries = _memoization_cache.size() + _recognizer_cache.size()
+      + _event_cache.size();
+    stats._memo_high_water = _memoization_cache.high_water()
+      + _recognizer_cache.high_water() + _event_cache.high_water();
+    stats._failure_entries = _failure_cache.size()
+      + _recognizer_failure_cache.size();
+    stats._failure_high_water = _failure_cache.high_water()
+      + _recognizer_failure_cache.high_water();
+    stats._cut_dropped = _cut_dropped;
+    stats._evicted = _memo_evictions;
+
+    stats._memo_bytes = _memoization_cache.bytes() + _recognizer_cache.bytes()
+      + _event_cache.bytes() + _events.replay_bytes()
+      + _failure_cache.bytes() + _recognizer_failure_cache.bytes();
+    stats._memo_bytes_high_water = _memoization_cache.bytes_high_water()
+      + _recognizer_cache.bytes_high_water()
+      + _event_cache.bytes_high_water()
+      + _failure_cache.bytes_high_water()
+      + _recognizer_failure_cache.bytes_high_water();
+    std::unordered_set<const Ast*> seen;
+    _memoization_cache.for_each([&] (size_t, const memo_key_t&,
+				     const memo_value_t& value) {
+				  _count_ast(std::get<0>(value), seen, stats);
+				});
+    if (_buffer)
+      stats._buffer_bytes = string_heap_bytes(_buffer->text());
+
+    const AstCounters& counters = AstCounters::get();
+    stats._ast_counted = AstCounters::enabled;
+    stats._ast_allocated = counters._allocated - _ast_allocated_base;
+    stats._ast_freed = counters._freed - _ast_freed_base;
+    stats._ast_high_water = counters._high_water;
+    return stats;
+  }
+
+  std::string stats_report(bool json=false) const
+  {
+    std::ostringstream out;
+    if (json)
+      stats().report_json(out);
+    else
+      stats().report(out);
+    return out.str();
+  }
+
+  /* The profile as a table sorted by exclusive time, or as JSON.  */
+  std::string profile_report(bool json=false) const
+  {
+    std::ostringstream out;
+    if (json)
+      _profiler.report_json(out);
+    else
+      _profiler.report(out);
+    return out.str();
+  }
+
+  void set_deferred_semantics(bool deferred)
+  {
+    _deferred_semantics = deferred;
+    _eager_rules.clear();
+    reset();
+  }
+
+  void set_compact_failures(bool compact)
+  {
+    _compact_failures = compact;
+    reset();
+  }
+
+  /* Without cuts, the memoization caches grow with the input until
+     reset.  With a budget, results are dropped when a cache has more
+     than ENTRIES results, down to three quarters of that.  By default,
+     the results at the lowest positions are dropped, which are
+     usually the furthest behind the parser.  With LRU, the results
+     that were not used for the longest time are dropped instead.
+     Dropped results are simply parsed again if needed.  */
+  void set_memo_budget(size_t entries, bool lru=false)
+  {
+    _memo_budget = entries;
+    _memo_lru = lru;
+  }
+
+  /* Stop memoizing the rules whose results are rarely used again.
+     The hit rate of a rule is measured over at least MIN_LOOKUPS
+     lookups, and once a rule is not memoized any more, it stays that
+     way until reset.  A MIN_HIT_RATE of 0 disables this.  */
+  void set_adaptive_memo(double min_hit_rate, size_t min_lookups=1000)
+  {
+    _adaptive_memo = min_hit_rate > 0;
+    _adaptive_hit_rate = min_hit_rate;
+    _adaptive_min_lookups = min_lookups;
+    reset();
+  }
+
+  /* Returns the statistics of the rule NAME in STATS if adaptive
+     memoization is enabled, and a null pointer otherwise.  */
+  MemoStats* _adaptive_stats(std::unordered_map<std::string, MemoStats>& stats,
+			     const std::string& name)
+  {
+    if (! _adaptive_memo)
+      return nullptr;
+    return &stats[name];
+  }
+
+  void _count_lookup(MemoStats* stats, bool hit)
+  {
+    if (! stats)
+      return;
+    stats->_lookups++;
+    if (hit)
+      stats->_hits++;
+    else if (stats->_lookups >= _adaptive_min_lookups
+	     && stats->_hits < stats->_lookups * _adaptive_hit_rate)
+      stats->_memoize = false;
+  }
+
+  template<typename Cache>
+  void _check_memo_budget(Cache& cache)
+  {
+    if (_memo_budget == 0 || cache.size() <= _memo_budget)
+      return;
+    size_t size = _memo_budget - _memo_budget / 4;
+    if (_memo_lru)
+      _memo_evictions += cache.evict_unused(size);
+    else
+      _memo_evictions += cache.evict_lowest(size);
+  }
+
+  bool _compacting_failures() const
+  {
+    return _compact_failures && !_incremental;
+  }
+
+  /* The AST returned for a failure from the bitmaps, see
+     _compact_failures.  */
+  static AstPtr _memoized_failure(bool cut)
+  {
+    static const AstPtr failure = _memoized_failure_ast(false);
+    static const AstPtr cut_failure = _memoized_failure_ast(true);
+    return cut ? cut_failure : failure;
+  }
+
+  static AstPtr _memoized_failure_ast(bool cut)
+  {
+    AstPtr ast = std::make_shared<Ast>
+      (AstException(std::make_shared<FailedParse>("memoized failure")));
+    ast->_cut = cut;
+    return ast;
+  }
+
+  /* In incremental mode, the memoization cache is kept accurate
+     enough to survive edits of the buffer, see edit().  */
+  void set_incremental(bool incremental)
+  {
+    _incremental = incremental;
+    reset();
+  }
+
+  /* Replace REMOVED characters at OFFSET in the buffer by INSERTED,
+     and prepare to parse the new text from the start.  Memoized
+     results that did not look at the replaced text are kept (moved
+     along if they are behind it), so calling the start rule again
+     only reparses around the edit.  */
+  void edit(size_t offset, size_t removed, const std::string& inserted)
+  {
+    if (! _incremental)
+      {
+	_buffer->replace(offset, removed, inserted);
+	reset();
+	return;
+      }
+
+    _buffer->replace(offset, removed, inserted);
+    _edit_cache(_memoization_cache, offset, removed, inserted.length());
+    _edit_cache(_recognizer_cache, offset, removed, inserted.length());
+    /* The tokens of the replays point into the old text.  */
+    _event_cache.clear();
+    _events.expire();
+
+    _state = State();
+    _buffer->_pos = 0;
+    _buffer->_horizon = 0;
+    _error_pos = 0;
+  }
+
+  template<typename Cache>
+  static void _edit_cache(Cache& cache, size_t offset, size_t removed,
+			  size_t inserted)
+  {
+    /* Unsigned arithmetic wraps around correctly.  */
+    size_t delta = inserted - removed;
+    using value_type = typename Cache::mapped_type;
+    cache.edit(offset, offset + removed, delta,
+	       [offset] (const value_type& value) {
+		 return std::get<3>(value) <= offset;
+	       },
+	       [delta] (value_type& value) {
+		 std::get<1>(value) += delta;
+		 std::get<3>(value) += delta;
+	       });
+  }
+
   template<typename T>
   AstPtr _error(std::string msg)
   {
@@ -103,30 +606,99 @@ public:
     return ast;
   }
 
-  AstPtr _call(std::string name, semantics_func_t sem_func, std::function<AstPtr ()> func)
+  /* The rule body FUNC is a template parameter, so that it can be
+     inlined here (the cpp-flat backend generates one lambda per rule
+     for this).  If MEMOIZE is false, the result is not memoized: the
+     code generator does this for rules that are cheaper to parse
+     again, see grakopp/codegen/analysis.py.  RULE is the number of
+     the rule for the trace, see _trace_rule.  */
+  template<typename Func>
+  AstPtr _call(std::string name, semantics_func_t sem_func, Func func,
+	       bool memoize=true, int rule=-1)
   {
     size_t pos = _buffer->_pos;
-    State& state = _state;
-    memo_key_t key(pos, name, state);
+    memo_key_t key(name, _state);
+    /* The state to restore on failure (copying states can be
+       expensive, see grakopp/state.hpp).  */
+    const State& state = key.second;
 
-    {
-      /* Check memoization cache.  */
-      auto cache = _memoization_cache.find(key);
-      if (cache != _memoization_cache.end())
-	{
-	  /* TODO: Trace.  */
-	  memo_value_t& value = cache->second;
-	  _buffer->_pos = std::get<1>(value);
-	  _state = std::get<2>(value);
-	  return std::get<0>(value);
-	}
-    }
+    if (_call_depth == 0)
+      {
+	/* The parse again for the error (see _compact_failures) is not
+	   traced.  */
+	if (_trace && ! _reparsing)
+	  _tracing = _trace->sample() ? _trace.get() : nullptr;
+	_failure_hit = false;
+	if (_deferred_semantics)
+	  _deferred_state = _state;
+      }
+    if (! _reparsing)
+      {
+	_profiler.enter(name);
+	GRAKOPP_PROBE2(rule__entry, name.c_str(), pos);
+      }
+    _trace_rule(TraceEvent::CALL, rule, name, pos);
+
+    MemoStats *stats = memoize ? _adaptive_stats(_memo_stats, name) : nullptr;
+    if (stats)
+      memoize = stats->_memoize;
+
+    if (memoize)
+      {
+	/* Check memoization cache.  */
+	memo_value_t *cache = _memoization_cache.find(pos, key);
+	if (cache)
+	  {
+	    _count_lookup(stats, true);
+	    if (! _reparsing)
+	      {
+		_profiler.memo_hit();
+		GRAKOPP_PROBE2(memo__hit, name.c_str(), pos);
+	      }
+	    memo_value_t& value = *cache;
+	    _trace_rule(TraceEvent::MEMO_HIT, rule, name, pos,
+			std::get<0>(value)->as_exception() ? 0 : TraceEvent::OK);
+	    _buffer->_pos = std::get<1>(value);
+	    _state = std::get<2>(value);
+	    _buffer->see(std::get<3>(value));
+	    if (_deferred_semantics && _call_depth == 0)
+	      return _finish_deferred(std::get<0>(value), name, sem_func, func,
+				      memoize, rule, pos);
+	    return std::get<0>(value);
+	  }
+
+	/* The outermost rule needs the real error.  */
+	if (_compacting_failures() && _call_depth > 0)
+	  {
+	    int failure = _failure_cache.find(pos, key);
+	    if (failure)
+	      {
+		_count_lookup(stats, true);
+		_profiler.memo_hit();
+		GRAKOPP_PROBE2(memo__hit, name.c_str(), pos);
+		_trace_rule(TraceEvent::MEMO_HIT, rule, name, pos,
+			    (failure & FailureTable<State>::CUT)
+			    ? TraceEvent::CUT_FAILURE : 0);
+		_failure_hit = true;
+		return _memoized_failure(failure & FailureTable<State>::CUT);
+	      }
+	  }
+	_count_lookup(stats, false);
+	if (! _reparsing)
+	  _profiler.memo_miss();
+      }
+
+    /* Measure the lookahead of this rule separately.  */
+    size_t outer_horizon = _buffer->_horizon;
+    _buffer->_horizon = pos;
 
     if (std::islower(name[0]))
       _buffer->next_token();
 
     /* Call rule.  */
+    _call_depth++;
     AstPtr ast = func();
+    _call_depth--;
 
     //if self.parseinfo:
     //  node._add('_parseinfo', ParseInfo(self._buffer, name, pos, self._pos))
@@ -141,21 +713,152 @@ public:
       }
 
     /* Apply semantics.  */
-    if (_semantics)
-      if (!ast->as_exception())
-	ast = (_semantics->*sem_func)(ast);
+    if (_semantics && !ast->as_exception())
+      {
+	if (_deferred_semantics && ! _eager_rules.count(name))
+	  {
+	    AstPtr deferred = std::make_shared<Ast>
+	      (AstExtension(std::make_shared<Deferred>(name, sem_func, ast)));
+	    deferred->_cut = ast->_cut;
+	    ast = deferred;
+	  }
+	else
+	  ast = (_semantics->*sem_func)(ast);
+      }
     size_t next_pos = _buffer->_pos;
-    State& next_state = _state;
+    size_t horizon = _buffer->_horizon;
+    _buffer->see(outer_horizon);
 
-    /* Fill memoization cache.  FIXME: Check "don't memo lookaheads" flag. */
-    memo_value_t value (ast, next_pos, next_state);
-    _memoization_cache[key] = value;
+    /* Fill memoization cache.  Lookaheads use the recognizers (see
+       _if_r), so they don't store incomplete ASTs here.  */
+    memo_value_t value(ast, next_pos, _state, horizon);
 
-    if (ast->as_exception())
+    /* The key is moved into the cache, and STATE with it.  */
+    bool failed = ast->as_exception();
+    if (failed)
       {
 	_buffer->_pos = pos;
 	_state = state;
       }
+    if (memoize && failed && _compacting_failures())
+      _failure_cache.insert(pos, key, ast->_cut);
+    else if (memoize)
+      {
+	_memoization_cache.insert(pos, std::move(key), std::move(value));
+	_check_memo_budget(_memoization_cache);
+      }
+    if (! _reparsing)
+      {
+	_profiler.leave(! failed, next_pos - pos, failed && next_pos > pos);
+	GRAKOPP_PROBE3(rule__return, name.c_str(), next_pos, ! failed);
+      }
+    _trace_rule(TraceEvent::RETURN, rule, name, next_pos,
+		failed ? (ast->_cut ? TraceEvent::CUT_FAILURE : 0) : TraceEvent::OK);
+
+    if (failed && _call_depth == 0 && _failure_hit)
+      {
+	/* Parse again for the error, see _compact_failures.  */
+	TraceBuffer *tracing = _tracing;
+	_tracing = nullptr;
+	_compact_failures = false;
+	_reparsing = true;
+	ast = _call(name, sem_func, func, memoize, rule);
+	_reparsing = false;
+	_compact_failures = true;
+	_tracing = tracing;
+      }
+    else if (!failed && _deferred_semantics && _call_depth == 0)
+      return _finish_deferred(ast, name, sem_func, func, memoize, rule, pos);
+    return ast;
+  }
+
+  /* Run the deferred actions in AST, the result of the outermost
+     rule NAME at POS.  If one of them returned a node that is merged
+     differently than the Deferred node in its place, the rule is
+     parsed again (its memoized results contain Deferred nodes of
+     rules that are eager now).  */
+  template<typename Func>
+  AstPtr _finish_deferred(const AstPtr& ast, std::string name,
+			  semantics_func_t sem_func, Func func, bool memoize,
+			  int rule, size_t pos)
+  {
+    _deferred_mismatch = false;
+    AstPtr result = _run_deferred(ast);
+    if (! _deferred_mismatch)
+      return result;
+
+    _memoization_cache.clear();
+    _buffer->_pos = pos;
+    _state = _deferred_state;
+    return _call(name, sem_func, func, memoize, rule);
+  }
+
+  /* Replace the Deferred nodes in AST by the results of their
+     semantic actions, innermost first.  The nodes of AST are not
+     modified, as they may be memoized.  */
+  AstPtr _run_deferred(const AstPtr& ast)
+  {
+    AstExtension *ext = ast->as_extension();
+    if (ext)
+      {
+	Deferred *deferred = dynamic_cast<Deferred*>(ext->get());
+	if (! deferred)
+	  return ast;
+	AstPtr result = _run_deferred(deferred->_ast);
+	if (result->as_exception())
+	  return result;
+	result = (_semantics->*(deferred->_func))(result);
+	if (! result->as_string() && ! result->as_extension()
+	    && ! result->as_exception())
+	  {
+	    _eager_rules.insert(deferred->_name);
+	    _deferred_mismatch = true;
+	  }
+	return result;
+      }
+
+    AstList *list = ast->as_list();
+    if (list)
+      {
+	AstPtr result;
+	for (auto it = list->begin(); it != list->end(); it++)
+	  {
+	    AstPtr el = _run_deferred(*it);
+	    if (el->as_exception())
+	      return el;
+	    if (el.get() != it->get() && !result)
+	      {
+		/* Copy the list on the first change.  */
+		result = std::make_shared<Ast>(AstList());
+		AstList& result_list = result->the_list();
+		result_list._mergeable = list->_mergeable;
+		result_list.insert(result_list.end(), list->begin(), it);
+	      }
+	    if (result)
+	      result->the_list().push_back(el);
+	  }
+	return result ? result : ast;
+      }
+
+    AstMap *map = ast->as_map();
+    if (map)
+      {
+	AstPtr result;
+	for (auto& pair: *map)
+	  {
+	    AstPtr value = _run_deferred(pair.second);
+	    if (value->as_exception())
+	      return value;
+	    if (value.get() != pair.second.get())
+	      {
+		if (! result)
+		  result = std::make_shared<Ast>(*map);
+		result->as_map()->at(pair.first) = value;
+	      }
+	  }
+	return result ? result : ast;
+      }
+
     return ast;
   }
 
@@ -179,7 +882,14 @@ public:
        cut flag there.  */
     AstPtr ast = std::make_shared<Ast>();
     ast->_cut = true;
+    if (_tracing)
+      _trace_event(TraceEvent::CUT, std::string(), _buffer->_pos);
+    _drop_memos();
+    return ast;
+  }
 
+  void _drop_memos()
+  {
     /* Grako:
 
        "Kota Mizushima et al say that we can throw away memos for
@@ -192,37 +902,46 @@ public:
        proven if doing it this way affects linearity. Empirically, it
        hasn't."  */
 
+    if (! _reparsing)
+      GRAKOPP_PROBE1(cut, _buffer->_pos);
+
+    /* In incremental mode, the memos may be needed after an edit.  */
+    if (_incremental)
+      return;
+
     size_t cutpos = _buffer->_pos;
-    /* This is a bit cheesy, but it'll work.  We need a string larger
-       than all valid strings (and state doesn't matter then).  */
-    memo_key_t last_key(cutpos, "\xff", State());
-    auto upper = _memoization_cache.upper_bound(last_key);
-    // std::cout << "Dropping " << std::distance(_memoization_cache.begin(),upper) << "\n";
-    _memoization_cache.erase(_memoization_cache.begin(), upper);
-    return ast;
+    _cut_dropped += _memoization_cache.erase_through(cutpos)
+      + _recognizer_cache.erase_through(cutpos)
+      + _event_cache.erase_through(cutpos)
+      + _failure_cache.erase_through(cutpos)
+      + _recognizer_failure_cache.erase_through(cutpos);
   }
 
   AstPtr _token(const std::string& token)
   {
     _buffer->next_token();
+    size_t pos = _buffer->_pos;
     if (! _buffer->match(token))
       {
+	_trace_event(TraceEvent::TOKEN, token, pos);
 	return _error<FailedToken>(token);
       }
-    // _trace_match(token);
+    _trace_event(TraceEvent::TOKEN, token, pos, TraceEvent::OK);
     AstPtr node = std::make_shared<Ast>(token);
     return node;
   }
 
   AstPtr _pattern(const std::string& pattern)
   {
+    size_t pos = _buffer->_pos;
     boost::optional<std::string> maybe_token = _buffer->matchre(pattern);
     if (! maybe_token)
       {
+	_trace_event(TraceEvent::PATTERN, pattern, pos);
 	return _error<FailedPattern>(pattern);
       }
     const std::string& token = *maybe_token;
-    // _trace_match(token);
+    _trace_event(TraceEvent::PATTERN, pattern, pos, TraceEvent::OK);
     AstPtr node = std::make_shared<Ast>(token);
     return node;
   }
@@ -324,6 +1043,46 @@ public:
       return _error<FailedLookahead>("");
   }
 
+  /* Like _if, but the lookahead is checked with RECOGNIZER, the
+     recognizer for the expression FUNC (so no AST is built and no
+     semantics are called).  Only if the lookahead fails, FUNC is run
+     for the exception.  */
+  template<typename Recognizer>
+  AstPtr _if_r(std::function<AstPtr ()> func, Recognizer recognizer)
+  {
+    size_t pos = _buffer->_pos;
+    State state = _state;
+
+    Recognized result = recognizer();
+    _state = state;
+    _buffer->_pos = pos;
+    if (result)
+      return std::make_shared<Ast>();
+
+    AstPtr ast = func();
+    _state = state;
+    _buffer->_pos = pos;
+    if (ast->as_exception())
+      return ast;
+    /* Only the semantics can make a difference.  */
+    return _error<FailedLookahead>("");
+  }
+
+  /* Like _ifnot, for the recognizer of the expression.  */
+  template<typename Recognizer>
+  AstPtr _ifnot_r(Recognizer recognizer)
+  {
+    size_t pos = _buffer->_pos;
+    State state = _state;
+
+    Recognized result = recognizer();
+    _state = state;
+    _buffer->_pos = pos;
+    if (result)
+      return _error<FailedLookahead>("");
+    return std::make_shared<Ast>();
+  }
+
   AstPtr _closure(std::function<AstPtr ()> func)
   {
     AstPtr cum_ast = std::make_shared<Ast>(AstList());
@@ -369,6 +1128,276 @@ public:
     return ast << opt_ast;
   }
 
+  /* Recognizer mode.  The generated recognizers expand the
+     combinators in place (like the cpp-flat backend), so only rules
+     and terminals are needed here.  There are no semantics.  */
+
+  Recognized _error_r()
+  {
+    if (_buffer->_pos > _error_pos)
+      _error_pos = _buffer->_pos;
+    return Recognized(false);
+  }
+
+  template<typename Func>
+  Recognized _call_r(const std::string& name, Func func, bool memoize=true)
+  {
+    size_t pos = _buffer->_pos;
+    memo_key_t key(name, _state);
+    const State& state = key.second;
+
+    MemoStats *stats = memoize
+      ? _adaptive_stats(_recognizer_memo_stats, name) : nullptr;
+    if (stats)
+      memoize = stats->_memoize;
+
+    GRAKOPP_PROBE2(rule__entry, name.c_str(), pos);
+
+    if (memoize)
+      {
+	recognizer_value_t *cache = _recognizer_cache.find(pos, key);
+	if (cache)
+	  {
+	    _count_lookup(stats, true);
+	    GRAKOPP_PROBE2(memo__hit, name.c_str(), pos);
+	    recognizer_value_t& value = *cache;
+	    _buffer->_pos = std::get<1>(value);
+	    _state = std::get<2>(value);
+	    _buffer->see(std::get<3>(value));
+	    return std::get<0>(value);
+	  }
+
+	if (_compacting_failures())
+	  {
+	    int failure = _recognizer_failure_cache.find(pos, key);
+	    if (failure)
+	      {
+		_count_lookup(stats, true);
+		GRAKOPP_PROBE2(memo__hit, name.c_str(), pos);
+		Recognized result(false);
+		result._cut = failure & FailureTable<State>::CUT;
+		return result;
+	      }
+	  }
+	_count_lookup(stats, false);
+      }
+
+    size_t outer_horizon = _buffer->_horizon;
+    _buffer->_horizon = pos;
+
+    if (std::islower(name[0]))
+      _buffer->next_token();
+
+    Recognized result = func();
+
+    size_t horizon = _buffer->_horizon;
+    _buffer->see(outer_horizon);
+    recognizer_value_t value(result, _buffer->_pos, _state, horizon);
+    GRAKOPP_PROBE3(rule__return, name.c_str(), _buffer->_pos, bool(result));
+
+    if (! result)
+      {
+	_buffer->_pos = pos;
+	_state = state;
+      }
+    if (memoize && ! result && _compacting_failures())
+      _recognizer_failure_cache.insert(pos, key, result._cut);
+    else if (memoize)
+      {
+	_recognizer_cache.insert(pos, std::move(key), std::move(value));
+	_check_memo_budget(_recognizer_cache);
+      }
+    return result;
+  }
+
+  Recognized _fail_r()
+  {
+    return _error_r();
+  }
+
+  Recognized _check_eof_r()
+  {
+    _buffer->next_token();
+    if (! _buffer->atend())
+      return _error_r();
+    return Recognized();
+  }
+
+  Recognized _cut_r()
+  {
+    Recognized result;
+    result._cut = true;
+    _drop_memos();
+    return result;
+  }
+
+  Recognized _token_r(const std::string& token)
+  {
+    _buffer->next_token();
+    if (! _buffer->match(token))
+      return _error_r();
+    return Recognized();
+  }
+
+  Recognized _pattern_r(const std::string& pattern)
+  {
+    if (! _buffer->matchre_length(pattern))
+      return _error_r();
+    return Recognized();
+  }
+
+  /* Event mode.  The emitters are generated like the recognizers, and
+     only the rules and the terminals report events.  A rule matches
+     the same in both modes, so the emitters share the failures with
+     the recognizers.  A match is memoized in _event_cache with its
+     events, if the event queue could keep them, and replayed after
+     backtracking.  Otherwise it goes to the cache of the recognizers,
+     and a rule that matches is parsed again after backtracking.  */
+
+  template<typename Func>
+  Recognized _call_e(const char* name, Func func, bool memoize=true)
+  {
+    size_t pos = _buffer->_pos;
+    memo_key_t key(name, _state);
+    const State& state = key.second;
+
+    MemoStats *stats = memoize
+      ? _adaptive_stats(_recognizer_memo_stats, key.first) : nullptr;
+    if (stats)
+      memoize = stats->_memoize;
+
+    GRAKOPP_PROBE2(rule__entry, name, pos);
+
+    /* A match in the cache of the recognizers is only used to not
+       insert it again.  */
+    bool cached = false;
+    if (memoize)
+      {
+	event_value_t *replay = _event_cache.find(pos, key);
+	if (replay && _events.replay(std::get<4>(*replay)))
+	  {
+	    _count_lookup(stats, true);
+	    GRAKOPP_PROBE2(memo__hit, name, pos);
+	    _buffer->_pos = std::get<1>(*replay);
+	    _state = std::get<2>(*replay);
+	    _buffer->see(std::get<3>(*replay));
+	    return std::get<0>(*replay);
+	  }
+
+	recognizer_value_t *cache = _recognizer_cache.find(pos, key);
+	int failure = 0;
+	if (cache && ! std::get<0>(*cache))
+	  {
+	    _buffer->see(std::get<3>(*cache));
+	    failure = FailureTable<State>::FAILED
+	      | (std::get<0>(*cache)._cut ? FailureTable<State>::CUT : 0);
+	  }
+	else if (cache)
+	  cached = true;
+	else if (_compacting_failures())
+	  failure = _recognizer_failure_cache.find(pos, key);
+	_count_lookup(stats, failure != 0);
+	if (failure)
+	  {
+	    GRAKOPP_PROBE2(memo__hit, name, pos);
+	    Recognized result(false);
+	    result._cut = failure & FailureTable<State>::CUT;
+	    return result;
+	  }
+      }
+
+    size_t outer_horizon = _buffer->_horizon;
+    _buffer->_horizon = pos;
+
+    if (std::islower(name[0]))
+      _buffer->next_token();
+
+    _events.begin_rule();
+    _events.add(ParseEvent::RULE_START, name, _buffer->_pos);
+    Recognized result = func();
+
+    size_t horizon = _buffer->_horizon;
+    _buffer->see(outer_horizon);
+    GRAKOPP_PROBE3(rule__return, name, _buffer->_pos, bool(result));
+
+    if (result)
+      _events.add(ParseEvent::RULE_END, name, _buffer->_pos);
+    else
+      {
+	_buffer->_pos = pos;
+	_state = state;
+      }
+    ParseEventQueue::Replay replay;
+    bool replayable = _events.end_rule(bool(result), replay);
+    if (memoize && ! result && _compacting_failures())
+      _recognizer_failure_cache.insert(pos, key, result._cut);
+    else if (memoize && replayable)
+      {
+	event_value_t value(result, _buffer->_pos, _state, horizon, replay);
+	_event_cache.insert(pos, std::move(key), std::move(value));
+	_check_memo_budget(_event_cache);
+      }
+    else if (memoize && ! cached)
+      {
+	recognizer_value_t value(result, _buffer->_pos, _state, horizon);
+	_recognizer_cache.insert(pos, std::move(key), std::move(value));
+	_check_memo_budget(_recognizer_cache);
+      }
+    return result;
+  }
+
+  Recognized _token_e(const std::string& token)
+  {
+    _buffer->next_token();
+    size_t pos = _buffer->_pos;
+    if (! _buffer->match(token))
+      return _error_r();
+    _events.add(ParseEvent::TOKEN, _buffer->text().data() + pos, pos,
+		_buffer->_pos - pos);
+    return Recognized();
+  }
+
+  Recognized _pattern_e(const std::string& pattern)
+  {
+    size_t pos = _buffer->_pos;
+    if (! _buffer->matchre_length(pattern))
+      return _error_r();
+    _events.add(ParseEvent::TOKEN, _buffer->text().data() + pos, pos,
+		_buffer->_pos - pos);
+    return Recognized();
+  }
+
+  Recognized _cut_e()
+  {
+    _events.cut();
+    return _cut_r();
+  }
+
+  /* A named element, which is a barrier for cuts (see
+     ParseEventQueue).  */
+  void _field_start_e(const char* name, bool list)
+  {
+    _events.add(ParseEvent::FIELD_START, name, _buffer->_pos, list);
+    _events.begin_barrier();
+  }
+
+  void _field_end_e(const char* name, bool ok)
+  {
+    _events.end_barrier();
+    if (ok)
+      _events.add(ParseEvent::FIELD_END, name, _buffer->_pos);
+  }
+
+  void _list_start_e()
+  {
+    _events.add(ParseEvent::LIST_START, nullptr, _buffer->_pos);
+  }
+
+  void _list_end_e()
+  {
+    _events.add(ParseEvent::LIST_END, nullptr, _buffer->_pos);
+  }
+
 };
 
 #endif /* _GRAKOPP_PARSER_HPP */
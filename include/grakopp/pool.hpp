@@ -0,0 +1,181 @@
+/* grakopp/pool.hpp - Grako++ parser pool header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_POOL_HPP
+#define _GRAKOPP_POOL_HPP 1
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+#include "buffer.hpp"
+
+
+/* A pool of parser instances for servers parsing many documents on
+   many threads.  Each handle owns a parser and a buffer exclusively
+   until it is destroyed, and then returns both to the pool, so that
+   the parser object (with its settings) and the buffer are reused by
+   the next document.  The memoization caches are emptied by
+   Parser::clear, which keeps their buckets for the next document up
+   to the high-water limit of the pool (in bytes per cache), and frees
+   the rest, so that a large document does not keep its caches alive
+   in an idle parser.  The parser type
+   is usually a generated parser, but anything derived from Parser
+   will do.  The handles share the idle parsers with the pool, so a
+   handle may outlive the pool: its parser is then deleted with the
+   last handle.  */
+template <typename _Parser>
+class ParserPool
+{
+public:
+  using parser_t = _Parser;
+  using factory_t = std::function<parser_t* ()>;
+
+private:
+  /* The idle parsers, owned by the pool and its handles.  */
+  class Shared
+  {
+  public:
+    Shared(factory_t factory)
+      : _factory(factory)
+    {
+    }
+
+    ~Shared()
+    {
+      for (auto& entry: _free)
+	delete entry.first;
+    }
+
+    void release(parser_t* parser, const BufferPtr& buffer)
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _free.push_back(std::make_pair(parser, buffer));
+    }
+
+    factory_t _factory;
+    std::mutex _mutex;
+    std::vector<std::pair<parser_t*, BufferPtr>> _free;
+  };
+
+public:
+  class Handle
+  {
+    std::shared_ptr<Shared> _pool;
+    parser_t* _parser;
+    BufferPtr _buffer;
+
+  public:
+    Handle(const std::shared_ptr<Shared>& pool, parser_t* parser,
+	   const BufferPtr& buffer)
+      : _pool(pool), _parser(parser), _buffer(buffer)
+    {
+    }
+
+    Handle(Handle&& other)
+      : _pool(std::move(other._pool)), _parser(other._parser),
+	_buffer(std::move(other._buffer))
+    {
+      other._parser = nullptr;
+    }
+
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+
+    ~Handle()
+    {
+      if (_parser)
+	_pool->release(_parser, _buffer);
+    }
+
+    parser_t& operator*() const
+    {
+      return *_parser;
+    }
+
+    parser_t* operator->() const
+    {
+      return _parser;
+    }
+
+    /* Load the text into the buffer of this handle and attach it to
+       the parser, which is then positioned at the start.  */
+    parser_t& parse_string(const std::string& text)
+    {
+      _buffer->from_string(text);
+      _parser->set_buffer(_buffer);
+      return *_parser;
+    }
+
+    parser_t& parse_file(const std::string& filename)
+    {
+      _buffer->from_file(filename);
+      _parser->set_buffer(_buffer);
+      return *_parser;
+    }
+
+    /* Like parse_string, but share the text of SOURCE.  */
+    parser_t& parse_shared(const Buffer& source)
+    {
+      _buffer->share(source);
+      _parser->set_buffer(_buffer);
+      return *_parser;
+    }
+  };
+
+  static constexpr size_t default_high_water = 4 << 20;
+
+  ParserPool(factory_t factory=[] () { return new parser_t(); },
+	     size_t high_water=default_high_water)
+    : _shared(std::make_shared<Shared>(factory)), _high_water(high_water)
+  {
+  }
+
+  ParserPool(const ParserPool&) = delete;
+  ParserPool& operator=(const ParserPool&) = delete;
+
+  /* Return a parser that is cleared and ready for a new document.  */
+  Handle acquire()
+  {
+    parser_t* parser = nullptr;
+    BufferPtr buffer;
+    {
+      std::lock_guard<std::mutex> lock(_shared->_mutex);
+      if (!_shared->_free.empty())
+	{
+	  parser = _shared->_free.back().first;
+	  buffer = std::move(_shared->_free.back().second);
+	  _shared->_free.pop_back();
+	}
+    }
+
+    if (!parser)
+      {
+	parser = _shared->_factory();
+	buffer = std::make_shared<Buffer>();
+      }
+    else
+      parser->clear(_high_water);
+    return Handle(_shared, parser, buffer);
+  }
+
+  /* Number of idle parsers in the pool.  */
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lock(_shared->_mutex);
+    return _shared->_free.size();
+  }
+
+private:
+  std::shared_ptr<Shared> _shared;
+  size_t _high_water;
+};
+
+#endif /* _GRAKOPP_POOL_HPP */
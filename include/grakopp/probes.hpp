@@ -0,0 +1,49 @@
+/* grakopp/probes.hpp - Grako++ static probes header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_PROBES_HPP
+#define _GRAKOPP_PROBES_HPP 1
+
+/* Compile with -DGRAKOPP_USDT to put static probes of the provider
+   "grakopp" into the parser, which perf, bpftrace and SystemTap can
+   attach to on a running process (this needs sys/sdt.h from
+   SystemTap).  A probe that nobody attached to is a nop.
+
+     rule__entry(const char *name, size_t pos)
+     rule__return(const char *name, size_t pos, int ok)
+     memo__hit(const char *name, size_t pos)
+     cut(size_t pos)
+     buffer__load(size_t length)
+     buffer__replace(size_t offset, size_t removed, size_t inserted)
+
+   Without GRAKOPP_USDT, the arguments are not even evaluated.  */
+
+#ifdef GRAKOPP_USDT
+#include <sys/sdt.h>
+#define GRAKOPP_PROBE1(probe, a) DTRACE_PROBE1(grakopp, probe, a)
+#define GRAKOPP_PROBE2(probe, a, b) DTRACE_PROBE2(grakopp, probe, a, b)
+#define GRAKOPP_PROBE3(probe, a, b, c) DTRACE_PROBE3(grakopp, probe, a, b, c)
+#else
+#define GRAKOPP_PROBE1(probe, a) do { } while (0)
+#define GRAKOPP_PROBE2(probe, a, b) do { } while (0)
+#define GRAKOPP_PROBE3(probe, a, b, c) do { } while (0)
+#endif
+
+/* The generated parsers put the body of every rule into a lambda with
+   GRAKOPP_RULE.  Compile with -DGRAKOPP_RULE_SYMBOLS to keep these
+   out of line, so that each rule has a symbol of its own (like
+   jsonParser::_value_()::{lambda()#1}::operator()) and profilers
+   attribute the time to the rules instead of Parser::_call.  */
+#ifdef GRAKOPP_RULE_SYMBOLS
+#define GRAKOPP_RULE __attribute__((noinline))
+#else
+#define GRAKOPP_RULE
+#endif
+
+#endif /* GRAKOPP_PROBES_HPP */
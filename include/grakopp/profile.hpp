@@ -0,0 +1,239 @@
+/* grakopp/profile.hpp - Grako++ rule profiler header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_PROFILE_HPP
+#define _GRAKOPP_PROFILE_HPP 1
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/* The profiler of a parser is a policy class, the third template
+   parameter of Parser.  Parser::_call reports to it when a rule is
+   entered (enter), found in the memoization cache (memo_hit) or not
+   (memo_miss), and when it returns (leave).  NoProfiler does nothing
+   and is optimized away completely.  RuleProfiler counts and times
+   every rule.  Compile with -DGRAKOPP_PROFILE to make RuleProfiler
+   the default for all parsers, including the generated ones.  */
+class NoProfiler
+{
+public:
+  static constexpr bool enabled = false;
+
+  void enter(const std::string&)
+  {
+  }
+
+  void memo_hit()
+  {
+  }
+
+  void memo_miss()
+  {
+  }
+
+  void leave(bool, size_t, bool)
+  {
+  }
+
+  void clear()
+  {
+  }
+
+  void report(std::ostream& out) const
+  {
+    out << "profiling not enabled, compile with -DGRAKOPP_PROFILE\n";
+  }
+
+  void report_json(std::ostream& out) const
+  {
+    out << "[]\n";
+  }
+};
+
+
+/* The counters of one rule.  A memo hit counts as a call, but not
+   as a success or failure (it was counted when the result was
+   memoized).  A backtrack is a failure after the rule advanced the
+   position.  The inclusive time of a recursive rule counts the time
+   of the inner calls again, like gprof does.  */
+class RuleProfile
+{
+public:
+  RuleProfile()
+    : _calls(0), _memo_hits(0), _memo_misses(0), _successes(0),
+      _failures(0), _bytes(0), _backtracks(0), _inclusive(0),
+      _exclusive(0)
+  {
+  }
+
+  uint64_t _calls;
+  uint64_t _memo_hits;
+  uint64_t _memo_misses;
+  uint64_t _successes;
+  uint64_t _failures;
+  /* The input consumed by successful calls.  */
+  uint64_t _bytes;
+  uint64_t _backtracks;
+  /* In nanoseconds.  */
+  uint64_t _inclusive;
+  uint64_t _exclusive;
+};
+
+
+class RuleProfiler
+{
+public:
+  static constexpr bool enabled = true;
+
+  using clock = std::chrono::steady_clock;
+
+  std::unordered_map<std::string, RuleProfile> _rules;
+
+private:
+  /* The rules that are running.  Pointers to the elements of an
+     unordered_map stay valid when it grows.  */
+  struct Frame
+  {
+    RuleProfile *_rule;
+    clock::time_point _start;
+    uint64_t _children;
+  };
+
+  std::vector<Frame> _frames;
+
+public:
+  void enter(const std::string& name)
+  {
+    RuleProfile& rule = _rules[name];
+    rule._calls++;
+    _frames.push_back(Frame{&rule, clock::now(), 0});
+  }
+
+  /* A memo hit returns at once, without a call to leave.  */
+  void memo_hit()
+  {
+    _frames.back()._rule->_memo_hits++;
+    _frames.pop_back();
+  }
+
+  void memo_miss()
+  {
+    _frames.back()._rule->_memo_misses++;
+  }
+
+  /* BYTES is the input consumed by the rule, and BACKTRACKED is true
+     if it failed after advancing.  */
+  void leave(bool success, size_t bytes, bool backtracked)
+  {
+    Frame frame = _frames.back();
+    _frames.pop_back();
+
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>
+      (clock::now() - frame._start).count();
+    RuleProfile& rule = *frame._rule;
+    rule._inclusive += elapsed;
+    rule._exclusive += elapsed - std::min(elapsed, frame._children);
+    if (success)
+      {
+	rule._successes++;
+	rule._bytes += bytes;
+      }
+    else
+      rule._failures++;
+    if (backtracked)
+      rule._backtracks++;
+
+    if (! _frames.empty())
+      _frames.back()._children += elapsed;
+  }
+
+  void clear()
+  {
+    _rules.clear();
+    _frames.clear();
+  }
+
+  /* The rules by exclusive time, the most expensive first.  */
+  std::vector<std::pair<std::string, RuleProfile> > sorted() const
+  {
+    std::vector<std::pair<std::string, RuleProfile> > rules(_rules.begin(),
+							     _rules.end());
+    std::sort(rules.begin(), rules.end(),
+	      [] (const std::pair<std::string, RuleProfile>& left,
+		  const std::pair<std::string, RuleProfile>& right) {
+		if (left.second._exclusive != right.second._exclusive)
+		  return left.second._exclusive > right.second._exclusive;
+		return left.first < right.first;
+	      });
+    return rules;
+  }
+
+  void report(std::ostream& out) const
+  {
+    out << std::left << std::setw(24) << "rule" << std::right
+	<< std::setw(10) << "calls" << std::setw(10) << "hits"
+	<< std::setw(10) << "misses" << std::setw(10) << "ok"
+	<< std::setw(10) << "failed" << std::setw(10) << "backtrack"
+	<< std::setw(12) << "bytes" << std::setw(12) << "incl ms"
+	<< std::setw(12) << "excl ms" << "\n";
+    for (auto& entry: sorted())
+      {
+	const RuleProfile& rule = entry.second;
+	out << std::left << std::setw(24) << entry.first << std::right
+	    << std::setw(10) << rule._calls << std::setw(10) << rule._memo_hits
+	    << std::setw(10) << rule._memo_misses
+	    << std::setw(10) << rule._successes
+	    << std::setw(10) << rule._failures
+	    << std::setw(10) << rule._backtracks
+	    << std::setw(12) << rule._bytes << std::fixed << std::setprecision(3)
+	    << std::setw(12) << rule._inclusive / 1e6
+	    << std::setw(12) << rule._exclusive / 1e6 << "\n";
+      }
+  }
+
+  /* Rule names are identifiers, so they need no escaping.  */
+  void report_json(std::ostream& out) const
+  {
+    out << "[";
+    const char *sep = "\n";
+    for (auto& entry: sorted())
+      {
+	const RuleProfile& rule = entry.second;
+	out << sep << "  {\"rule\": \"" << entry.first << "\""
+	    << ", \"calls\": " << rule._calls
+	    << ", \"memo_hits\": " << rule._memo_hits
+	    << ", \"memo_misses\": " << rule._memo_misses
+	    << ", \"successes\": " << rule._successes
+	    << ", \"failures\": " << rule._failures
+	    << ", \"backtracks\": " << rule._backtracks
+	    << ", \"bytes\": " << rule._bytes
+	    << ", \"inclusive_ns\": " << rule._inclusive
+	    << ", \"exclusive_ns\": " << rule._exclusive << "}";
+	sep = ",\n";
+      }
+    out << "\n]\n";
+  }
+};
+
+
+#ifdef GRAKOPP_PROFILE
+using DefaultProfiler = RuleProfiler;
+#else
+using DefaultProfiler = NoProfiler;
+#endif
+
+#endif /* GRAKOPP_PROFILE_HPP */
@@ -0,0 +1,233 @@
+/* grakopp/state.hpp - Grako++ parser state header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_STATE_HPP
+#define _GRAKOPP_STATE_HPP 1
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+
+/* The parser copies its state at every point it may backtrack to,
+   stores it in every memoized result and compares it with operator<
+   to look up the memoization cache.  For a state that is a container
+   (an indentation stack, a set of declared symbols), all of this is
+   proportional to its size.  The classes below are persistent: a copy
+   shares the data with the original, and changing one of them leaves
+   the other intact, so that copies take constant time and unchanged
+   states compare equal without looking at the data.  Use them with
+   the --statetype option, for example --statetype
+   "PersistentStack<int>".
+
+   We use persistent states instead of an undo log, because a memoized
+   result has to restore the state after the rule, not only a state
+   that was current earlier.  */
+
+
+/* A stack that shares the elements below the top with its copies.
+   T must implement operator< and std::hash.  The hash of the elements
+   is kept in every node, so that different stacks usually compare in
+   constant time, too.  */
+template <typename T>
+class PersistentStack
+{
+  struct Node
+  {
+    Node(const T& value, const std::shared_ptr<const Node>& next)
+      : _value(value), _next(next),
+	_size(next ? next->_size + 1 : 1),
+	_hash((next ? next->_hash * 31 : 0) + std::hash<T>()(value))
+    {
+    }
+
+    T _value;
+    std::shared_ptr<const Node> _next;
+    size_t _size;
+    size_t _hash;
+  };
+
+  std::shared_ptr<const Node> _top;
+
+public:
+  bool empty() const
+  {
+    return !_top;
+  }
+
+  size_t size() const
+  {
+    return _top ? _top->_size : 0;
+  }
+
+  size_t hash() const
+  {
+    return _top ? _top->_hash : 0;
+  }
+
+  /* The stack must not be empty.  */
+  const T& top() const
+  {
+    return _top->_value;
+  }
+
+  void push(const T& value)
+  {
+    _top = std::make_shared<Node>(value, _top);
+  }
+
+  /* The stack must not be empty.  */
+  void pop()
+  {
+    _top = _top->_next;
+  }
+
+  /* Orders by hash, then size, then the elements from the top.  */
+  friend bool operator<(const PersistentStack& left, const PersistentStack& right)
+  {
+    const Node *lnode = left._top.get();
+    const Node *rnode = right._top.get();
+    if (lnode == rnode)
+      return false;
+    if (left.hash() != right.hash())
+      return left.hash() < right.hash();
+    if (left.size() != right.size())
+      return left.size() < right.size();
+    /* Stop at the first shared node.  */
+    while (lnode != rnode)
+      {
+	if (lnode->_value < rnode->_value)
+	  return true;
+	if (rnode->_value < lnode->_value)
+	  return false;
+	lnode = lnode->_next.get();
+	rnode = rnode->_next.get();
+      }
+    return false;
+  }
+
+  friend bool operator==(const PersistentStack& left, const PersistentStack& right)
+  {
+    return !(left < right) && !(right < left);
+  }
+};
+
+
+/* Any value type T (for example a std::set) with copy-on-write.
+   Copies share the value until one of them is modified.  States that
+   are copies of each other compare equal in constant time, others are
+   compared with the operator< of T.  If T has a std::hash, the hash
+   is computed once per value and shared by the copies, so that memo
+   lookups do not hash the whole value every time.  */
+template <typename T>
+class SharedState
+{
+  struct Node
+  {
+    Node(const T& value)
+      : _value(value), _hashed(false), _hash(0)
+    {
+    }
+
+    T _value;
+    /* Set by hash, and reset by modify.  Parsers in several threads
+       may compute the hash of a shared value at once, but they all
+       store the same.  */
+    mutable std::atomic<bool> _hashed;
+    mutable std::atomic<size_t> _hash;
+  };
+
+  std::shared_ptr<Node> _node;
+
+public:
+  SharedState()
+    : _node(std::make_shared<Node>(T()))
+  {
+  }
+
+  SharedState(const T& value)
+    : _node(std::make_shared<Node>(value))
+  {
+  }
+
+  const T& get() const
+  {
+    return _node->_value;
+  }
+
+  const T* operator->() const
+  {
+    return &_node->_value;
+  }
+
+  /* Returns the value for modification, after copying it if it is
+     shared with another state.  The reference must not be used after
+     the state was copied or hashed.  */
+  T& modify()
+  {
+    if (_node.use_count() > 1)
+      _node = std::make_shared<Node>(_node->_value);
+    else
+      _node->_hashed.store(false, std::memory_order_relaxed);
+    return _node->_value;
+  }
+
+  /* Only callable if T has a hash.  */
+  template <typename U=T>
+  auto hash() const -> decltype(std::hash<U>()(std::declval<const U&>()))
+  {
+    if (! _node->_hashed.load(std::memory_order_acquire))
+      {
+	_node->_hash.store(std::hash<U>()(_node->_value), std::memory_order_relaxed);
+	_node->_hashed.store(true, std::memory_order_release);
+      }
+    return _node->_hash.load(std::memory_order_relaxed);
+  }
+
+  friend bool operator<(const SharedState& left, const SharedState& right)
+  {
+    if (left._node == right._node)
+      return false;
+    return left.get() < right.get();
+  }
+
+  friend bool operator==(const SharedState& left, const SharedState& right)
+  {
+    return left._node == right._node || !(left < right || right < left);
+  }
+};
+
+
+namespace std
+{
+  template <typename T>
+  struct hash<PersistentStack<T> >
+  {
+    size_t operator()(const PersistentStack<T>& stack) const
+    {
+      return stack.hash();
+    }
+  };
+
+  /* Only callable if T has a hash, so that memo_hashable (see
+     grakopp/memo.hpp) sees whether it has.  */
+  template <typename T>
+  struct hash<SharedState<T> >
+  {
+    template <typename U=T>
+    auto operator()(const SharedState<U>& state) const
+      -> decltype(state.template hash<U>())
+    {
+      return state.hash();
+    }
+  };
+}
+
+#endif /* GRAKOPP_STATE_HPP */
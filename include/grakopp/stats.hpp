@@ -0,0 +1,112 @@
+/* grakopp/stats.hpp - Grako++ parser statistics header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_STATS_HPP
+#define _GRAKOPP_STATS_HPP 1
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+
+/* A snapshot of the memoization caches and memory of a parser, see
+   Parser::stats.  The entries and bytes of the caches are counted
+   while parsing, the memory of the memoized ASTs when the snapshot is
+   taken.  The high-water marks and the counters are since the last
+   reset of the parser (or its construction).  All bytes are
+   estimates: allocator overhead is not counted.  */
+class ParserStats
+{
+public:
+  ParserStats()
+    : _memo_entries(0), _memo_high_water(0), _failure_entries(0),
+      _failure_high_water(0), _cut_dropped(0), _evicted(0),
+      _memo_bytes(0), _memo_bytes_high_water(0), _ast_bytes(0),
+      _string_bytes(0), _buffer_bytes(0), _ast_nodes(0),
+      _ast_counted(false), _ast_allocated(0), _ast_freed(0),
+      _ast_high_water(0)
+  {
+  }
+
+  /* The results in the memoization caches of the rules and the
+     recognizers, and the failures in the bitmaps of compact
+     failures.  */
+  size_t _memo_entries;
+  size_t _memo_high_water;
+  size_t _failure_entries;
+  size_t _failure_high_water;
+  /* The results and failures dropped at cuts and by the memo
+     budget.  */
+  uint64_t _cut_dropped;
+  uint64_t _evicted;
+
+  /* Memory by category: the caches themselves, the AST nodes and the
+     strings in them that the caches keep alive, and the text of the
+     buffer.  */
+  size_t _memo_bytes;
+  size_t _memo_bytes_high_water;
+  size_t _ast_bytes;
+  size_t _string_bytes;
+  size_t _buffer_bytes;
+
+  /* The AST nodes in the caches, and the AST nodes allocated and
+     freed by this thread, and the most alive at once (see
+     AstCounters), which are only counted if _ast_counted is set.  */
+  size_t _ast_nodes;
+  bool _ast_counted;
+  uint64_t _ast_allocated;
+  uint64_t _ast_freed;
+  uint64_t _ast_high_water;
+
+  void report(std::ostream& out) const
+  {
+    out << "memo entries:        " << _memo_entries
+	<< " (high water " << _memo_high_water << ")\n"
+	<< "failure entries:     " << _failure_entries
+	<< " (high water " << _failure_high_water << ")\n"
+	<< "dropped at cuts:     " << _cut_dropped << "\n"
+	<< "evicted:             " << _evicted << "\n"
+	<< "memo bytes:          " << _memo_bytes
+	<< " (high water " << _memo_bytes_high_water << ")\n"
+	<< "memoized AST bytes:  " << _ast_bytes
+	<< " (" << _ast_nodes << " nodes)\n"
+	<< "memoized strings:    " << _string_bytes << "\n"
+	<< "buffer bytes:        " << _buffer_bytes << "\n";
+    if (! _ast_counted)
+      {
+	out << "AST nodes allocated: not counted, compile with -DGRAKOPP_AST_COUNTERS\n";
+	return;
+      }
+    out << "AST nodes allocated: " << _ast_allocated << "\n"
+	<< "AST nodes freed:     " << _ast_freed
+	<< " (high water " << _ast_high_water << " alive)\n";
+  }
+
+  void report_json(std::ostream& out) const
+  {
+    out << "{\"memo_entries\": " << _memo_entries
+	<< ", \"memo_high_water\": " << _memo_high_water
+	<< ", \"failure_entries\": " << _failure_entries
+	<< ", \"failure_high_water\": " << _failure_high_water
+	<< ", \"cut_dropped\": " << _cut_dropped
+	<< ", \"evicted\": " << _evicted
+	<< ", \"memo_bytes\": " << _memo_bytes
+	<< ", \"memo_bytes_high_water\": " << _memo_bytes_high_water
+	<< ", \"ast_bytes\": " << _ast_bytes
+	<< ", \"string_bytes\": " << _string_bytes
+	<< ", \"buffer_bytes\": " << _buffer_bytes
+	<< ", \"ast_nodes\": " << _ast_nodes
+	<< ", \"ast_counted\": " << (_ast_counted ? "true" : "false")
+	<< ", \"ast_allocated\": " << _ast_allocated
+	<< ", \"ast_freed\": " << _ast_freed
+	<< ", \"ast_high_water\": " << _ast_high_water << "}\n";
+  }
+};
+
+#endif /* GRAKOPP_STATS_HPP */
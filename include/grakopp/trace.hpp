@@ -0,0 +1,307 @@
+/* grakopp/trace.hpp - Grako++ parse trace header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_TRACE_HPP
+#define _GRAKOPP_TRACE_HPP 1
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+/* A parser with a trace buffer records what it does as fixed-size
+   events: rule calls and returns, memo hits, tokens, patterns and
+   cuts.  Rule names, tokens and patterns are stored once in a table
+   and referred to by their index.  The buffer is a ring that keeps
+   the last events, so recording an event is a lookup in the table
+   and a few stores, and nothing is allocated after the table is
+   complete.  The parser looks up the name of a generated rule only
+   once, and then records it by its index.  With sampling, only every Nth parse is recorded, and
+   the others only test a pointer.  Use grakopp-trace to decode a dump
+   written with TraceBuffer::write.  */
+class TraceEvent
+{
+public:
+  enum Kind
+  {
+    CALL,
+    RETURN,
+    MEMO_HIT,
+    TOKEN,
+    PATTERN,
+    CUT
+  };
+
+  enum Flags
+  {
+    /* The rule, token or pattern matched.  */
+    OK = 1,
+    /* The rule failed after a cut.  */
+    CUT_FAILURE = 2
+  };
+
+  uint64_t _pos;
+  /* Index into the names of the trace.  */
+  uint32_t _id;
+  uint16_t _depth;
+  uint8_t _kind;
+  uint8_t _flags;
+};
+
+static_assert(sizeof(TraceEvent) == 16, "TraceEvent must be 16 bytes");
+
+
+/* Only the parser records events and names, but other threads can
+   take a snapshot or write a dump at any time.  For this, the names
+   are in fixed storage, and the number of them is published after a
+   new one is complete.  Each slot of the ring has a sequence number,
+   which is odd while the parser writes the slot, and otherwise tells
+   which event is in it.  A snapshot checks it before and after
+   copying an event, and drops the events that the parser overwrote
+   meanwhile.  */
+class TraceBuffer
+{
+  struct Slot
+  {
+    /* 2 * (N + 1) for event N, and odd while it is written.  */
+    std::atomic<uint64_t> _seq;
+    /* The TraceEvent, as two words.  */
+    std::atomic<uint64_t> _pos;
+    std::atomic<uint64_t> _info;
+  };
+
+  std::unique_ptr<Slot[]> _slots;
+  size_t _size;
+  size_t _mask;
+  /* The number of events recorded so far.  */
+  std::atomic<uint64_t> _head;
+
+  std::unique_ptr<std::string[]> _names;
+  size_t _max_names;
+  std::atomic<uint32_t> _name_count;
+  /* Open addressing from the hash of a name to its index plus 1, for
+     the parser only.  */
+  std::vector<uint32_t> _ids;
+
+  unsigned _sample;
+  uint64_t _parses;
+
+public:
+  /* The capacity is rounded up to a power of two.  Only one out of
+     SAMPLE parses is recorded.  The table has room for MAX_NAMES
+     rule names, tokens and patterns, and the others all get the name
+     with index 0, "...".  */
+  TraceBuffer(size_t capacity=65536, unsigned sample=1,
+	      size_t max_names=16384)
+    : _size(1), _head(0), _max_names(std::max<size_t>(max_names, 1)),
+      _name_count(1), _sample(sample), _parses(0)
+  {
+    while (_size < capacity)
+      _size <<= 1;
+    _mask = _size - 1;
+    _slots.reset(new Slot[_size]);
+    for (size_t i = 0; i < _size; i++)
+      _slots[i]._seq.store(0, std::memory_order_relaxed);
+
+    _names.reset(new std::string[_max_names]);
+    _names[0] = "...";
+    size_t ids = 1;
+    while (ids < 2 * _max_names)
+      ids <<= 1;
+    _ids.resize(ids);
+  }
+
+  size_t capacity() const
+  {
+    return _size;
+  }
+
+  /* Called at the start of every parse, returns true if it should be
+     traced.  */
+  bool sample()
+  {
+    return _sample <= 1 || _parses++ % _sample == 0;
+  }
+
+  uint32_t intern(const std::string& name)
+  {
+    size_t mask = _ids.size() - 1;
+    size_t slot = std::hash<std::string>()(name) & mask;
+    uint32_t count = _name_count.load(std::memory_order_relaxed);
+    while (_ids[slot])
+      {
+	uint32_t id = _ids[slot] - 1;
+	if (_names[id] == name)
+	  return id;
+	slot = (slot + 1) & mask;
+      }
+    if (count == _max_names)
+      return 0;
+    _names[count] = name;
+    _ids[slot] = count + 1;
+    _name_count.store(count + 1, std::memory_order_release);
+    return count;
+  }
+
+  void record(TraceEvent::Kind kind, const std::string& name, size_t pos,
+	      int depth, int flags=0)
+  {
+    record(kind, intern(name), pos, depth, flags);
+  }
+
+  /* Like record, with the index ID that intern returned for the
+     name.  */
+  void record(TraceEvent::Kind kind, uint32_t id, size_t pos, int depth,
+	      int flags=0)
+  {
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    uint64_t info = id | uint64_t(uint16_t(depth)) << 32
+      | uint64_t(uint8_t(kind)) << 48 | uint64_t(uint8_t(flags)) << 56;
+    Slot& slot = _slots[head & _mask];
+    slot._seq.store(2 * head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot._pos.store(pos, std::memory_order_relaxed);
+    slot._info.store(info, std::memory_order_relaxed);
+    slot._seq.store(2 * (head + 1), std::memory_order_release);
+    _head.store(head + 1, std::memory_order_release);
+  }
+
+  /* Forget the events, but not the names.  */
+  void clear()
+  {
+    for (size_t i = 0; i < _size; i++)
+      _slots[i]._seq.store(0, std::memory_order_relaxed);
+    _head.store(0, std::memory_order_release);
+  }
+
+  /* The events still in the buffer, oldest first.  DROPPED is set to
+     the number of older events that were overwritten, before or while
+     taking the snapshot.  */
+  std::vector<TraceEvent> snapshot(uint64_t *dropped=nullptr) const
+  {
+    uint64_t head = _head.load(std::memory_order_acquire);
+    uint64_t count = std::min<uint64_t>(head, _size);
+    std::vector<TraceEvent> events;
+    events.reserve(count);
+    for (uint64_t i = head - count; i < head; i++)
+      {
+	const Slot& slot = _slots[i & _mask];
+	uint64_t seq = slot._seq.load(std::memory_order_acquire);
+	uint64_t pos = slot._pos.load(std::memory_order_relaxed);
+	uint64_t info = slot._info.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (seq != 2 * (i + 1)
+	    || slot._seq.load(std::memory_order_relaxed) != seq)
+	  continue;
+
+	TraceEvent event;
+	event._pos = pos;
+	event._id = uint32_t(info);
+	event._depth = uint16_t(info >> 32);
+	event._kind = uint8_t(info >> 48);
+	event._flags = uint8_t(info >> 56);
+	events.push_back(event);
+      }
+    if (dropped)
+      *dropped = head - events.size();
+    return events;
+  }
+
+  /* The names, at least all those of the events in an earlier
+     snapshot.  */
+  std::vector<std::string> names() const
+  {
+    uint32_t count = _name_count.load(std::memory_order_acquire);
+    return std::vector<std::string>(&_names[0], &_names[0] + count);
+  }
+
+  /* The dump format is the magic "GPPTRACE", the version, the names
+     (each as a length and the bytes), the number of dropped events
+     and the events, oldest first.  Integers are in host byte
+     order.  */
+  static const uint32_t version = 1;
+
+  void write(std::ostream& out) const
+  {
+    uint64_t dropped;
+    std::vector<TraceEvent> events = snapshot(&dropped);
+    std::vector<std::string> names = this->names();
+    out.write("GPPTRACE", 8);
+    write_int(out, version);
+    write_int(out, uint32_t(names.size()));
+    for (const std::string& name: names)
+      {
+	write_int(out, uint32_t(name.size()));
+	out.write(name.data(), name.size());
+      }
+    write_int(out, dropped);
+    write_int(out, uint64_t(events.size()));
+    out.write(reinterpret_cast<const char*>(events.data()),
+	      events.size() * sizeof(TraceEvent));
+  }
+
+  /* Read a dump written by write, throws std::invalid_argument on
+     errors.  */
+  static void read(std::istream& in, std::vector<std::string>& names,
+		   std::vector<TraceEvent>& events, uint64_t& dropped)
+  {
+    char magic[8];
+    in.read(magic, 8);
+    if (! in || std::string(magic, 8) != "GPPTRACE")
+      throw std::invalid_argument("not a trace");
+    if (read_int<uint32_t>(in) != version)
+      throw std::invalid_argument("unsupported trace version");
+    uint32_t count = read_int<uint32_t>(in);
+    names.clear();
+    for (uint32_t i = 0; i < count; i++)
+      {
+	std::string name(read_int<uint32_t>(in), '\0');
+	in.read(&name[0], name.size());
+	names.push_back(name);
+      }
+    dropped = read_int<uint64_t>(in);
+    events.resize(read_int<uint64_t>(in));
+    in.read(reinterpret_cast<char*>(events.data()),
+	    events.size() * sizeof(TraceEvent));
+    if (! in)
+      throw std::invalid_argument("truncated trace");
+    for (const TraceEvent& event: events)
+      if (event._id >= names.size())
+	throw std::invalid_argument("name out of range");
+  }
+
+private:
+  template <typename T>
+  static void write_int(std::ostream& out, T value)
+  {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  template <typename T>
+  static T read_int(std::istream& in)
+  {
+    T value = 0;
+    in.read(reinterpret_cast<char*>(&value), sizeof(value));
+    if (! in)
+      throw std::invalid_argument("truncated trace");
+    return value;
+  }
+};
+
+using TraceBufferPtr = std::shared_ptr<TraceBuffer>;
+
+#endif /* GRAKOPP_TRACE_HPP */
@@ -0,0 +1,738 @@
+/* grakopp/vm.hpp - Grako++ bytecode interpreter header file
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+#ifndef _GRAKOPP_VM_HPP
+#define _GRAKOPP_VM_HPP 1
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "grakopp.hpp"
+
+/* Dispatch with computed goto where the compiler supports it (define
+   GRAKOPP_VM_SWITCH to use a switch statement instead).  */
+#if defined(__GNUC__) && !defined(GRAKOPP_VM_SWITCH)
+#define GRAKOPP_VM_COMPUTED_GOTO 1
+#endif
+
+
+/* A grammar compiled by grakopp -f vm.  Every rule is a sequence of
+   instructions that works on a stack of frames, each holding the AST
+   of one expression under construction and the position and state
+   before it.  Instructions that can fail add the exception to the AST
+   of the top frame and jump to their target, which is always the
+   instruction that closes the frame.  */
+class VmProgram
+{
+public:
+  /* Keep in sync with python/grakopp/codegen/vm.py.  */
+  enum Op : uint8_t
+  {
+    TOKEN,	/* Match token ARG.  */
+    PATTERN,	/* Match pattern ARG.  */
+    CALL,	/* Call rule ARG.  */
+    EOF_,	/* Match the end of text.  */
+    CUT,	/* Commit to the current option.  */
+    FAIL,	/* Fail.  */
+    PUSH,	/* Open a frame.  */
+    PUSH_LIST,	/* Open a frame with an empty list.  */
+    ADD,	/* Close frame, add AST to the frame below.  */
+    GROUP,	/* Like ADD, but make a list AST mergeable.  */
+    MERGE,	/* Like GROUP, but never fail.  */
+    NAMED,	/* Close frame, add AST under the name ARG.  */
+    OPTIONAL,	/* Close frame, ignore failures without cut.  */
+    IF,		/* Close frame, restore position, pass on failures.  */
+    IFNOT,	/* Close frame, restore position, invert result.  */
+    OPTION,	/* Close frame, on success set AST below and jump to ARG.  */
+    ERROR,	/* Set AST to FailedParse(ARG).  */
+    ITERATE,	/* Close frame, on success collect AST and jump to ARG.  */
+    RETURN,	/* End of rule.  */
+    OP_MAX
+  };
+
+  struct Instr
+  {
+    uint8_t _op;
+    uint32_t _arg;
+    uint32_t _target;
+  };
+
+  struct Rule
+  {
+    std::string _name;
+    uint32_t _entry;
+    std::vector<std::pair<std::string, int>> _defines;
+  };
+
+  std::string _grammar;
+  std::string _version;
+  bool _whitespace_set;
+  std::string _whitespace;
+  bool _nameguard_set;
+  bool _nameguard;
+  std::vector<std::string> _strings;
+  std::vector<Rule> _rules;
+  std::vector<Instr> _code;
+
+  VmProgram()
+    : _whitespace_set(false), _nameguard_set(false), _nameguard(true)
+  {
+  }
+
+  static const char* op_name(int op)
+  {
+    static const char* names[] = {
+      "TOKEN", "PATTERN", "CALL", "EOF", "CUT", "FAIL", "PUSH",
+      "PUSH_LIST", "ADD", "GROUP", "MERGE", "NAMED", "OPTIONAL", "IF",
+      "IFNOT", "OPTION", "ERROR", "ITERATE", "RETURN"
+    };
+    return names[op];
+  }
+
+  /* Returns the index of the rule NAME, or -1.  */
+  int find_rule(const std::string& name) const
+  {
+    for (size_t i = 0; i < _rules.size(); i++)
+      if (_rules[i]._name == name)
+	return i;
+    return -1;
+  }
+
+  /* Load a program, throws std::invalid_argument on errors.  */
+  void load(std::istream& is)
+  {
+    Reader in(is);
+
+    in.expect("grakopp-vm");
+    if (in.number() != 1)
+      throw std::invalid_argument("unsupported program version");
+    in.expect("grammar");
+    _grammar = in.string();
+    in.expect("version");
+    _version = in.string();
+    in.expect("whitespace");
+    _whitespace_set = ! in.peek_word("default");
+    if (_whitespace_set)
+      _whitespace = in.string();
+    in.expect("nameguard");
+    _nameguard_set = ! in.peek_word("default");
+    if (_nameguard_set)
+      _nameguard = in.number() != 0;
+
+    in.expect("strings");
+    size_t nr_strings = in.number();
+    _strings.clear();
+    for (size_t i = 0; i < nr_strings; i++)
+      _strings.push_back(in.string());
+
+    in.expect("rules");
+    size_t nr_rules = in.number();
+    _rules.clear();
+    for (size_t i = 0; i < nr_rules; i++)
+      {
+	Rule rule;
+	rule._name = _strings.at(in.number());
+	rule._entry = in.number();
+	size_t nr_defines = in.number();
+	for (size_t j = 0; j < nr_defines; j++)
+	  {
+	    std::string key = _strings.at(in.number());
+	    int flags = in.number();
+	    rule._defines.push_back(std::make_pair(key, flags));
+	  }
+	_rules.push_back(rule);
+      }
+
+    std::unordered_map<std::string, int> ops;
+    for (int op = 0; op < OP_MAX; op++)
+      ops[op_name(op)] = op;
+
+    in.expect("code");
+    size_t nr_code = in.number();
+    _code.clear();
+    for (size_t i = 0; i < nr_code; i++)
+      {
+	auto op = ops.find(in.word());
+	if (op == ops.end())
+	  throw std::invalid_argument("unknown instruction");
+	Instr instr;
+	instr._op = op->second;
+	instr._arg = in.number();
+	instr._target = in.number();
+	_code.push_back(instr);
+      }
+    verify();
+  }
+
+  void load_file(const std::string& filename)
+  {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    if (! in)
+      throw std::invalid_argument("can not open " + filename);
+    load(in);
+  }
+
+private:
+  /* Reads the tokens of a program: words, numbers and C-style
+     strings, with comments from # to the end of the line.  Note that
+     ast-io.hpp overrides operator>> for strings, so we don't use
+     it.  */
+  class Reader
+  {
+    std::istream& _is;
+
+    void skip()
+    {
+      int ch;
+      while ((ch = _is.peek()) != EOF)
+	{
+	  if (ch == '#')
+	    while ((ch = _is.get()) != EOF && ch != '\n')
+	      ;
+	  else if (std::isspace(ch))
+	    _is.get();
+	  else
+	    break;
+	}
+    }
+
+  public:
+    Reader(std::istream& is) : _is(is) {}
+
+    std::string word()
+    {
+      std::string word;
+      int ch;
+      skip();
+      while ((ch = _is.peek()) != EOF && ! std::isspace(ch))
+	word += _is.get();
+      if (word.empty())
+	throw std::invalid_argument("unexpected end of program");
+      return word;
+    }
+
+    void expect(const std::string& keyword)
+    {
+      if (word() != keyword)
+	throw std::invalid_argument("expected " + keyword);
+    }
+
+    bool peek_word(const std::string& keyword)
+    {
+      skip();
+      if (_is.peek() != keyword[0])
+	return false;
+      expect(keyword);
+      return true;
+    }
+
+    /* A missing argument is written as "-".  */
+    uint32_t number()
+    {
+      std::string num = word();
+      if (num == "-")
+	return 0;
+      size_t end;
+      unsigned long val = std::stoul(num, &end);
+      if (end != num.size())
+	throw std::invalid_argument("number expected");
+      return val;
+    }
+
+    std::string string()
+    {
+      std::string str;
+      skip();
+      if (_is.get() != '"')
+	throw std::invalid_argument("quote expected");
+      while (true)
+	{
+	  int ch = _is.get();
+	  if (ch == EOF)
+	    throw std::invalid_argument("EOF in string");
+	  if (ch == '"')
+	    return str;
+	  if (ch != '\\')
+	    {
+	      str += ch;
+	      continue;
+	    }
+	  ch = _is.get();
+	  if (ch == 'n')
+	    str += '\n';
+	  else if (ch == 'r')
+	    str += '\r';
+	  else if (ch == 't')
+	    str += '\t';
+	  else if (ch >= '0' && ch <= '7')
+	    {
+	      int val = ch - '0';
+	      for (int i = 0; i < 2 && _is.peek() >= '0' && _is.peek() <= '7'; i++)
+		val = val * 8 + _is.get() - '0';
+	      str += (char) val;
+	    }
+	  else if (ch == EOF)
+	    throw std::invalid_argument("EOF in string");
+	  else
+	    str += ch;
+	}
+    }
+  };
+
+  /* The interpreter does not check its input.  */
+  void verify() const
+  {
+    for (auto& rule: _rules)
+      if (rule._entry >= _code.size())
+	throw std::invalid_argument("rule entry out of range");
+    if (_code.empty() || _code.back()._op != RETURN)
+      throw std::invalid_argument("program must end with RETURN");
+    for (auto& instr: _code)
+      {
+	if (instr._target >= _code.size())
+	  throw std::invalid_argument("jump target out of range");
+	switch (instr._op)
+	  {
+	  case TOKEN:
+	  case PATTERN:
+	  case NAMED:
+	  case ERROR:
+	    if (instr._arg >= _strings.size())
+	      throw std::invalid_argument("string out of range");
+	    break;
+	  case CALL:
+	    if (instr._arg >= _rules.size())
+	      throw std::invalid_argument("rule out of range");
+	    break;
+	  case OPTION:
+	  case ITERATE:
+	    if (instr._arg >= _code.size())
+	      throw std::invalid_argument("jump target out of range");
+	    break;
+	  }
+      }
+    verify_frames();
+  }
+
+  /* Follow the control flow from every rule entry and compute the
+     number of frames of the rule before each instruction.  It must be
+     the same on all paths to an instruction, at least 1 where the top
+     frame is used, at least 2 where it is closed (the frame below
+     gets its AST), and 1 at RETURN, so that a rule leaves the frames
+     of its caller alone.  */
+  void verify_frames() const
+  {
+    std::vector<int> depths(_code.size(), -1);
+    std::vector<uint32_t> todo;
+    auto reach = [&depths, &todo] (uint32_t addr, int depth) {
+      if (depths[addr] < 0)
+	{
+	  depths[addr] = depth;
+	  todo.push_back(addr);
+	}
+      else if (depths[addr] != depth)
+	throw std::invalid_argument("frame stack depth differs at join");
+    };
+
+    /* VmParser::run opens the first frame.  */
+    for (auto& rule: _rules)
+      reach(rule._entry, 1);
+
+    while (! todo.empty())
+      {
+	uint32_t addr = todo.back();
+	todo.pop_back();
+	const Instr& instr = _code[addr];
+	int depth = depths[addr];
+	/* The frames used, and the change of the depth.  */
+	int used = 1;
+	int change = 0;
+	bool next = true;
+	bool target = true;
+	bool arg = false;
+	switch (instr._op)
+	  {
+	  case TOKEN:
+	  case PATTERN:
+	  case CALL:
+	  case EOF_:
+	    break;
+	  case CUT:
+	  case ERROR:
+	    target = false;
+	    break;
+	  case FAIL:
+	    next = false;
+	    break;
+	  case PUSH:
+	  case PUSH_LIST:
+	    used = 0;
+	    change = 1;
+	    target = false;
+	    break;
+	  case ADD:
+	  case GROUP:
+	  case NAMED:
+	  case OPTIONAL:
+	  case IF:
+	  case IFNOT:
+	    used = 2;
+	    change = -1;
+	    break;
+	  case MERGE:
+	    used = 2;
+	    change = -1;
+	    target = false;
+	    break;
+	  case OPTION:
+	  case ITERATE:
+	    used = 2;
+	    change = -1;
+	    /* ITERATE jumps to ARG or to the target, OPTION to ARG or
+	       to the next instruction.  */
+	    next = instr._op == OPTION;
+	    target = instr._op == ITERATE;
+	    arg = true;
+	    break;
+	  case RETURN:
+	    if (depth != 1)
+	      throw std::invalid_argument("RETURN with open frames");
+	    next = false;
+	    target = false;
+	    break;
+	  }
+	if (depth < used)
+	  throw std::invalid_argument("frame stack underflow");
+	if (next)
+	  {
+	    /* Only RETURN may end the program (see verify).  */
+	    if (addr + 1 >= _code.size())
+	      throw std::invalid_argument("program runs off the end");
+	    reach(addr + 1, depth + change);
+	  }
+	if (target)
+	  reach(instr._target, depth + change);
+	if (arg)
+	  reach(instr._arg, depth + change);
+      }
+  }
+};
+
+using VmProgramPtr = std::shared_ptr<const VmProgram>;
+
+
+/* Runs a VmProgram.  The rules are memoized by Parser::_call, just
+   like the rules of the generated parsers, and build the same AST.  */
+class VmParser : public Parser<>
+{
+  struct Frame
+  {
+    AstPtr _ast;
+    size_t _pos;
+    State _state;
+  };
+
+  VmProgramPtr _program;
+  /* Shared by all active rules (the frames of a rule start at the
+     size of the stack when it was called).  */
+  std::vector<Frame> _frames;
+
+public:
+  VmParser(const VmProgramPtr& program)
+    : _program(program)
+  {
+    if (_program->_whitespace_set)
+      set_whitespace(_program->_whitespace);
+    if (_program->_nameguard_set)
+      set_nameguard(_program->_nameguard);
+  }
+
+  const VmProgram& program() const
+  {
+    return *_program;
+  }
+
+  AstPtr parse_rule(size_t rule)
+  {
+    return _call(_program->_rules[rule]._name, nullptr,
+		 [this, rule] () { return run(rule); }, true, int(rule));
+  }
+
+  AstPtr parse_rule(const std::string& name)
+  {
+    int rule = _program->find_rule(name);
+    if (rule < 0)
+      return _error<FailedParse>("unknown rule " + name);
+    return parse_rule(rule);
+  }
+
+private:
+  void push(AstPtr ast)
+  {
+    _frames.push_back(Frame { ast, _buffer->_pos, _state });
+  }
+
+  /* Close the top frame.  If RESTORE, move back to where it started
+     (always for lookaheads, otherwise on failure).  */
+  AstPtr pop(bool restore)
+  {
+    Frame& frame = _frames.back();
+    AstPtr ast = std::move(frame._ast);
+    if (restore)
+      {
+	_state = frame._state;
+	_buffer->_pos = frame._pos;
+      }
+    _frames.pop_back();
+    return ast;
+  }
+
+  AstPtr run(size_t rule)
+  {
+    const VmProgram& program = *_program;
+    const std::vector<std::pair<std::string, int>>& defines = program._rules[rule]._defines;
+    const VmProgram::Instr* code = program._code.data();
+    const VmProgram::Instr* ip = code + program._rules[rule]._entry;
+
+    if (defines.empty())
+      push(std::make_shared<Ast>());
+    else
+      push(std::make_shared<Ast>(AstMap(defines)));
+
+#define VM_TOP (_frames.back()._ast)
+#define VM_STRING (program._strings[ip->_arg])
+    /* Continue with the next instruction, or jump to the target of
+       this one if the AST of the top frame has failed.  */
+#define VM_CHECK()						\
+    do {							\
+      ip = VM_TOP->as_exception() ? code + ip->_target : ip + 1;	\
+      VM_NEXT();						\
+    } while (0)
+
+#ifdef GRAKOPP_VM_COMPUTED_GOTO
+    /* Same order as VmProgram::Op.  */
+    static void* const dispatch[] = {
+      &&op_TOKEN, &&op_PATTERN, &&op_CALL, &&op_EOF_, &&op_CUT,
+      &&op_FAIL, &&op_PUSH, &&op_PUSH_LIST, &&op_ADD, &&op_GROUP,
+      &&op_MERGE, &&op_NAMED, &&op_OPTIONAL, &&op_IF, &&op_IFNOT,
+      &&op_OPTION, &&op_ERROR, &&op_ITERATE, &&op_RETURN
+    };
+#define VM_CASE(op) op_##op:
+#define VM_NEXT() goto *dispatch[ip->_op]
+
+    VM_NEXT();
+#else
+#define VM_CASE(op) case VmProgram::op:
+#define VM_NEXT() goto next
+
+  next:
+    switch (ip->_op)
+#endif
+      {
+	VM_CASE(TOKEN)
+	  {
+	    VM_TOP << _token(VM_STRING);
+	    VM_CHECK();
+	  }
+
+	VM_CASE(PATTERN)
+	  {
+	    VM_TOP << _pattern(VM_STRING);
+	    VM_CHECK();
+	  }
+
+	VM_CASE(CALL)
+	  {
+	    /* This may grow the frame stack, so we can't hold a
+	       reference to the top frame over it.  */
+	    AstPtr ast = parse_rule(ip->_arg);
+	    VM_TOP << ast;
+	    VM_CHECK();
+	  }
+
+	VM_CASE(EOF_)
+	  {
+	    VM_TOP << _check_eof();
+	    VM_CHECK();
+	  }
+
+	VM_CASE(CUT)
+	  {
+	    VM_TOP << _cut();
+	    ip++;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(FAIL)
+	  {
+	    VM_TOP = _fail();
+	    ip = code + ip->_target;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(PUSH)
+	  {
+	    push(std::make_shared<Ast>());
+	    ip++;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(PUSH_LIST)
+	  {
+	    push(std::make_shared<Ast>(AstList()));
+	    ip++;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(ADD)
+	  {
+	    AstPtr ast = pop(false);
+	    VM_TOP << ast;
+	    VM_CHECK();
+	  }
+
+	VM_CASE(GROUP)
+	  {
+	    AstPtr ast = pop(false);
+	    AstList *list = ast->as_list();
+	    if (list)
+	      list->_mergeable = true;
+	    VM_TOP << ast;
+	    VM_CHECK();
+	  }
+
+	VM_CASE(MERGE)
+	  {
+	    AstPtr ast = pop(false);
+	    AstList *list = ast->as_list();
+	    if (list)
+	      list->_mergeable = true;
+	    VM_TOP << ast;
+	    ip++;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(NAMED)
+	  {
+	    AstPtr ast = pop(false);
+	    (*VM_TOP)[VM_STRING.c_str()] << ast;
+	    VM_CHECK();
+	  }
+
+	VM_CASE(OPTIONAL)
+	  {
+	    bool failed = _frames.back()._ast->as_exception();
+	    AstPtr ast = pop(failed);
+	    if (failed && !ast->_cut)
+	      ast = std::make_shared<Ast>();
+	    ast->_cut = false;
+	    VM_TOP << ast;
+	    VM_CHECK();
+	  }
+
+	VM_CASE(IF)
+	  {
+	    AstPtr ast = pop(true);
+	    /* Only failures are passed through.  */
+	    if (ast->as_exception())
+	      {
+		VM_TOP << ast;
+		ip = code + ip->_target;
+	      }
+	    else
+	      ip++;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(IFNOT)
+	  {
+	    AstPtr ast = pop(true);
+	    if (! ast->as_exception())
+	      {
+		VM_TOP << _error<FailedLookahead>("");
+		ip = code + ip->_target;
+	      }
+	    else
+	      ip++;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(OPTION)
+	  {
+	    bool failed = _frames.back()._ast->as_exception();
+	    AstPtr ast = pop(failed);
+	    /* A failed option leaves no trace.  An option that succeeds
+	       or fails after a cut is the result of the choice.  */
+	    if (! failed || ast->_cut)
+	      {
+		ast->_cut = false;
+		VM_TOP = ast;
+		ip = code + ip->_arg;
+	      }
+	    else
+	      ip++;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(ERROR)
+	  {
+	    VM_TOP = _error<FailedParse>(VM_STRING);
+	    ip++;
+	    VM_NEXT();
+	  }
+
+	VM_CASE(ITERATE)
+	  {
+	    Frame& frame = _frames.back();
+	    size_t pos = frame._pos;
+	    bool failed = frame._ast->as_exception();
+	    AstPtr ast = pop(failed);
+	    /* Only failures after a cut are passed on.  */
+	    if (failed)
+	      {
+		if (ast->_cut)
+		  VM_TOP = ast;
+		ip = code + ip->_target;
+	      }
+	    else if (pos == _buffer->_pos)
+	      {
+		VM_TOP = _error<FailedParse>("empty closure");
+		ip = code + ip->_target;
+	      }
+	    else
+	      {
+		VM_TOP << ast;
+		ip = code + ip->_arg;
+	      }
+	    VM_NEXT();
+	  }
+
+	VM_CASE(RETURN)
+	  {
+	    return pop(false);
+	  }
+      }
+    /* Not reached.  */
+    return AstPtr();
+
+#undef VM_NEXT
+#undef VM_CASE
+#undef VM_CHECK
+#undef VM_STRING
+#undef VM_TOP
+  }
+};
+
+#endif /* _GRAKOPP_VM_HPP */
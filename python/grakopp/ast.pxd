@@ -74,6 +74,41 @@ cdef extern from "grakopp/ast.hpp":
         AstException* as_exception() nogil
         AstExtension* as_extension() nogil
 
+cdef extern from "grakopp/ast-binary.hpp":
+    cdef enum AstBinaryKind:
+        AST_BINARY_NONE
+        AST_BINARY_STRING
+        AST_BINARY_LIST
+        AST_BINARY_MAP
+        AST_BINARY_EXCEPTION
+        AST_BINARY_EXTENSION
+
+    cdef cppclass AstBinaryStringRef:
+        const char* _data
+        size_t _size
+
+    cdef cppclass AstBinaryNode:
+        AstBinaryKind kind() except + nogil
+        AstBinaryStringRef string() except + nogil
+        size_t size() except + nogil
+        AstBinaryNode at(size_t index) except + nogil
+        size_t ordered() except + nogil
+        AstBinaryStringRef key(size_t index) except + nogil
+        bool has_value(size_t index) except + nogil
+        AstBinaryNode value(size_t index) except + nogil
+        AstBinaryStringRef exception_type() except + nogil
+        AstBinaryStringRef exception_initializer() except + nogil
+        AstBinaryStringRef extension_tag() except + nogil
+        AstBinaryStringRef extension_data() except + nogil
+
+    cdef cppclass AstBinary:
+        AstBinary(const char* data, size_t size) except + nogil
+        AstBinaryNode root() except + nogil
+        AstPtr load() except + nogil
+
+    cdef cppclass AstBinaryWriter:
+        string write(const Ast& ast) except + nogil
+
 
 # Extension types
 
@@ -8,6 +8,7 @@
 
 from cython.operator cimport dereference as deref, preincrement as inc
 from cpython.ref cimport PyObject, Py_XDECREF, Py_XINCREF
+from cpython.buffer cimport PyObject_GetBuffer, PyBuffer_Release, PyBUF_SIMPLE
 from libcpp.string cimport string
 
 from collections import OrderedDict
@@ -85,6 +86,20 @@ cdef AstPtr exc_to_ast(PyObject* _exc):
     deref(new_ast).set(ast_exc)
     return new_ast
 
+cdef exc_to_python(bytes type, bytes initializer):
+    if type == b"FailedParse":
+        return FailedParse(initializer)
+    elif type == b"FailedToken":
+        return FailedToken(initializer)
+    elif type == b"FailedPattern":
+        return FailedPattern(initializer)
+    elif type == b"FailedLookahead":
+        return FailedLookahead(initializer)
+    elif type == b"FailedSemantics":
+        return GrakoppFailedSemantics(initializer)
+    else:
+        return FailedParse("unknown exception %s(%s)" % (type, repr(initializer)))
+
 cdef ast_to_python(Ast& ast):
     if ast.as_none() != NULL:
         return None
@@ -121,23 +136,9 @@ cdef ast_to_python(Ast& ast):
         return val
 
     cdef AstException *ast_exc = ast.as_exception()
-    cdef const char *type
-    cdef const char *initializer
     if ast_exc != NULL:
-        type = deref(ast_exc._exc).type()
-        initializer = deref(ast_exc._exc).initializer()
-        if type == b"FailedParse":
-            return FailedParse(initializer)
-        elif type == b"FailedToken":
-            return FailedToken(initializer)
-        elif type == b"FailedPattern":
-            return FailedPattern(initializer)
-        elif type == b"FailedLookahead":
-            return FailedLookahead(initializer)
-        elif type == b"FailedSemantics":
-            return GrakoppFailedSemantics(initializer)
-        else:
-            return FailedParse("unknown exception %s(%s)" % (type, repr(initializer)))
+        return exc_to_python(deref(ast_exc._exc).type(),
+                             deref(ast_exc._exc).initializer())
 
     cdef AstExtension *ast_ext = ast.as_extension()
     cdef AstExtension ext_obj
@@ -165,3 +166,80 @@ cdef class PyAst:
 
     def to_python(self):
         return ast_to_python(deref(self.ast))
+
+    def to_binary(self):
+        """Return the AST in the binary format of grakopp/ast-binary.hpp."""
+        cdef AstBinaryWriter writer
+        return writer.write(deref(self.ast))
+
+    def from_binary(self, data):
+        """Load the AST from DATA in the binary format."""
+        cdef Py_buffer view
+        cdef AstBinary* binary = NULL
+        PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)
+        try:
+            binary = new AstBinary(<const char*> view.buf, view.len)
+            self.ast = deref(binary).load()
+        finally:
+            del binary
+            PyBuffer_Release(&view)
+
+
+cdef bytes binary_string(AstBinaryStringRef ref):
+    return ref._data[:ref._size]
+
+cdef binary_to_python(AstBinaryNode node):
+    cdef AstBinaryKind kind = node.kind()
+    cdef size_t index
+    if kind == AST_BINARY_NONE:
+        return None
+
+    elif kind == AST_BINARY_STRING:
+        return binary_string(node.string())
+
+    elif kind == AST_BINARY_LIST:
+        val = []
+        for index in range(node.size()):
+            val.append(binary_to_python(node.at(index)))
+        return val
+
+    elif kind == AST_BINARY_MAP:
+        # Like ast_to_python, only the keys in _order.
+        val = GrakoppAst()
+        for index in range(node.ordered()):
+            key = binary_string(node.key(index))
+            if node.has_value(index):
+                val[key] = binary_to_python(node.value(index))
+            else:
+                val[key] = None
+        return val
+
+    elif kind == AST_BINARY_EXCEPTION:
+        return exc_to_python(binary_string(node.exception_type()),
+                             binary_string(node.exception_initializer()))
+
+    elif kind == AST_BINARY_EXTENSION:
+        # Python objects are stored by their representation.
+        tag = binary_string(node.extension_tag())
+        data = binary_string(node.extension_data())
+        if tag:
+            ext = PyAstExtension(tag)
+            ext.data = data
+            return ext
+        return PyAstExtension(data)
+    return None
+
+def load_binary(data):
+    """Convert the AST in DATA, in the binary format of
+    grakopp/ast-binary.hpp, to Python objects.  DATA can be bytes or
+    any object with the buffer protocol, like an mmap, and is read in
+    place, without building the C++ AST."""
+    cdef Py_buffer view
+    cdef AstBinary* binary = NULL
+    PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)
+    try:
+        binary = new AstBinary(<const char*> view.buf, view.len)
+        return binary_to_python(deref(binary).root())
+    finally:
+        del binary
+        PyBuffer_Release(&view)
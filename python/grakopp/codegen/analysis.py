@@ -0,0 +1,144 @@
+# python/grakopp/codegen/analysis.py - Grako++ grammar analysis -*- coding: utf-8 -*-
+# Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+# Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+#
+# This file is part of Grako++.  Grako++ is free software; you can
+# redistribute it and/or modify it under the terms of the 2-clause
+# BSD license, see file LICENSE.TXT.
+
+from __future__ import (absolute_import, division, print_function,
+                        unicode_literals)
+
+"""
+Static analysis of models defined with grako.model, shared by the
+C++ backends.
+
+memoized_rules decides which rules are memoized by Parser::_call.
+Looking up and filling the memoization cache costs more than parsing
+a small rule again.  And a rule that is only called from one place in
+a memoized rule, at a fixed offset from the start of that rule, is
+never parsed twice at the same position anyway: the caller is only
+parsed once at the one position that leads there.  (If the call comes
+after something of variable length, like in R = X C, the caller tried
+at different positions can reach C at the same one.)  The decision
+can be overridden per rule with the parameters "memo" and "nomemo",
+for example:
+
+    token::nomemo = /[a-z]+/ ;
+"""
+
+from grako.model import (Closure, Cut, Group, Lookahead, Named,
+                         NegativeLookahead, RuleInclude, RuleRef, Sequence,
+                         Token, Void)
+
+# Rules with at most this many nodes and without rule references or
+# loops are not memoized.
+TRIVIAL_SIZE = 4
+
+
+def _children(node):
+    if isinstance(node, RuleInclude):
+        return [node.rule.exp]
+    children = []
+    for attr in ('exp', 'rhs'):
+        child = getattr(node, attr, None)
+        if child is not None and hasattr(child, 'firstset'):
+            children.append(child)
+    children.extend(getattr(node, 'sequence', None) or [])
+    children.extend(getattr(node, 'options', None) or [])
+    return children
+
+
+def _walk(node):
+    yield node
+    for child in _children(node):
+        for n in _walk(child):
+            yield n
+
+
+def _body(rule):
+    return getattr(rule, 'rhs', None) or rule.exp
+
+
+def _override(rule):
+    params = [str(p) for p in (rule.params or [])]
+    if 'nomemo' in params:
+        return False
+    if 'memo' in params:
+        return True
+    return None
+
+
+def _trivial(rule):
+    nodes = list(_walk(_body(rule)))
+    if len(nodes) > TRIVIAL_SIZE:
+        return False
+    return not any(isinstance(n, (RuleRef, RuleInclude, Closure,
+                                  Lookahead, NegativeLookahead))
+                   for n in nodes)
+
+
+def _fixed_length(node):
+    """True if NODE always matches the same number of characters
+    (apart from the whitespace before tokens)."""
+    if isinstance(node, (Token, Cut, Void, Lookahead, NegativeLookahead)):
+        return True
+    if isinstance(node, Sequence):
+        return all(_fixed_length(n) for n in node.sequence)
+    if isinstance(node, (Group, Named)):
+        return _fixed_length(node.exp)
+    return False
+
+
+def _at_fixed_offset(node, ref):
+    """True if the rule reference REF in NODE is always reached at the
+    same offset from the start of NODE."""
+    if node is ref:
+        return True
+    if isinstance(node, Sequence):
+        for child in node.sequence:
+            if any(n is ref for n in _walk(child)):
+                return _at_fixed_offset(child, ref)
+            if not _fixed_length(child):
+                return False
+        return False
+    if isinstance(node, Closure):
+        # Only the first iteration is.
+        return False
+    return any(_at_fixed_offset(child, ref) for child in _children(node))
+
+
+def memoized_rules(grammar):
+    """Returns the set of names of the rules of GRAMMAR that should be
+    memoized."""
+    callers = dict((rule.name, []) for rule in grammar.rules)
+    for rule in grammar.rules:
+        for node in _walk(_body(rule)):
+            if isinstance(node, RuleRef) and node.name in callers:
+                callers[node.name].append((rule, node))
+
+    # Memoize everything that is not trivial, except that a rule
+    # called from a single place at a fixed offset only needs it if
+    # that caller is not memoized.  To avoid chains, this only looks
+    # at callers that are memoized for another reason.
+    memo = {}
+    for rule in grammar.rules:
+        override = _override(rule)
+        if override is not None:
+            memo[rule.name] = override
+        elif _trivial(rule):
+            memo[rule.name] = False
+        elif len(callers[rule.name]) != 1:
+            memo[rule.name] = True
+        else:
+            caller, ref = callers[rule.name][0]
+            if not _at_fixed_offset(_body(caller), ref):
+                memo[rule.name] = True
+
+    for rule in grammar.rules:
+        if rule.name in memo:
+            continue
+        caller = callers[rule.name][0][0].name
+        memo[rule.name] = caller == rule.name or not memo.get(caller, False)
+
+    return set(name for name, memoized in memo.items() if memoized)
@@ -20,9 +20,25 @@ from grako.exceptions import CodegenError
 from grako.model import Node
 from grako.codegen.cgbase import ModelRenderer, CodeGenerator
 
+from .analysis import memoized_rules
+
 def cpp_repr(str):
     return 'R"(' + urepr(str)[1:-1] + ')"'
 
+def cpp_literal(str):
+    """A C++ string literal for the characters in STR (unlike cpp_repr,
+    which keeps escape sequences as they are)."""
+    escapes = {'\\': '\\\\', '"': '\\"', '\n': '\\n', '\r': '\\r', '\t': '\\t'}
+    chars = []
+    for c in str:
+        if c in escapes:
+            chars.append(escapes[c])
+        elif ord(c) < 32 or ord(c) == 127:
+            chars.append('\\%03o' % ord(c))
+        else:
+            chars.append(c)
+    return '"' + ''.join(chars) + '"'
+
 class CppCodeGenerator(CodeGenerator):
     def _find_renderer_class(self, item):
         if not isinstance(item, Node):
@@ -39,6 +55,19 @@ def codegen(model):
     return CppCodeGenerator().render(model)
 
 
+def memo_arg(rule, memoized):
+    """The last argument of _call_r and _call_e for RULE (see
+    analysis.py)."""
+    return '' if rule.name in memoized else ', false'
+
+
+def call_args(rule, memoized, number):
+    """The arguments of _call after the body of RULE: whether it is
+    memoized, and its NUMBER for the trace (see Parser::_trace_rule)."""
+    memoize = 'true' if rule.name in memoized else 'false'
+    return ', %s, %d' % (memoize, number)
+
+
 class Base(ModelRenderer):
     def defines(self):
         return []
@@ -96,21 +125,39 @@ class Pattern(Base):
 
 
 class Lookahead(_Decorator):
+    def render_fields(self, fields):
+        from .recognizer import codegen_exp
+        recognizer, target = codegen_exp(self.node.exp, 'r', 'done')
+        fields.update(recognizer=recognizer, label=target.label())
+
+    # The lookahead is checked with the recognizer, the expression is
+    # only used for the exception if it fails.
     template = '''\
-                ast << _if([this] () {{
+                ast << _if_r([this] () {{
                     AstPtr ast = std::make_shared<Ast>();
                 {exp:1::}
                     return ast;
+                }}, [this] () {{
+                    Recognized r;
+                {recognizer:1::}
+                  {label}
+                    return r;
                 }}); RETURN_IF_EXC(ast);\
                 '''
 
 
 class NegativeLookahead(_Decorator):
+    def render_fields(self, fields):
+        from .recognizer import codegen_exp
+        recognizer, target = codegen_exp(self.node.exp, 'r', 'done')
+        fields.update(recognizer=recognizer, label=target.label())
+
     template = '''\
-                ast << _ifnot([this] () {{
-                    AstPtr ast = std::make_shared<Ast>();
-                {exp:1::}
-                    return ast;
+                ast << _ifnot_r([this] () {{
+                    Recognized r;
+                {recognizer:1::}
+                  {label}
+                    return r;
                 }}); RETURN_IF_EXC(ast);\
                 '''
 
@@ -321,11 +368,11 @@ class Rule(_Decorator):
                 AstPtr {classname}Parser::_{name}_()
                 {{
                     AstPtr ast = std::make_shared<Ast>();
-                    ast << _call("{name}", &Semantics::_{name}_, [this] () {{
+                    ast << _call("{name}", &Semantics::_{name}_, [this] () GRAKOPP_RULE {{
                 {defines:2::}
                 {exp:2::}
                         return ast;
-                    }}); RETURN_IF_EXC(ast);
+                    }}{args}); RETURN_IF_EXC(ast);
                     return ast;
                 }}
                 '''
@@ -350,7 +397,7 @@ class Grammar(Base):
         abstract_rules = '\n'.join(abstract_rules)
 
         if self.node.whitespace is not None:
-            whitespace = "set_whitespace(" + cpp_repr(self.node.whitespace) + ");"
+            whitespace = "set_whitespace(" + cpp_literal(self.node.whitespace) + ");"
         else:
             whitespace = "// use default whitespace setting"
 
@@ -360,8 +407,16 @@ class Grammar(Base):
         else:
             nameguard = "// use default nameguard setting"
 
+        if self.node.trace:
+            trace = "set_trace(std::make_shared<TraceBuffer>());"
+        else:
+            trace = "// no trace (use grakopp --trace)"
+
+        memoized = memoized_rules(self.node)
         rules = '\n'.join([
-            self.get_renderer(rule).render(classname=fields['name']) for rule in self.node.rules
+            self.get_renderer(rule).render(classname=fields['name'],
+                                           args=call_args(rule, memoized, number))
+            for number, rule in enumerate(self.node.rules)
         ])
 
         findruleitems = '\n'.join([
@@ -369,14 +424,29 @@ class Grammar(Base):
             for rule in self.node.rules
         ])
 
+        # The recognizers are the same for all C++ backends.
+        from .recognizer import codegen_rule
+        recognizers = '\n'.join([
+            codegen_rule(rule, fields['name'], memo_arg(rule, memoized))
+            for rule in self.node.rules
+        ])
+        emitters = '\n'.join([
+            codegen_rule(rule, fields['name'], memo_arg(rule, memoized),
+                         events=True)
+            for rule in self.node.rules
+        ])
+
         version = str(tuple(int(n) for n in str(timestamp()).split('.')))
 
         fields.update(rules=rules,
                       findruleitems=indent(findruleitems),
+                      recognizers=recognizers,
+                      emitters=emitters,
                       abstract_rules=abstract_rules,
                       version=version,
                       whitespace=whitespace,
-                      nameguard=nameguard
+                      nameguard=nameguard,
+                      trace=trace
                       )
 
     # FIXME.  Clarify interface (avoid copies). 
@@ -408,11 +478,34 @@ class Grammar(Base):
                 {{
                   {whitespace}
                   {nameguard}
+                  {trace}
                 }}
 
                 {name}Parser::rule_method_t {name}Parser::find_rule(const std::string& name)
                 {{
-                  std::map<std::string, rule_method_t> map({{
+                  static const std::map<std::string, rule_method_t> map({{
+                {findruleitems}
+                  }});
+                  auto el = map.find(name);
+                  if (el != map.end())
+                    return el->second;
+                  return 0;
+                }}
+
+                {name}Parser::recognizer_method_t {name}Parser::find_recognizer(const std::string& name)
+                {{
+                  static const std::map<std::string, recognizer_method_t> map({{
+                {findruleitems}
+                  }});
+                  auto el = map.find(name);
+                  if (el != map.end())
+                    return el->second;
+                  return 0;
+                }}
+
+                {name}Parser::emitter_method_t {name}Parser::find_emitter(const std::string& name)
+                {{
+                  static const std::map<std::string, emitter_method_t> map({{
                 {findruleitems}
                   }});
                   auto el = map.find(name);
@@ -423,8 +516,15 @@ class Grammar(Base):
 
                 {rules}
 
+                {recognizers}
+
+                {emitters}
+
                 #ifdef GRAKOPP_MAIN
                 #include <grakopp/ast-io.hpp>
+                #include <grakopp/ast-binary.hpp>
+                #include <grakopp/parallel.hpp>
+                #include <grakopp/cache.hpp>
 
                 int
                 main(int argc, char *argv[])
@@ -435,13 +535,76 @@ class Grammar(Base):
                     std::list<std::string> args(argv + 1, argv + argc);
                     bool validate = false;
                     std::string validate_file;
-
-                    if (args.front() == "--test")
+                    bool recognize = false;
+                    bool events = false;
+                    bool compact = false;
+
+                    std::string records;
+                    std::string cache_dir;
+                    size_t memo_budget = 0;
+                    std::string profile;
+                    std::string stats;
+                    std::string trace_file;
+                    std::string binary_file;
+
+                    while (args.size() > 0 && args.front().compare(0, 2, "--") == 0)
                     {{
+                        std::string option = args.front();
                         args.pop_front();
-                        validate = true;
-                        validate_file = args.front();
-                        args.pop_front();
+                        if (option == "--test")
+                        {{
+                            validate = true;
+                            validate_file = args.front();
+                            args.pop_front();
+                        }}
+                        else if (option == "--records")
+                        {{
+                            records = args.front();
+                            args.pop_front();
+                        }}
+                        else if (option == "--cache")
+                        {{
+                            cache_dir = args.front();
+                            args.pop_front();
+                        }}
+                        else if (option == "--recognize")
+                            recognize = true;
+                        else if (option == "--events")
+                            events = true;
+                        else if (option == "--compact")
+                            compact = true;
+                        else if (option == "--memo-budget")
+                        {{
+                            memo_budget = std::stoul(args.front());
+                            args.pop_front();
+                        }}
+                        else if (option == "--trace")
+                        {{
+                            trace_file = args.front();
+                            args.pop_front();
+                        }}
+                        else if (option == "--binary")
+                        {{
+                            /* Also write the AST in the binary format.  */
+                            binary_file = args.front();
+                            args.pop_front();
+                        }}
+                        else if (option == "--profile")
+                        {{
+                            /* Needs -DGRAKOPP_PROFILE.  */
+                            profile = args.front();
+                            args.pop_front();
+                        }}
+                        else if (option == "--stats")
+                        {{
+                            stats = args.front();
+                            args.pop_front();
+                        }}
+                        else
+                        {{
+                            std::cerr << "ERROR: unknown option " << option << "\\n";
+                            return 2;
+                        }}
                     }}
 
                     BufferPtr buf = std::make_shared<Buffer>();
@@ -450,24 +613,81 @@ class Grammar(Base):
                     buf->from_file(args.front());
                     args.pop_front();
                     parser.set_buffer(buf);
+                    parser.set_memo_budget(memo_budget);
+                    if (! trace_file.empty() && ! parser._trace)
+                        parser.set_trace(std::make_shared<TraceBuffer>());
 
                     try
                     {{
                         std::string startrule(args.front());
                         args.pop_front();
+                        if (recognize)
+                        {{
+                            /* Only check if the input matches.  */
+                            {name}Parser::recognizer_method_t recognizer = parser.find_recognizer(startrule);
+                            if ((parser.*recognizer)(Recognize()))
+                                return 0;
+                            std::cerr << "ERROR: not recognized at position " << parser._error_pos << "\\n";
+                            return 1;
+                        }}
+                        if (events && validate)
+                        {{
+                            /* Check the events against the AST.  */
+                            ParseEventChecker checker;
+                            parser.set_event_handler(&checker);
+                            {name}Parser::emitter_method_t emitter = parser.find_emitter(startrule);
+                            bool matched = bool((parser.*emitter)(EmitEvents()));
+                            std::string error = checker.check(matched, *read_json_file(validate_file));
+                            if (error.empty())
+                                return 0;
+                            std::cerr << "ERROR: " << error << "\\n";
+                            return 1;
+                        }}
+                        if (events)
+                        {{
+                            /* Print the events instead of the AST.  */
+                            ParseEventPrinter printer(std::cout);
+                            parser.set_event_handler(&printer);
+                            {name}Parser::emitter_method_t emitter = parser.find_emitter(startrule);
+                            if ((parser.*emitter)(EmitEvents()))
+                                return 0;
+                            std::cerr << "ERROR: no match at position " << parser._error_pos << "\\n";
+                            return 1;
+                        }}
+
                         {name}Parser::rule_method_t rule = parser.find_rule(startrule);
-                        AstPtr ast = (parser.*rule)();
-                        std::cout << *ast << "\\n";
+                        AstPtr ast;
+                        if (! cache_dir.empty())
+                        {{
+                            ParseCache cache(cache_dir);
+                            ast = cached_call(cache, parser, rule, startrule);
+                        }}
+                        else if (records.empty())
+                            ast = (parser.*rule)();
+                        else
+                        {{
+                            /* Parse a sequence of STARTRULE records in parallel.  */
+                            WorkStealingPool workers;
+                            RecordParser<{name}Parser> record_parser(rule, sync_pattern(records), workers);
+                            ast = record_parser.parse(buf);
+                        }}
+                        if (compact)
+                            write_compact_json(std::cout, *ast);
+                        else
+                            std::cout << *ast;
+                        std::cout << "\\n";
+                        if (! binary_file.empty())
+                        {{
+                            std::ofstream file(binary_file, std::ios::binary);
+                            write_binary(file, *ast);
+                        }}
                         AstException *exc = ast->as_exception();
                         if (exc)
                             exc->_exc->_throw();
 
                         if (validate)
                         {{
-                            std::ifstream file;
-                            file.open(validate_file);
-                            AstPtr validate_ast = std::make_shared<Ast>();
-                            file >> std::noskipws >> std::ws >> validate_ast;
+                            AstPtr validate_ast = read_json_file(validate_file);
                             if (ast != validate_ast)
                                 result = 1;
                         }}
@@ -483,6 +703,17 @@ class Grammar(Base):
                         result = 2;
                     }}
 
+                    if (! profile.empty())
+                        std::cerr << parser.profile_report(profile == "json");
+                    if (! stats.empty())
+                        std::cerr << parser.stats_report(stats == "json");
+                    if (! trace_file.empty())
+                    {{
+                        /* Decode with grakopp-trace.  */
+                        std::ofstream file(trace_file, std::ios::binary);
+                        parser._trace->write(file);
+                    }}
+
                     return result;
                 }}
                 #endif /* GRAKOPP_MAIN */
@@ -0,0 +1,468 @@
+# python/grakopp/codegen/cppflat.py - Grako++ straight-line code generator backend -*- coding: utf-8 -*-
+# Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+# Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+#
+# This file is part of Grako++.  Grako++ is free software; you can
+# redistribute it and/or modify it under the terms of the 2-clause
+# BSD license, see file LICENSE.TXT.
+
+from __future__ import (absolute_import, division, print_function,
+                        unicode_literals)
+
+"""
+C++ code generation without nested lambdas for models defined with
+grako.model.
+
+The parsers generated by the cpp backend express every combinator as a
+call that takes a lambda through std::function, which the compiler can
+not inline.  This backend emits the body of each rule as one function
+instead: the combinators are expanded in place, with explicit save
+points for the position and state, loops for closures and goto for
+backtracking.  The parser class (see hpp.py) and the AST built are the
+same as with the cpp backend.  Lookaheads use the recognizers (see
+recognizer.py).
+"""
+
+from grako.codegen.cgbase import CodeGenerator
+from grako.exceptions import CodegenError
+from grako.model import Node
+
+from . import cpp
+from .recognizer import Target, codegen_exp
+
+
+class CppFlatCodeGenerator(CodeGenerator):
+    def _find_renderer_class(self, item):
+        if not isinstance(item, Node):
+            return None
+
+        name = item.__class__.__name__
+        renderer = globals().get(name, None)
+        if not renderer or not issubclass(renderer, Base):
+            raise CodegenError('Renderer for %s not found' % name)
+        return renderer
+
+
+def codegen(model):
+    return CppFlatCodeGenerator().render(model)
+
+
+# The targets of the expressions being rendered, innermost last.
+_targets = []
+
+
+class Base(cpp.Base):
+    @property
+    def target(self):
+        return _targets[-1]
+
+    def rend_to(self, item, ast, label):
+        target = Target(ast, label)
+        _targets.append(target)
+        try:
+            return self.rend(item), target
+        finally:
+            _targets.pop()
+
+    def add(self, expr):
+        target = self.target
+        return '%s << %s; GOTO_IF_EXC(%s, %s);' % (
+            target.ast, expr, target.ast, target.fail())
+
+
+class Void(Base, cpp.Void):
+    pass
+
+
+class Fail(Base, cpp.Fail):
+    def render_fields(self, fields):
+        fields.update(ast=self.target.ast, fail=self.target.fail())
+
+    template = '{ast} = _fail(); goto {fail};'
+
+
+class Comment(Base, cpp.Comment):
+    pass
+
+
+class EOF(Base, cpp.EOF):
+    def render_fields(self, fields):
+        fields.update(add=self.add('_check_eof()'))
+
+    template = '{add}'
+
+
+class _Decorator(Base, cpp._Decorator):
+    pass
+
+
+class Group(_Decorator, cpp.Group):
+    def render_fields(self, fields):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'ast%d' % n, 'group%d' % n)
+        fields.update(n=n, exp=exp, label=target.label(),
+                      add=self.add('ast%d' % n))
+
+    template = '''\
+                {{
+                    AstPtr ast{n} = std::make_shared<Ast>();
+                    {{
+                {exp:2::}
+                    }}
+                  {label}
+                    AstList *list{n} = ast{n}->as_list();
+                    if (list{n})
+                        list{n}->_mergeable = true;
+                    {add}
+                }}\
+               '''
+
+
+class Token(Base, cpp.Token):
+    def render_fields(self, fields):
+        fields.update(add=self.add('_token(%s)' % cpp.cpp_repr(self.node.token)))
+
+    template = '{add}'
+
+
+class Pattern(Base, cpp.Pattern):
+    def render_fields(self, fields):
+        raw_repr = cpp.cpp_repr(self.node.pattern).replace("\\\\", '\\')
+        fields.update(add=self.add('_pattern(%s)' % raw_repr))
+
+    template = '{add}'
+
+
+class Lookahead(_Decorator, cpp.Lookahead):
+    def render_fields(self, fields):
+        n = self.counter()
+        recognizer, rtarget = codegen_exp(self.node.exp, 'r%d' % n, 'if%d' % n)
+        exp, target = self.rend_to(self.node.exp, 'ast%d' % n, 'ifexc%d' % n)
+        fields.update(n=n, recognizer=recognizer, rlabel=rtarget.label(),
+                      exp=exp, label=target.label(),
+                      ast=self.target.ast, fail=self.target.fail())
+
+    # The lookahead is checked with the recognizer.  Only if it fails,
+    # the expression is parsed for the exception.
+    template = '''\
+                {{
+                    size_t pos{n} = _buffer->_pos;
+                    State state{n} = _state;
+                    Recognized r{n};
+                    {{
+                {recognizer:2::}
+                    }}
+                  {rlabel}
+                    _state = state{n};
+                    _buffer->_pos = pos{n};
+                    if (! r{n})
+                    {{
+                        AstPtr ast{n} = std::make_shared<Ast>();
+                        {{
+                {exp:3::}
+                        }}
+                      {label}
+                        _state = state{n};
+                        _buffer->_pos = pos{n};
+                        if (ast{n}->as_exception())
+                            {ast} << ast{n};
+                        else
+                            {ast} << _error<FailedLookahead>("");
+                        goto {fail};
+                    }}
+                }}\
+                '''
+
+
+class NegativeLookahead(_Decorator, cpp.NegativeLookahead):
+    def render_fields(self, fields):
+        n = self.counter()
+        recognizer, target = codegen_exp(self.node.exp, 'r%d' % n, 'ifnot%d' % n)
+        fields.update(n=n, recognizer=recognizer, label=target.label(),
+                      ast=self.target.ast, fail=self.target.fail())
+
+    template = '''\
+                {{
+                    size_t pos{n} = _buffer->_pos;
+                    State state{n} = _state;
+                    Recognized r{n};
+                    {{
+                {recognizer:2::}
+                    }}
+                  {label}
+                    _state = state{n};
+                    _buffer->_pos = pos{n};
+                    if (r{n})
+                    {{
+                        {ast} << _error<FailedLookahead>("");
+                        goto {fail};
+                    }}
+                }}\
+                '''
+
+
+class Sequence(Base, cpp.Sequence):
+    pass
+
+
+class Choice(Base, cpp.Choice):
+    def render_fields(self, fields):
+        n = self.counter()
+        template = cpp.trim(self.option_template)
+        options = []
+        for o in self.node.options:
+            m = self.counter()
+            option, target = self.rend_to(o, 'ast%d' % m, 'option%d' % m)
+            options.append(template.format(n=n, m=m, option=cpp.indent(option, 2),
+                                           label=target.label()))
+        options = '\n'.join(options)
+        firstset = ' '.join(f[0] for f in sorted(self.node.firstset) if f)
+        if firstset:
+            error = 'expecting one of: ' + firstset
+        else:
+            error = 'no available options'
+        fields.update(n=n,
+                      options=cpp.indent(options),
+                      error=cpp.cpp_repr(error),
+                      add=self.add('ast%d' % n)
+                      )
+
+    # A failed option leaves no trace.  An option that succeeds or
+    # fails after a cut is the result of the choice.
+    option_template = '''\
+                       {{
+                           AstPtr ast{m} = std::make_shared<Ast>();
+                           {{
+                       {option}
+                           }}
+                         {label}
+                           if (ast{m}->as_exception())
+                           {{
+                               _state = state{n};
+                               _buffer->_pos = pos{n};
+                           }}
+                           if (! ast{m}->as_exception() || ast{m}->_cut)
+                           {{
+                               ast{m}->_cut = false;
+                               ast{n} = ast{m};
+                               goto choice{n};
+                           }}
+                       }}\
+                      '''
+
+    template = '''\
+                {{
+                    size_t pos{n} = _buffer->_pos;
+                    State state{n} = _state;
+                    AstPtr ast{n};
+                {options}
+                    ast{n} = _error<FailedParse>({error});
+                  choice{n}:
+                    {add}
+                }}\
+               '''
+
+
+class Closure(_Decorator, cpp.Closure):
+    def render_closure(self, ast):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'ast%d' % n, 'closure%d' % n)
+        return cpp.trim(self.closure_template).format(
+            n=n, ast=ast, exp=cpp.indent(exp, 2), label=target.label())
+
+    def render_fields(self, fields):
+        n = self.counter()
+        fields.update(n=n, closure=self.render_closure('ast%d' % n),
+                      add=self.add('ast%d' % n))
+
+    # Collect results in AST until an iteration fails.  Only failures
+    # after a cut are passed on.
+    closure_template = '''\
+                        while (true)
+                        {{
+                            size_t pos{n} = _buffer->_pos;
+                            State state{n} = _state;
+                            AstPtr ast{n} = std::make_shared<Ast>();
+                            {{
+                        {exp}
+                            }}
+                          {label}
+                            if (ast{n}->as_exception())
+                            {{
+                                _state = state{n};
+                                _buffer->_pos = pos{n};
+                                if (ast{n}->_cut)
+                                    {ast} = ast{n};
+                                break;
+                            }}
+                            if (pos{n} == _buffer->_pos)
+                            {{
+                                {ast} = _error<FailedParse>("empty closure");
+                                break;
+                            }}
+                            {ast} << ast{n};
+                        }}\
+                       '''
+
+    template = '''\
+                {{
+                    AstPtr ast{n} = std::make_shared<Ast>(AstList());
+                {closure:1::}
+                    {add}
+                }}\
+                '''
+
+
+class PositiveClosure(Closure, cpp.PositiveClosure):
+    def render_fields(self, fields):
+        n = self.counter()
+        m = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'ast%d' % m, 'closure%d' % m)
+        k = self.counter()
+        fields.update(n=n, m=m, k=k, exp=exp, label=target.label(),
+                      closure=self.render_closure('ast%d' % k),
+                      add=self.add('ast%d' % n))
+
+    # The first iteration must succeed, the others are merged.
+    template = '''\
+                {{
+                    AstPtr ast{n} = std::make_shared<Ast>(AstList());
+                    {{
+                        AstPtr ast{m} = std::make_shared<Ast>();
+                        {{
+                {exp:3::}
+                        }}
+                      {label}
+                        ast{n} << ast{m};
+                    }}
+                    if (! ast{n}->as_exception())
+                    {{
+                        AstPtr ast{k} = std::make_shared<Ast>(AstList());
+                {closure:2::}
+                        AstList *list{k} = ast{k}->as_list();
+                        if (list{k})
+                            list{k}->_mergeable = true;
+                        ast{n} << ast{k};
+                    }}
+                    {add}
+                }}\
+                '''
+
+
+class Optional(_Decorator, cpp.Optional):
+    def render_fields(self, fields):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'ast%d' % n, 'optional%d' % n)
+        fields.update(n=n, exp=exp, label=target.label(),
+                      add=self.add('ast%d' % n))
+
+    # Failures without cut are ignored.
+    template = '''\
+                {{
+                    size_t pos{n} = _buffer->_pos;
+                    State state{n} = _state;
+                    AstPtr ast{n} = std::make_shared<Ast>();
+                    {{
+                {exp:2::}
+                    }}
+                  {label}
+                    if (ast{n}->as_exception())
+                    {{
+                        _state = state{n};
+                        _buffer->_pos = pos{n};
+                        if (! ast{n}->_cut)
+                            ast{n} = std::make_shared<Ast>();
+                    }}
+                    ast{n}->_cut = false;
+                    {add}
+                }}\
+               '''
+
+
+class Cut(Base, cpp.Cut):
+    def render_fields(self, fields):
+        fields.update(ast=self.target.ast)
+
+    template = '{ast} << _cut();'
+
+
+class Named(_Decorator, cpp.Named):
+    def render_fields(self, fields):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'ast%d' % n, 'named%d' % n)
+        fields.update(n=n, exp=exp, label=target.label(), name=self.node.name,
+                      ast=self.target.ast, fail=self.target.fail())
+
+    template = '''\
+                {{
+                    AstPtr ast{n} = std::make_shared<Ast>();
+                    {{
+                {exp:2::}
+                    }}
+                  {label}
+                    (*{ast})["{name}"] << ast{n}; GOTO_IF_EXC({ast}, {fail});
+                }}\
+                '''
+
+
+class NamedList(Named, cpp.NamedList):
+    pass
+
+
+class Override(Named, cpp.Override):
+    pass
+
+
+class OverrideList(NamedList, cpp.OverrideList):
+    pass
+
+
+class Special(Base, cpp.Special):
+    pass
+
+
+class RuleRef(Base, cpp.RuleRef):
+    def render_fields(self, fields):
+        fields.update(add=self.add('_%s_()' % self.node.name))
+
+    template = '{add}'
+
+
+class RuleInclude(_Decorator, cpp.RuleInclude):
+    pass
+
+
+class Rule(_Decorator, cpp.Rule):
+    def body(self):
+        return self.node.exp
+
+    def render_fields(self, fields):
+        super(Rule, self).render_fields(fields)
+
+        exp, target = self.rend_to(self.body(), 'ast', 'done')
+        # Drop the lines of unused labels.
+        exp = '\n'.join(l for l in exp.splitlines() if l.strip())
+        fields.update(exp=exp, label=target.label())
+
+    template = '''
+                AstPtr {classname}Parser::_{name}_()
+                {{
+                    AstPtr ast = std::make_shared<Ast>();
+                    ast << _call("{name}", &Semantics::_{name}_, [this] () GRAKOPP_RULE {{
+                {defines:2::}
+                {exp:2::}
+                      {label}
+                        return ast;
+                    }}{args}); RETURN_IF_EXC(ast);
+                    return ast;
+                }}
+                '''
+
+
+class BasedRule(Rule, cpp.BasedRule):
+    def body(self):
+        return self.rhs
+
+
+class Grammar(Base, cpp.Grammar):
+    pass
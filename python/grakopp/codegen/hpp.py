@@ -72,6 +72,8 @@ class Grammar(ModelRenderer):
 
     rule_template = '''
             AstPtr _{name}_();
+            Recognized _{name}_(Recognize);
+            Recognized _{name}_(EmitEvents);
             '''
 
     template = '''\
@@ -103,6 +105,11 @@ class Grammar(ModelRenderer):
                     virtual ~{name}Parser() {{}};
                     typedef AstPtr ({name}Parser::*rule_method_t) ();
                     rule_method_t find_rule(const std::string& name);
+                    typedef Recognized ({name}Parser::*recognizer_method_t) (Recognize);
+                    recognizer_method_t find_recognizer(const std::string& name);
+                    typedef Recognized ({name}Parser::*emitter_method_t) (EmitEvents);
+                    emitter_method_t find_emitter(const std::string& name);
+                    static const char* version__() {{ return "{version}"; }}
                 {rules}
                 }};
                '''
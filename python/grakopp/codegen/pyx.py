@@ -106,7 +106,7 @@ class Grammar(ModelRenderer):
                 from cython.operator cimport dereference as deref
 
                 from grakopp.buffer cimport PyBuffer
-                from grakopp.parser cimport Parser
+                from grakopp.parser cimport Parser, ParserStats
                 from grakopp.ast cimport Ast, AstPtr, PyAst, python_to_ast, exc_to_ast
 
                 from cpython.ref cimport PyObject, Py_XINCREF, Py_XDECREF
@@ -196,6 +196,56 @@ class Grammar(ModelRenderer):
                         self.state_intern = dict()
                         self.state_by_id = dict()
 
+                    # Run the semantic actions only on the final parse.
+                    def set_deferred_semantics(self, deferred):
+                        deref(self.parser).set_deferred_semantics(deferred)
+
+                    # Memoize failures in bitmaps.
+                    def set_compact_failures(self, compact):
+                        deref(self.parser).set_compact_failures(compact)
+
+                    # Limit the size of the memoization caches.
+                    def set_memo_budget(self, entries, lru=False):
+                        deref(self.parser).set_memo_budget(entries, lru)
+
+                    # Stop memoizing rules with a low hit rate.
+                    def set_adaptive_memo(self, min_hit_rate, min_lookups=1000):
+                        deref(self.parser).set_adaptive_memo(min_hit_rate, min_lookups)
+
+                    # The rule profile, if compiled with GRAKOPP_PROFILE.
+                    def profile_report(self, json=False):
+                        return deref(self.parser).profile_report(json)
+
+                    # The memoization caches and memory, as a dict (see
+                    # grakopp/stats.hpp).
+                    def stats(self):
+                        cdef ParserStats stats = deref(self.parser).stats()
+                        return {{
+                            'memo_entries': stats._memo_entries,
+                            'memo_high_water': stats._memo_high_water,
+                            'failure_entries': stats._failure_entries,
+                            'failure_high_water': stats._failure_high_water,
+                            'cut_dropped': stats._cut_dropped,
+                            'evicted': stats._evicted,
+                            'memo_bytes': stats._memo_bytes,
+                            'memo_bytes_high_water': stats._memo_bytes_high_water,
+                            'ast_bytes': stats._ast_bytes,
+                            'string_bytes': stats._string_bytes,
+                            'buffer_bytes': stats._buffer_bytes,
+                            'ast_nodes': stats._ast_nodes,
+                            'ast_counted': stats._ast_counted,
+                            'ast_allocated': stats._ast_allocated,
+                            'ast_freed': stats._ast_freed,
+                            'ast_high_water': stats._ast_high_water,
+                        }}
+
+                    # Support for incremental reparsing.
+                    def set_incremental(self, incremental):
+                        deref(self.parser).set_incremental(incremental)
+
+                    def edit(self, offset, removed, inserted):
+                        deref(self.parser).edit(offset, removed, inserted)
+
                     # Support for stateful parsing.
                     property _state:
                         def __get__(self):
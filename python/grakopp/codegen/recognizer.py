@@ -0,0 +1,541 @@
+# python/grakopp/codegen/recognizer.py - Grako++ recognizer generator -*- coding: utf-8 -*-
+# Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+# Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+#
+# This file is part of Grako++.  Grako++ is free software; you can
+# redistribute it and/or modify it under the terms of the 2-clause
+# BSD license, see file LICENSE.TXT.
+
+from __future__ import (absolute_import, division, print_function,
+                        unicode_literals)
+
+"""
+C++ code generation of recognizers for models defined with
+grako.model.
+
+A recognizer only checks if a rule matches, without building an AST
+or calling semantics (see Recognized in grakopp/parser.hpp).  The
+rules are expanded like in the cpp-flat backend, but the result of an
+expression is a Recognized variable instead of an AST.  The cpp and
+cpp-flat backends both include the recognizers with the rules, and use
+them for lookaheads.
+
+The event emitters (see grakopp/events.hpp) are recognizers that also
+report the rules, named elements, closures and terminals they match,
+and put the options of choices, optional elements and iterations of
+closures in a speculation, whose events are dropped if it fails.
+Their lookaheads are plain recognizers.
+"""
+
+from grako.util import indent, trim
+from grako.exceptions import CodegenError
+from grako.model import Node
+from grako.codegen.cgbase import ModelRenderer, CodeGenerator
+
+from .cpp import cpp_repr
+
+
+class RecognizerCodeGenerator(CodeGenerator):
+    def _find_renderer_class(self, item):
+        if not isinstance(item, Node):
+            return None
+
+        name = item.__class__.__name__
+        renderer = globals().get(name, None)
+        if not renderer or not issubclass(renderer, Base):
+            raise CodegenError('Renderer for %s not found' % name)
+        return renderer
+
+
+class Target(object):
+    """The variable an expression adds its result to (an AST, or a
+    Recognized for recognizers), and the label it jumps to if it fails
+    (after adding the failure).  This is also used by the cpp-flat
+    backend.  EVENTS is set for the expressions of event emitters."""
+
+    def __init__(self, ast, label, events=False):
+        self.ast = ast
+        self._label = label
+        self.events = events
+        self.used = False
+
+    def fail(self):
+        self.used = True
+        return self._label
+
+    def label(self):
+        # Only emit labels somebody jumps to.
+        return self._label + ':' if self.used else ''
+
+
+def codegen_rule(rule, classname, memo='', events=False):
+    """The recognizer for RULE, or its event emitter with EVENTS."""
+    return RecognizerCodeGenerator().render(rule, classname=classname,
+                                            memo=memo, events=events)
+
+
+def codegen_exp(exp, result, label):
+    """The recognizer for the expression EXP, which adds to the
+    Recognized variable RESULT and jumps to LABEL if it fails.  Returns
+    the code and the target (for the label line)."""
+    target = Target(result, label)
+    _targets.append(target)
+    try:
+        code = RecognizerCodeGenerator().render(exp)
+        # Drop the lines left empty by the parts for event emitters.
+        return '\n'.join(l for l in code.splitlines() if l.strip()), target
+    finally:
+        _targets.pop()
+
+
+# The targets of the expressions being rendered, innermost last.
+_targets = []
+
+
+class Base(ModelRenderer):
+    @property
+    def target(self):
+        return _targets[-1]
+
+    @property
+    def events(self):
+        return self.target.events
+
+    def rend_to(self, item, result, label, events=None):
+        if events is None:
+            events = self.events
+        target = Target(result, label, events)
+        _targets.append(target)
+        try:
+            return self.rend(item), target
+        finally:
+            _targets.pop()
+
+    def add(self, expr):
+        target = self.target
+        return '%s << %s; GOTO_IF_FAIL(%s, %s);' % (
+            target.ast, expr, target.ast, target.fail())
+
+    def terminal(self, name):
+        """The runtime function of the terminal NAME in this mode."""
+        return name + ('_e' if self.events else '_r')
+
+    def speculation(self, n):
+        """The code to open and close the speculation of the result
+        rN in event mode (see ParseEventQueue)."""
+        if not self.events:
+            return '', ''
+        return '_events.begin();', '_events.end(bool(r%d));' % n
+
+    def event(self, code):
+        return code if self.events else ''
+
+
+class Void(Base):
+    template = ';'
+
+
+class Fail(Base):
+    def render_fields(self, fields):
+        fields.update(r=self.target.ast, fail=self.target.fail())
+
+    template = '{r} << _fail_r(); goto {fail};'
+
+
+class Comment(Base):
+    template = '''
+        /* {comment} */
+
+        '''
+
+
+class EOF(Base):
+    def render_fields(self, fields):
+        fields.update(add=self.add('_check_eof_r()'))
+
+    template = '{add}'
+
+
+class _Decorator(Base):
+    template = '{exp}'
+
+
+class Group(_Decorator):
+    # Without an AST, a group is the same as its contents.
+    pass
+
+
+class Token(Base):
+    def render_fields(self, fields):
+        fields.update(add=self.add('%s(%s)' % (self.terminal('_token'),
+                                               cpp_repr(self.node.token))))
+
+    template = '{add}'
+
+
+class Pattern(Base):
+    def render_fields(self, fields):
+        raw_repr = cpp_repr(self.node.pattern).replace("\\\\", '\\')
+        fields.update(add=self.add('%s(%s)' % (self.terminal('_pattern'),
+                                               raw_repr)))
+
+    template = '{add}'
+
+
+class Lookahead(_Decorator):
+    def render_fields(self, fields):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'r%d' % n, 'if%d' % n,
+                                   events=False)
+        fields.update(n=n, exp=exp, label=target.label(),
+                      r=self.target.ast, fail=self.target.fail())
+
+    template = '''\
+                {{
+                    size_t pos{n} = _buffer->_pos;
+                    State state{n} = _state;
+                    Recognized r{n};
+                    {{
+                {exp:2::}
+                    }}
+                  {label}
+                    _state = state{n};
+                    _buffer->_pos = pos{n};
+                    if (! r{n})
+                    {{
+                        {r} << r{n};
+                        goto {fail};
+                    }}
+                }}\
+                '''
+
+
+class NegativeLookahead(_Decorator):
+    def render_fields(self, fields):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'r%d' % n, 'ifnot%d' % n,
+                                   events=False)
+        fields.update(n=n, exp=exp, label=target.label(),
+                      r=self.target.ast, fail=self.target.fail())
+
+    template = '''\
+                {{
+                    size_t pos{n} = _buffer->_pos;
+                    State state{n} = _state;
+                    Recognized r{n};
+                    {{
+                {exp:2::}
+                    }}
+                  {label}
+                    _state = state{n};
+                    _buffer->_pos = pos{n};
+                    if (r{n})
+                    {{
+                        {r} << _error_r();
+                        goto {fail};
+                    }}
+                }}\
+                '''
+
+
+class Sequence(Base):
+    def render_fields(self, fields):
+        fields.update(seq='\n'.join(self.rend(s) for s in self.node.sequence))
+
+    template = '''
+                {seq}\
+                '''
+
+
+class Choice(Base):
+    def render_fields(self, fields):
+        n = self.counter()
+        template = trim(self.option_template)
+        options = []
+        for o in self.node.options:
+            m = self.counter()
+            option, target = self.rend_to(o, 'r%d' % m, 'option%d' % m)
+            begin, end = self.speculation(m)
+            options.append(template.format(n=n, m=m, option=indent(option, 2),
+                                           label=target.label(),
+                                           begin=begin, end=end))
+        fields.update(n=n,
+                      options=indent('\n'.join(options)),
+                      add=self.add('r%d' % n))
+
+    def render(self, **fields):
+        if len(self.node.options) == 1:
+            return self.rend(self.options[0], **fields)
+        else:
+            return super(Choice, self).render(**fields)
+
+    option_template = '''\
+                       {{
+                           Recognized r{m};
+                           {begin}
+                           {{
+                       {option}
+                           }}
+                         {label}
+                           {end}
+                           if (! r{m})
+                           {{
+                               _state = state{n};
+                               _buffer->_pos = pos{n};
+                           }}
+                           if (r{m} || r{m}._cut)
+                           {{
+                               r{m}._cut = false;
+                               r{n} = r{m};
+                               goto choice{n};
+                           }}
+                       }}\
+                      '''
+
+    template = '''\
+                {{
+                    size_t pos{n} = _buffer->_pos;
+                    State state{n} = _state;
+                    Recognized r{n};
+                {options}
+                    r{n} = Recognized(false);
+                  choice{n}:
+                    {add}
+                }}\
+               '''
+
+
+class Closure(_Decorator):
+    def render_closure(self, result):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'r%d' % n, 'closure%d' % n)
+        begin, end = self.speculation(n)
+        return trim(self.closure_template).format(
+            n=n, r=result, exp=indent(exp, 2), label=target.label(),
+            begin=begin, end=end)
+
+    def list_events(self, result):
+        """The events of the list of a closure with the result
+        RESULT."""
+        return (self.event('_list_start_e();'),
+                self.event('if (%s) _list_end_e();' % result))
+
+    def render_fields(self, fields):
+        n = self.counter()
+        list_start, list_end = self.list_events('r%d' % n)
+        fields.update(n=n, closure=self.render_closure('r%d' % n),
+                      list_start=list_start, list_end=list_end,
+                      add=self.add('r%d' % n))
+
+    def render(self, **fields):
+        if {()} in self.node.exp.firstset:
+            raise CodegenError('may repeat empty sequence')
+        return super(Closure, self).render(**fields)
+
+    closure_template = '''\
+                        while (true)
+                        {{
+                            size_t pos{n} = _buffer->_pos;
+                            State state{n} = _state;
+                            Recognized r{n};
+                            {begin}
+                            {{
+                        {exp}
+                            }}
+                          {label}
+                            {end}
+                            if (! r{n})
+                            {{
+                                _state = state{n};
+                                _buffer->_pos = pos{n};
+                                if (r{n}._cut)
+                                    {r} = r{n};
+                                break;
+                            }}
+                            if (pos{n} == _buffer->_pos)
+                            {{
+                                {r} = Recognized(false);
+                                break;
+                            }}
+                            {r} << r{n};
+                        }}\
+                       '''
+
+    template = '''\
+                {{
+                    Recognized r{n};
+                    {list_start}
+                {closure:1::}
+                    {list_end}
+                    {add}
+                }}\
+                '''
+
+
+class PositiveClosure(Closure):
+    def render_fields(self, fields):
+        n = self.counter()
+        m = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'r%d' % m, 'closure%d' % m)
+        k = self.counter()
+        list_start, list_end = self.list_events('r%d' % n)
+        fields.update(n=n, m=m, k=k, exp=exp, label=target.label(),
+                      closure=self.render_closure('r%d' % k),
+                      list_start=list_start, list_end=list_end,
+                      add=self.add('r%d' % n))
+
+    template = '''\
+                {{
+                    Recognized r{n};
+                    {list_start}
+                    {{
+                        Recognized r{m};
+                        {{
+                {exp:3::}
+                        }}
+                      {label}
+                        r{n} << r{m};
+                    }}
+                    if (r{n})
+                    {{
+                        Recognized r{k};
+                {closure:2::}
+                        r{n} << r{k};
+                    }}
+                    {list_end}
+                    {add}
+                }}\
+                '''
+
+
+class Optional(_Decorator):
+    def render_fields(self, fields):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'r%d' % n, 'optional%d' % n)
+        begin, end = self.speculation(n)
+        fields.update(n=n, exp=exp, label=target.label(),
+                      begin=begin, end=end, add=self.add('r%d' % n))
+
+    template = '''\
+                {{
+                    size_t pos{n} = _buffer->_pos;
+                    State state{n} = _state;
+                    Recognized r{n};
+                    {begin}
+                    {{
+                {exp:2::}
+                    }}
+                  {label}
+                    {end}
+                    if (! r{n})
+                    {{
+                        _state = state{n};
+                        _buffer->_pos = pos{n};
+                        if (! r{n}._cut)
+                            r{n} = Recognized();
+                    }}
+                    r{n}._cut = false;
+                    {add}
+                }}\
+               '''
+
+
+class Cut(Base):
+    def render_fields(self, fields):
+        fields.update(r=self.target.ast, cut=self.terminal('_cut'))
+
+    template = '{r} << {cut}();'
+
+
+class Named(_Decorator):
+    def render_fields(self, fields):
+        n = self.counter()
+        exp, target = self.rend_to(self.node.exp, 'r%d' % n, 'named%d' % n)
+        name = cpp_repr(self.node.name)
+        fields.update(n=n, exp=exp, label=target.label(),
+                      r=self.target.ast, fail=self.target.fail(),
+                      field_start=self.event('_field_start_e(%s, %s);' % (
+                          name, 'true' if self.is_list else 'false')),
+                      field_end=self.event('_field_end_e(%s, bool(r%d));' % (
+                          name, n)))
+
+    is_list = False
+
+    # Like adding to an element of a map, this only passes on failure.
+    template = '''\
+                {{
+                    Recognized r{n};
+                    {field_start}
+                    {{
+                {exp:2::}
+                    }}
+                  {label}
+                    {field_end}
+                    if (! r{n})
+                    {{
+                        {r}._ok = false;
+                        goto {fail};
+                    }}
+                }}\
+                '''
+
+
+class NamedList(Named):
+    is_list = True
+
+
+class Override(Named):
+    pass
+
+
+class OverrideList(NamedList):
+    pass
+
+
+class Special(Base):
+    pass
+
+
+class RuleRef(Base):
+    def render_fields(self, fields):
+        tag = 'EmitEvents' if self.events else 'Recognize'
+        fields.update(add=self.add('_%s_(%s())' % (self.node.name, tag)))
+
+    template = '{add}'
+
+
+class RuleInclude(_Decorator):
+    def render_fields(self, fields):
+        fields.update(exp=self.rend(self.node.rule.exp))
+
+
+class Rule(_Decorator):
+    def body(self):
+        return self.node.exp
+
+    def render_fields(self, fields):
+        self.reset_counter()
+        events = fields.get('events', False)
+        exp, target = self.rend_to(self.body(), 'r', 'done', events=events)
+        # Drop the lines of unused labels.
+        exp = '\n'.join(l for l in exp.splitlines() if l.strip())
+        fields.update(exp=exp, label=target.label(),
+                      tag='EmitEvents' if events else 'Recognize',
+                      call='_call_e' if events else '_call_r')
+
+    template = '''
+                Recognized {classname}Parser::_{name}_({tag})
+                {{
+                    return {call}("{name}", [this] () GRAKOPP_RULE {{
+                        Recognized r;
+                {exp:2::}
+                      {label}
+                        return r;
+                    }}{memo});
+                }}
+                '''
+
+
+class BasedRule(Rule):
+    def body(self):
+        return self.rhs
@@ -0,0 +1,469 @@
+# python/grakopp/codegen/vm.py - Grako++ bytecode generator backend -*- coding: utf-8 -*-
+# Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+# Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+#
+# This file is part of Grako++.  Grako++ is free software; you can
+# redistribute it and/or modify it under the terms of the 2-clause
+# BSD license, see file LICENSE.TXT.
+
+from __future__ import (absolute_import, division, print_function,
+                        unicode_literals)
+
+"""
+Bytecode generation for models defined with grako.model.
+
+The program is run by VmParser in grakopp/vm.hpp, see there for the
+instruction set.  The expressions are translated like in the cpp-flat
+backend: every expression with its own AST opens a frame, and the
+instructions in it jump to the instruction closing the frame if they
+fail.  The renderers produce assembler text with symbolic labels,
+which Grammar resolves.
+"""
+
+from grako.util import trim, timestamp, urepr, compress_seq
+from grako.exceptions import CodegenError
+from grako.model import Node
+from grako.codegen.cgbase import ModelRenderer, CodeGenerator
+
+from .cpp import cpp_literal
+
+
+class VmCodeGenerator(CodeGenerator):
+    def _find_renderer_class(self, item):
+        if not isinstance(item, Node):
+            return None
+
+        name = item.__class__.__name__
+        renderer = globals().get(name, None)
+        if not renderer or not issubclass(renderer, Base):
+            raise CodegenError('Renderer for %s not found' % name)
+        return renderer
+
+
+def codegen(model):
+    return VmCodeGenerator().render(model)
+
+
+def raw(str):
+    # The same text as in the raw strings of the cpp backend.
+    return urepr(str)[1:-1]
+
+
+class Program(object):
+    """The string table and rule numbers of the program being
+    generated."""
+
+    def __init__(self, rules):
+        self.strings = []
+        self._strings = {}
+        self.rules = dict((rule.name, i) for i, rule in enumerate(rules))
+
+    def string(self, str):
+        if str not in self._strings:
+            self._strings[str] = len(self.strings)
+            self.strings.append(str)
+        return self._strings[str]
+
+
+_program = None
+
+# The labels failing instructions jump to, innermost last.
+_fail = []
+
+
+class Base(ModelRenderer):
+    def defines(self):
+        return []
+
+    def fail(self):
+        return _fail[-1]
+
+    def label(self):
+        return 'L%d' % self.counter()
+
+    def rend_to(self, item, label):
+        _fail.append(label)
+        try:
+            return self.rend(item)
+        finally:
+            _fail.pop()
+
+    def string(self, str):
+        return _program.string(str)
+
+
+class Void(Base):
+    template = ''
+
+
+class Fail(Base):
+    def render_fields(self, fields):
+        fields.update(fail=self.fail())
+
+    template = 'FAIL - {fail}'
+
+
+class Comment(Base):
+    template = ''
+
+
+class EOF(Base):
+    def render_fields(self, fields):
+        fields.update(fail=self.fail())
+
+    template = 'EOF - {fail}'
+
+
+class _Decorator(Base):
+    def defines(self):
+        return self.get_renderer(self.node.exp).defines()
+
+    # The instruction that closes the frame.
+    close = 'ADD'
+
+    def render_fields(self, fields):
+        label = self.label()
+        fields.update(exp=self.rend_to(self.node.exp, label),
+                      label=label,
+                      close=self.close,
+                      fail=self.fail())
+
+    template = '''
+                PUSH - -
+                {exp}
+                {label}:
+                {close} - {fail}
+                '''
+
+
+class Group(_Decorator):
+    close = 'GROUP'
+
+
+class Token(Base):
+    def render_fields(self, fields):
+        fields.update(token=self.string(raw(self.node.token)),
+                      fail=self.fail())
+
+    template = 'TOKEN {token} {fail}'
+
+
+class Pattern(Base):
+    def render_fields(self, fields):
+        pattern = raw(self.node.pattern).replace("\\\\", '\\')
+        fields.update(pattern=self.string(pattern), fail=self.fail())
+
+    template = 'PATTERN {pattern} {fail}'
+
+
+class Lookahead(_Decorator):
+    close = 'IF'
+
+
+class NegativeLookahead(_Decorator):
+    close = 'IFNOT'
+
+
+class Sequence(Base):
+    def defines(self):
+        return [d for s in self.node.sequence for d in s.defines()]
+
+    def render_fields(self, fields):
+        fields.update(seq='\n'.join(self.rend(s) for s in self.node.sequence))
+
+    template = '''
+                {seq}\
+                '''
+
+
+class Choice(Base):
+    def defines(self):
+        return [d for o in self.node.options for d in o.defines()]
+
+    def render_fields(self, fields):
+        done = self.label()
+        options = []
+        for o in self.node.options:
+            label = self.label()
+            options.append(trim(self.option_template).format(
+                option=self.rend_to(o, label), label=label, done=done))
+        firstset = ' '.join(f[0] for f in sorted(self.node.firstset) if f)
+        if firstset:
+            error = 'expecting one of: ' + firstset
+        else:
+            error = 'no available options'
+        fields.update(options='\n'.join(options),
+                      error=self.string(raw(error)),
+                      done=done,
+                      fail=self.fail())
+
+    def render(self, **fields):
+        if len(self.node.options) == 1:
+            return self.rend(self.options[0], **fields)
+        else:
+            return super(Choice, self).render(**fields)
+
+    option_template = '''
+                       PUSH - -
+                       {option}
+                       {label}:
+                       OPTION {done} -
+                       '''
+
+    template = '''
+                PUSH - -
+                {options}
+                ERROR {error} -
+                {done}:
+                ADD - {fail}
+                '''
+
+
+class Closure(_Decorator):
+    def render_fields(self, fields):
+        loop = self.label()
+        label = self.label()
+        done = self.label()
+        fields.update(exp=self.rend_to(self.node.exp, label),
+                      loop=loop,
+                      label=label,
+                      done=done,
+                      fail=self.fail())
+
+    def render(self, **fields):
+        if {()} in self.node.exp.firstset:
+            raise CodegenError('may repeat empty sequence')
+        return super(Closure, self).render(**fields)
+
+    template = '''
+                PUSH_LIST - -
+                {loop}:
+                PUSH - -
+                {exp}
+                {label}:
+                ITERATE {loop} {done}
+                {done}:
+                ADD - {fail}
+                '''
+
+
+class PositiveClosure(Closure):
+    def render_fields(self, fields):
+        first = self.label()
+        loop = self.label()
+        label = self.label()
+        done = self.label()
+        end = self.label()
+        fields.update(first_exp=self.rend_to(self.node.exp, first),
+                      exp=self.rend_to(self.node.exp, label),
+                      first=first,
+                      loop=loop,
+                      label=label,
+                      done=done,
+                      end=end,
+                      fail=self.fail())
+
+    # The first iteration must succeed, the others are merged.
+    template = '''
+                PUSH_LIST - -
+                PUSH - -
+                {first_exp}
+                {first}:
+                ADD - {end}
+                PUSH_LIST - -
+                {loop}:
+                PUSH - -
+                {exp}
+                {label}:
+                ITERATE {loop} {done}
+                {done}:
+                MERGE - -
+                {end}:
+                ADD - {fail}
+                '''
+
+
+class Optional(_Decorator):
+    close = 'OPTIONAL'
+
+
+class Cut(Base):
+    template = 'CUT - -'
+
+
+class Named(_Decorator):
+    def defines(self):
+        return [(self.node.name, False)] + super(Named, self).defines()
+
+    def render_fields(self, fields):
+        label = self.label()
+        fields.update(exp=self.rend_to(self.node.exp, label),
+                      label=label,
+                      name=self.string(self.node.name),
+                      fail=self.fail())
+
+    template = '''
+                PUSH - -
+                {exp}
+                {label}:
+                NAMED {name} {fail}
+                '''
+
+
+class NamedList(Named):
+    def defines(self):
+        return [(self.name, True)] + super(Named, self).defines()
+
+
+class Override(Named):
+    def defines(self):
+        return []
+
+
+class OverrideList(NamedList):
+    def defines(self):
+        return []
+
+
+class Special(Base):
+    template = ''
+
+
+class RuleRef(Base):
+    def render_fields(self, fields):
+        if self.node.name not in _program.rules:
+            raise CodegenError('rule %s not found' % self.node.name)
+        fields.update(rule=_program.rules[self.node.name], fail=self.fail())
+
+    template = 'CALL {rule} {fail}'
+
+
+class RuleInclude(_Decorator):
+    def render_fields(self, fields):
+        fields.update(exp=self.rend(self.node.rule.exp))
+
+    template = '''
+                {exp}
+                '''
+
+
+class Rule(_Decorator):
+    def body(self):
+        return self.node.exp
+
+    def rule_defines(self):
+        defines = compress_seq(self.defines())
+        sdefs = set(d for d, l in defines if not l)
+        ldefs = set(d for d, l in defines if l) - sdefs
+        # AST_DEFAULT is 0, AST_FORCELIST is 1.
+        defines = ['%d 0' % self.string(d) for d in sdefs]
+        defines += ['%d 1' % self.string(d) for d in ldefs]
+        return ' '.join([str(len(defines))] + defines)
+
+    def render_fields(self, fields):
+        done = self.label()
+        fields.update(exp=self.rend_to(self.body(), done),
+                      done=done)
+
+    # Rule names can't clash with the other labels.
+    template = '''
+                # rule {name}
+                @{name}:
+                {exp}
+                {done}:
+                RETURN - -
+                '''
+
+
+class BasedRule(Rule):
+    def defines(self):
+        return self.rhs.defines()
+
+    def body(self):
+        return self.rhs
+
+
+class Grammar(Base):
+    def render_fields(self, fields):
+        global _program
+        _program = Program(self.node.rules)
+        for rule in self.node.rules:
+            self.string(rule.name)
+
+        code = '\n'.join(
+            self.get_renderer(rule).render() for rule in self.node.rules
+        )
+        defines = [self.get_renderer(rule).rule_defines() for rule in self.node.rules]
+
+        # Resolve the labels.
+        labels = {}
+        instructions = []
+        for line in code.splitlines():
+            line = line.strip()
+            if not line:
+                continue
+            elif line.startswith('#'):
+                instructions.append(line)
+            elif line.endswith(':'):
+                labels[line[:-1]] = len([i for i in instructions if not i.startswith('#')])
+            else:
+                instructions.append(line)
+
+        def resolve(word):
+            return str(labels.get(word, word))
+
+        code = []
+        for instr in instructions:
+            if not instr.startswith('#'):
+                instr = ' '.join(resolve(w) for w in instr.split())
+            code.append(instr)
+        nr_code = len([i for i in code if not i.startswith('#')])
+
+        rules = [
+            '%d %d %s' % (self.string(rule.name), labels['@' + rule.name], d)
+            for rule, d in zip(self.node.rules, defines)
+        ]
+
+        if self.node.whitespace is not None:
+            whitespace = cpp_literal(self.node.whitespace)
+        else:
+            whitespace = 'default'
+
+        if self.node.nameguard is not None:
+            nameguard = '1' if self.node.nameguard else '0'
+        else:
+            nameguard = 'default'
+
+        version = str(tuple(int(n) for n in str(timestamp()).split('.')))
+
+        fields.update(version=cpp_literal(version),
+                      whitespace=whitespace,
+                      nameguard=nameguard,
+                      nr_strings=len(_program.strings),
+                      strings='\n'.join(cpp_literal(s) for s in _program.strings),
+                      nr_rules=len(rules),
+                      rules='\n'.join(rules),
+                      nr_code=nr_code,
+                      code='\n'.join(code))
+
+    template = '''\
+                # -*- coding: utf-8 -*-
+                # CAVEAT UTILITOR
+                #
+                # This file was automatically generated by Grako++.
+                # https://pypi.python.org/pypi/grakopp/
+                #
+                # Any changes you make to it will be overwritten the next time
+                # the file is generated.
+                grakopp-vm 1
+                grammar "{name}"
+                version {version}
+                whitespace {whitespace}
+                nameguard {nameguard}
+                strings {nr_strings}
+                {strings}
+                rules {nr_rules}
+                {rules}
+                code {nr_code}
+                {code}
+               '''
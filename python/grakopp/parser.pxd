@@ -15,12 +15,42 @@ from libcpp cimport bool
 from grakopp.buffer cimport BufferPtr
 from grakopp.ast cimport AstPtr
 
+from libc.stdint cimport uint64_t
+
+cdef extern from "grakopp/stats.hpp":
+    cdef cppclass ParserStats:
+        size_t _memo_entries
+        size_t _memo_high_water
+        size_t _failure_entries
+        size_t _failure_high_water
+        uint64_t _cut_dropped
+        uint64_t _evicted
+        size_t _memo_bytes
+        size_t _memo_bytes_high_water
+        size_t _ast_bytes
+        size_t _string_bytes
+        size_t _buffer_bytes
+        size_t _ast_nodes
+        bint _ast_counted
+        uint64_t _ast_allocated
+        uint64_t _ast_freed
+        uint64_t _ast_high_water
+
 cdef extern from "grakopp/parser.hpp":
     cdef cppclass Parser[semantics, state]:
         void set_buffer(const BufferPtr& buffer) nogil
         void set_whitespace(const string& whitespace) nogil
         void set_nameguard(bool nameguard) nogil
         void reset() nogil
+        void set_incremental(bool incremental) nogil
+        void set_deferred_semantics(bool deferred) nogil
+        void set_compact_failures(bool compact) nogil
+        void set_memo_budget(size_t entries, bool lru) nogil
+        void set_adaptive_memo(double min_hit_rate, size_t min_lookups) nogil
+        string profile_report(bool json) nogil
+        ParserStats stats() nogil
+        string stats_report(bool json) nogil
+        void edit(size_t offset, size_t removed, const string& inserted) nogil
         # AstPtr _error[T](string msg)
         # AstPtr _call(string name, semantics_func_t sem_func, function<AstPtr ()> func)
         # AstPtr _fail()
@@ -18,15 +18,19 @@ from __future__ import (absolute_import, division, print_function,
 
 import grako
 from . codegen.cpp import codegen as codegen_cpp
+from . codegen.cppflat import codegen as codegen_cppflat
 from . codegen.hpp import codegen as codegen_hpp
 from . codegen.pxd import codegen as codegen_pxd
 from . codegen.pyx import codegen as codegen_pyx
+from . codegen.vm import codegen as codegen_vm
 
 codegen = {
     'cpp': codegen_cpp,
+    'cpp-flat': codegen_cppflat,
     'hpp': codegen_hpp,
     'pxd': codegen_pxd,
-    'pyx': codegen_pyx
+    'pyx': codegen_pyx,
+    'vm': codegen_vm
 }
 
 # From grako.tool:
@@ -73,7 +77,7 @@ argparser.add_argument('-o', '--output',
                        help='output file (default is stdout)'
                        )
 argparser.add_argument('-t', '--trace',
-                       help='produce verbose parsing output',
+                       help='produce verbose parsing output, and record a trace in the generated parser',
                        action='store_true'
                        )
 argparser.add_argument('-w', '--whitespace',
@@ -132,6 +136,7 @@ def main():
         model.whitespace = whitespace
         model.nameguard = nameguard
         model.statetype = statetype
+        model.trace = trace
 
         renderer = args.format
         result = codegen[renderer](model)
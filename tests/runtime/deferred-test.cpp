@@ -0,0 +1,333 @@
+/* deferred-test.cpp - Grako++ deferred semantics test
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Parse with immediate and with deferred semantic actions, and
+   compare the ASTs.  The actions return every kind of node: the
+   results of the rules themselves (strings, lists, maps, mergeable
+   lists and empty nodes) and extensions.  Deferred actions must run
+   exactly once for each rule result in the final AST, and so less
+   often than immediate ones where the parser backtracks.  */
+
+#include <iostream>
+#include <sstream>
+
+#include <grakopp/grakopp.hpp>
+#include <grakopp/ast-io.hpp>
+
+
+class Number : public AstExtensionType
+{
+public:
+  Number(const std::string& text) : _value(std::stoi(text)) {}
+
+  int _value;
+
+  std::ostream& output(std::ostream& cout) const override
+  {
+    return cout << "\"number " << _value << "\"";
+  }
+};
+
+
+class TestSemantics
+{
+public:
+  TestSemantics() : _calls(0) {}
+
+  int _calls;
+
+  AstPtr identity(AstPtr& ast)
+  {
+    _calls++;
+    return ast;
+  }
+
+  AstPtr number(AstPtr& ast)
+  {
+    _calls++;
+    return std::make_shared<Ast>
+      (AstExtension(std::make_shared<Number>(*ast->as_string())));
+  }
+
+  AstPtr nothing(AstPtr&)
+  {
+    _calls++;
+    return std::make_shared<Ast>();
+  }
+};
+
+
+/* start = { statement }+ ;
+   statement = assign | range | call | empty ;
+   assign = name:word '=' value:value ';' ;
+   value = number ;
+   range = word '=' number '..' number ';' ;
+   call = word '(' args ')' ';' ;
+   args = number { ',' number }* ;
+   empty = ';' ;
+   word = /[a-z]+/ ;
+   number = /[0-9]+/ ;
+
+   where empty returns an empty node, number an extension, and the
+   other rules their result.  */
+class TestParser : public Parser<TestSemantics>
+{
+public:
+  TestParser(TestSemantics* semantics) : Parser<TestSemantics>(semantics) {}
+
+  AstPtr _start_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("start", &Semantics::identity, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _positive_closure([this] () {
+	    AstPtr ast = std::make_shared<Ast>();
+	    ast << _statement_(); RETURN_IF_EXC(ast);
+	    return ast;
+	  }); RETURN_IF_EXC(ast);
+	ast << _check_eof(); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _statement_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("statement", &Semantics::identity, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _choice([this] () {
+	    bool success = false;
+	    AstPtr ast = std::make_shared<Ast>();
+	    ast << _option(success, [this] () {
+		AstPtr ast = std::make_shared<Ast>();
+		ast << _assign_(); RETURN_IF_EXC(ast);
+		return ast;
+	      }); if (success) return ast;
+	    ast << _option(success, [this] () {
+		AstPtr ast = std::make_shared<Ast>();
+		ast << _range_(); RETURN_IF_EXC(ast);
+		return ast;
+	      }); if (success) return ast;
+	    ast << _option(success, [this] () {
+		AstPtr ast = std::make_shared<Ast>();
+		ast << _call_(); RETURN_IF_EXC(ast);
+		return ast;
+	      }); if (success) return ast;
+	    ast << _option(success, [this] () {
+		AstPtr ast = std::make_shared<Ast>();
+		ast << _empty_(); RETURN_IF_EXC(ast);
+		return ast;
+	      }); if (success) return ast;
+	    return _error<FailedParse>("no statement");
+	  }); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _assign_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("assign", &Semantics::identity, [this] () {
+	AstPtr ast = std::make_shared<Ast>
+	  (AstMap({
+	      { "name", AST_DEFAULT },
+	      { "value", AST_DEFAULT }
+	    }));
+	(*ast)["name"] << _word_(); RETURN_IF_EXC(ast);
+	ast << _token("="); RETURN_IF_EXC(ast);
+	(*ast)["value"] << _value_(); RETURN_IF_EXC(ast);
+	ast << _token(";"); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _value_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("value", &Semantics::identity, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _number_(); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _range_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("range", &Semantics::identity, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _word_(); RETURN_IF_EXC(ast);
+	ast << _token("="); RETURN_IF_EXC(ast);
+	ast << _number_(); RETURN_IF_EXC(ast);
+	ast << _token(".."); RETURN_IF_EXC(ast);
+	ast << _number_(); RETURN_IF_EXC(ast);
+	ast << _token(";"); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _call_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("call", &Semantics::identity, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _word_(); RETURN_IF_EXC(ast);
+	ast << _token("("); RETURN_IF_EXC(ast);
+	ast << _args_(); RETURN_IF_EXC(ast);
+	ast << _token(")"); RETURN_IF_EXC(ast);
+	ast << _token(";"); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _args_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("args", &Semantics::identity, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _number_(); RETURN_IF_EXC(ast);
+	ast << _closure([this] () {
+	    AstPtr ast = std::make_shared<Ast>();
+	    ast << _group([this] () {
+		AstPtr ast = std::make_shared<Ast>();
+		ast << _token(","); RETURN_IF_EXC(ast);
+		ast << _number_(); RETURN_IF_EXC(ast);
+		return ast;
+	      }); RETURN_IF_EXC(ast);
+	    return ast;
+	  }); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _empty_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("empty", &Semantics::nothing, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _token(";"); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _word_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("word", &Semantics::identity, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _pattern("[a-z]+"); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _number_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("number", &Semantics::number, [this] () {
+	AstPtr ast = std::make_shared<Ast>();
+	ast << _pattern("[0-9]+"); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+};
+
+
+/* Returns the printed ASTs, and sets CALLS to the number of semantic
+   calls in the last round.  The first round learns which rules need
+   eager actions, and parses again if it finds one, so it may make
+   more calls.  */
+static std::string parse(const std::string& text, bool deferred,
+			 int rounds, int& calls)
+{
+  TestSemantics semantics;
+  TestParser parser(&semantics);
+  parser.set_deferred_semantics(deferred);
+  std::ostringstream out;
+  for (int i = 0; i < rounds; i++)
+    {
+      BufferPtr buffer = std::make_shared<Buffer>();
+      buffer->from_string(text);
+      parser.set_buffer(buffer);
+      parser.reset();
+      semantics._calls = 0;
+      AstPtr ast = parser._start_();
+      if (ast->as_exception())
+	out << "failed\n";
+      else
+	out << *ast << "\n";
+    }
+  calls = semantics._calls;
+  return out.str();
+}
+
+
+int main()
+{
+  struct
+  {
+    const char *input;
+    /* The rule results in the AST, or -1 if the parse fails.  */
+    int kept;
+    /* Whether a rule succeeds and is then backtracked over.  */
+    bool backtracks;
+  } tests[] = {
+    { "a = 1;", 6, false },
+    { "f(1);", 6, false },
+    { "f(1, 2, 3);", 8, false },
+    { ";", 3, false },
+    { "a = 1; ; f(2, 3); b = 4; g(5);", 24, false },
+    { "a = 1..5;", 6, true },
+    { "a = 1; b = 2..3; c = 4..5; d = 6;", 21, true },
+    { "f(1, 2", -1, true },
+    { "a = ;", -1, false }
+  };
+  const int rounds = 2;
+  int failures = 0;
+  for (auto& test: tests)
+    {
+      int immediate_calls = 0;
+      int deferred_calls = 0;
+      std::string immediate = parse(test.input, false, rounds,
+				    immediate_calls);
+      std::string deferred = parse(test.input, true, rounds, deferred_calls);
+      if (immediate != deferred)
+	{
+	  std::cerr << "\"" << test.input << "\": immediate:\n" << immediate
+		    << "deferred:\n" << deferred;
+	  failures++;
+	}
+      if (test.kept >= 0 && deferred_calls != test.kept)
+	{
+	  std::cerr << "\"" << test.input << "\": " << deferred_calls
+		    << " deferred calls for " << test.kept
+		    << " rule results\n";
+	  failures++;
+	}
+      if (test.backtracks
+	  ? deferred_calls >= immediate_calls
+	  : deferred_calls > immediate_calls)
+	{
+	  std::cerr << "\"" << test.input << "\": " << deferred_calls
+		    << " deferred calls, " << immediate_calls
+		    << " immediate calls\n";
+	  failures++;
+	}
+    }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,234 @@
+/* record-test.cpp - Grako++ parallel record parsing test
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* The record boundary strategies, and parallel record parsing with
+   aligned, misaligned and missing boundary guesses, which the
+   stitching must repair, compared with a sequential parse.  Parses
+   are also started concurrently and from inside a pool task.  */
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <grakopp/grakopp.hpp>
+#include <grakopp/ast-io.hpp>
+#include <grakopp/parallel.hpp>
+
+
+/* record = name:word '=' ~ value:number ';' ;
+   word = /[a-z]+/ ;
+   number = /[0-9]+/ ;  */
+class RecordTestParser : public Parser<>
+{
+public:
+  AstPtr _record_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << _call("record", nullptr, [this] () {
+	AstPtr ast = std::make_shared<Ast>
+	  (AstMap({
+	      { "name", AST_DEFAULT },
+	      { "value", AST_DEFAULT }
+	    }));
+	(*ast)["name"] << _word_(); RETURN_IF_EXC(ast);
+	ast << _token("="); RETURN_IF_EXC(ast);
+	ast << _cut();
+	(*ast)["value"] << _number_(); RETURN_IF_EXC(ast);
+	ast << _token(";"); RETURN_IF_EXC(ast);
+	return ast;
+      }); RETURN_IF_EXC(ast);
+    return ast;
+  }
+
+  AstPtr _word_()
+  {
+    return _call("word", nullptr, [this] () {
+	return _pattern("[a-z]+");
+      });
+  }
+
+  AstPtr _number_()
+  {
+    return _call("number", nullptr, [this] () {
+	return _pattern("[0-9]+");
+      });
+  }
+};
+
+using RecordTest = RecordParser<RecordTestParser>;
+
+
+static int failures = 0;
+
+static void expect(const std::string& what, const std::string& result,
+		   const std::string& expected)
+{
+  if (result == expected)
+    return;
+  std::cerr << what << ": got\n" << result << "\nexpected\n" << expected
+	    << "\n";
+  failures++;
+}
+
+static void expect(const std::string& what, size_t result, size_t expected)
+{
+  expect(what, std::to_string(result), std::to_string(expected));
+}
+
+
+static std::string records(int count)
+{
+  std::ostringstream text;
+  for (int i = 0; i < count; i++)
+    text << std::string(1 + i % 7, 'a' + i % 26) << " = " << i * 37 << ";\n";
+  return text.str();
+}
+
+static BufferPtr buffer(const std::string& text)
+{
+  BufferPtr buffer = std::make_shared<Buffer>();
+  buffer->from_string(text);
+  return buffer;
+}
+
+static std::string print(const AstPtr& ast)
+{
+  std::ostringstream out;
+  out << *ast;
+  return out.str();
+}
+
+/* The records of TEXT, parsed one after the other.  */
+static std::string sequential(const std::string& text)
+{
+  RecordTestParser parser;
+  parser.set_buffer(buffer(text));
+  AstPtr list = std::make_shared<Ast>(AstList());
+  parser._buffer->next_token();
+  while (! parser._buffer->atend())
+    {
+      AstPtr ast = parser._record_();
+      if (ast->as_exception())
+	return print(ast);
+      list->the_list().push_back(ast);
+      parser._buffer->next_token();
+    }
+  return print(list);
+}
+
+static std::string parallel(WorkStealingPool& workers,
+			    record_boundary_t boundary,
+			    const std::string& text, size_t chunk_size)
+{
+  RecordTest parser(&RecordTestParser::_record_, boundary, workers,
+		    chunk_size);
+  return print(parser.parse(buffer(text)));
+}
+
+
+static void test_boundaries()
+{
+  Buffer text;
+  text.from_string("aa;bb;cc;dd");
+
+  record_boundary_t after = sync_token(";", true);
+  expect("token", after(text, 0, 11), 3);
+  expect("token before limit", after(text, 3, 6), std::string::npos);
+  expect("token at limit", after(text, 3, 7), 6);
+  record_boundary_t across = sync_token("b;c");
+  expect("token across limit", across(text, 0, 5), 4);
+  expect("token after limit", across(text, 0, 4), std::string::npos);
+
+  record_boundary_t pattern = sync_pattern(";+", true);
+  expect("pattern", pattern(text, 0, 11), 3);
+  expect("pattern before limit", pattern(text, 3, 6), std::string::npos);
+  expect("pattern at limit", pattern(text, 3, 7), 6);
+  expect("pattern at end", pattern(text, 9, 100), std::string::npos);
+
+  record_boundary_t cut = RecordTest::cut_boundary(&RecordTestParser::_record_);
+  Buffer spaced;
+  spaced.from_string("= 1; ab = 2;");
+  expect("cut", cut(spaced, 0, 12), 4);
+  expect("cut after limit", cut(spaced, 0, 4), std::string::npos);
+}
+
+
+static void test_stitching(WorkStealingPool& workers)
+{
+  std::string text = records(500);
+  std::string expected = sequential(text);
+  record_boundary_t guesses[] = {
+    /* Aligned.  */
+    sync_token(";", true),
+    /* Misaligned: the first record of each chunk starts in the
+       middle of a real record.  */
+    [] (const Buffer&, size_t pos, size_t) { return pos; },
+    sync_token("= "),
+    /* Missing: the stitching parses everything.  */
+    [] (const Buffer&, size_t, size_t) { return std::string::npos; }
+  };
+  int i = 0;
+  for (auto& boundary: guesses)
+    {
+      for (size_t chunk_size: { 1 << 20, 256, 100, 17 })
+	expect("records " + std::to_string(i) + " chunk size "
+	       + std::to_string(chunk_size),
+	       parallel(workers, boundary, text, chunk_size), expected);
+      i++;
+    }
+
+  expect("empty", parallel(workers, sync_token(";", true), "", 16), "[]");
+
+  std::string bad = records(50) + "oops;\n" + records(50);
+  expect("failure", parallel(workers, sync_token(";", true), bad, 64),
+	 sequential(bad));
+}
+
+
+/* Parses that share the pool finish independently, and a task of the
+   pool may run a parse itself.  */
+static void test_concurrency(WorkStealingPool& workers)
+{
+  std::string text = records(300);
+  std::string expected = sequential(text);
+
+  std::vector<std::string> results(4);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < results.size(); i++)
+    threads.emplace_back([&workers, &text, &results, i] () {
+	results[i] = parallel(workers, sync_token(";", true), text, 50 + i);
+      });
+  for (auto& thread: threads)
+    thread.join();
+  for (auto& result: results)
+    expect("concurrent", result, expected);
+
+  WorkStealingPool::Batch batch;
+  std::vector<std::string> nested(2 * workers.threads());
+  for (size_t i = 0; i < nested.size(); i++)
+    workers.submit(batch, [&workers, &text, &nested, i] () {
+	nested[i] = parallel(workers, sync_token(";", true), text, 64);
+      });
+  workers.wait(batch);
+  for (auto& result: nested)
+    expect("nested", result, expected);
+}
+
+
+int main()
+{
+  test_boundaries();
+  for (unsigned int threads: { 1, 4 })
+    {
+      WorkStealingPool workers(threads);
+      test_stitching(workers);
+      test_concurrency(workers);
+    }
+  return failures ? 1 : 0;
+}
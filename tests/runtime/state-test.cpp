@@ -0,0 +1,128 @@
+/* state-test.cpp - Grako++ parser state test
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Parsers with persistent states, with and without a hash.  That the
+   parsers compile is the main test.  */
+
+#include <iostream>
+#include <set>
+
+#include <grakopp/grakopp.hpp>
+#include <grakopp/ast-io.hpp>
+
+
+static_assert(memo_hashable<SharedState<int> >::value,
+	      "SharedState<int> has a hash");
+static_assert(memo_hashable<PersistentStack<int> >::value,
+	      "PersistentStack<int> has a hash");
+static_assert(! memo_hashable<SharedState<std::set<int> > >::value,
+	      "SharedState<std::set<int> > has no hash");
+
+
+/* items = { item }* ;  item = /[a-z]+/ ; where item adds the word to
+   the state, and fails if it was there already.  */
+template <typename State>
+class WordParser : public Parser<NoSemantics, State>
+{
+public:
+  AstPtr _items_()
+  {
+    AstPtr ast = std::make_shared<Ast>();
+    ast << this->_call("items", nullptr, [this] () {
+	return this->_closure([this] () {
+	    return _item_();
+	  });
+      });
+    return ast;
+  }
+
+  AstPtr _item_()
+  {
+    return this->_call("item", nullptr, [this] () {
+	AstPtr ast = this->_pattern("[a-z]+");
+	if (ast->as_exception())
+	  return ast;
+	if (! add(this->_state, *ast->as_string()))
+	  return this->template _error<FailedSemantics>("duplicate word");
+	return ast;
+      });
+  }
+
+private:
+  static bool add(SharedState<std::set<std::string> >& state,
+		  const std::string& word)
+  {
+    if (state->count(word))
+      return false;
+    state.modify().insert(word);
+    return true;
+  }
+
+  static bool add(SharedState<std::string>& state, const std::string& word)
+  {
+    std::string words = " " + state.get() + " ";
+    if (words.find(" " + word + " ") != std::string::npos)
+      return false;
+    state.modify() += " " + word;
+    return true;
+  }
+};
+
+
+template <typename State>
+static int check(const char *name)
+{
+  int failures = 0;
+  const char *inputs[] = { "one two three", "one two one" };
+  const size_t expected[] = { 3, 2 };
+  for (int i = 0; i < 2; i++)
+    {
+      BufferPtr buffer = std::make_shared<Buffer>();
+      buffer->from_string(inputs[i]);
+      WordParser<State> parser;
+      parser.set_buffer(buffer);
+      AstPtr ast = parser._items_();
+      AstList *list = ast->as_list();
+      size_t length = list ? list->size() : 0;
+      if (length != expected[i])
+	{
+	  std::cerr << name << ": \"" << inputs[i] << "\" gave " << *ast << "\n";
+	  failures++;
+	}
+    }
+  return failures;
+}
+
+
+int main()
+{
+  int failures = 0;
+
+  /* The hash is kept with the value, and must follow changes.  */
+  SharedState<std::string> state("one");
+  SharedState<std::string> copy = state;
+  std::hash<SharedState<std::string> >()(state);
+  state.modify() += " two";
+  if (std::hash<SharedState<std::string> >()(state) != std::hash<std::string>()("one two")
+      || std::hash<SharedState<std::string> >()(copy) != std::hash<std::string>()("one"))
+    {
+      std::cerr << "stale hash of SharedState\n";
+      failures++;
+    }
+  state.modify() += " three";
+  if (std::hash<SharedState<std::string> >()(state) != std::hash<std::string>()("one two three"))
+    {
+      std::cerr << "stale hash of SharedState after modify\n";
+      failures++;
+    }
+
+  failures += check<SharedState<std::set<std::string> > >("std::set");
+  failures += check<SharedState<std::string> >("std::string");
+  return failures ? 1 : 0;
+}
@@ -1,27 +1,20 @@
-#include <fstream>
-
 #include <grakopp/grakopp.hpp>
-#include <grakopp/ast-io.hpp>
+#include <grakopp/ast-binary.hpp>
 
 int main(int argc, char *argv[])
 {
-  std::ifstream file1;
-  std::ifstream file2;
-
-  file1.open(argv[1]);
-  file2.open(argv[2]);
-
-  AstPtr ast1 = std::make_shared<Ast>();
-  AstPtr ast2 = std::make_shared<Ast>();
+  AstPtr ast1;
+  AstPtr ast2;
 
   try
     {
-      file1 >> std::noskipws >> std::ws >> ast1;
-      file2 >> std::noskipws >> std::ws >> ast2;
+      ast1 = read_ast_file(argv[1]);
+      ast2 = read_ast_file(argv[2]);
     }
   catch (const std::invalid_argument& exc)
     {
       std::cout << "ERROR: " << exc.what() << "\n";
+      return 1;
     }
 
   return ast1 == ast2 ? 0 : 1;
@@ -0,0 +1,169 @@
+/* grakopp-trace.cpp - Decode a parse trace
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Usage: grakopp-trace [--chrome] TRACE
+
+   Print a trace written by TraceBuffer::write (for example with the
+   --trace option of the generated main programs), one event per line
+   and indented by rule depth.  With --chrome, write it in the Chrome
+   trace event format instead (for chrome://tracing or Perfetto).  The
+   trace has no clock, so the timestamps are the event numbers.  */
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <grakopp/trace.hpp>
+
+static const char *kind_names[] = {
+  "call", "return", "memo", "token", "pattern", "cut"
+};
+
+static std::string
+json_string(const std::string& str)
+{
+  std::string result = "\"";
+  for (char chr: str)
+    {
+      if (chr == '"' || chr == '\\')
+	{
+	  result += '\\';
+	  result += chr;
+	}
+      else if (static_cast<unsigned char>(chr) < 0x20)
+	{
+	  char buf[8];
+	  snprintf(buf, sizeof(buf), "\\u%04x", chr);
+	  result += buf;
+	}
+      else
+	result += chr;
+    }
+  return result + "\"";
+}
+
+static std::string
+outcome(const TraceEvent& event)
+{
+  switch (event._kind)
+    {
+    case TraceEvent::CALL:
+    case TraceEvent::CUT:
+      return "";
+    default:
+      if (event._flags & TraceEvent::OK)
+	return " ok";
+      if (event._flags & TraceEvent::CUT_FAILURE)
+	return " failed after cut";
+      return " failed";
+    }
+}
+
+static void
+print_text(const std::vector<std::string>& names,
+	   const std::vector<TraceEvent>& events, uint64_t dropped)
+{
+  if (dropped)
+    std::cout << "# " << dropped << " older events dropped\n";
+  for (const TraceEvent& event: events)
+    {
+      char pos[24];
+      snprintf(pos, sizeof(pos), "%10llu ",
+	       static_cast<unsigned long long>(event._pos));
+      std::cout << pos << std::string(2 * event._depth, ' ')
+		<< kind_names[event._kind];
+      if (event._kind == TraceEvent::TOKEN
+	  || event._kind == TraceEvent::PATTERN)
+	std::cout << " " << json_string(names[event._id]);
+      else if (event._kind != TraceEvent::CUT)
+	std::cout << " " << names[event._id];
+      std::cout << outcome(event) << "\n";
+    }
+}
+
+static void
+print_chrome(const std::vector<std::string>& names,
+	     const std::vector<TraceEvent>& events)
+{
+  std::cout << "{\"traceEvents\": [";
+  const char *sep = "\n";
+  uint64_t ts = 0;
+  for (const TraceEvent& event: events)
+    {
+      const char *phase = "i";
+      if (event._kind == TraceEvent::CALL)
+	phase = "B";
+      else if (event._kind == TraceEvent::RETURN)
+	phase = "E";
+      std::string name = event._kind == TraceEvent::CUT ? "cut"
+	: names[event._id];
+      if (event._kind == TraceEvent::TOKEN
+	  || event._kind == TraceEvent::PATTERN
+	  || event._kind == TraceEvent::MEMO_HIT)
+	name = std::string(kind_names[event._kind]) + " " + name;
+
+      std::cout << sep << "  {\"name\": " << json_string(name)
+		<< ", \"ph\": \"" << phase << "\"";
+      if (*phase == 'i')
+	std::cout << ", \"s\": \"t\"";
+      std::cout << ", \"ts\": " << ts++ << ", \"pid\": 1, \"tid\": 1"
+		<< ", \"args\": {\"pos\": " << event._pos;
+      if (event._kind != TraceEvent::CALL && event._kind != TraceEvent::CUT)
+	std::cout << ", \"ok\": "
+		  << ((event._flags & TraceEvent::OK) ? "true" : "false");
+      std::cout << "}}";
+      sep = ",\n";
+    }
+  std::cout << "\n]}\n";
+}
+
+int main(int argc, char *argv[])
+{
+  std::list<std::string> args(argv + 1, argv + argc);
+  bool chrome = false;
+
+  if (args.size() > 0 && args.front() == "--chrome")
+    {
+      args.pop_front();
+      chrome = true;
+    }
+  if (args.size() != 1)
+    {
+      std::cerr << "Usage: grakopp-trace [--chrome] TRACE\n";
+      return 2;
+    }
+
+  std::vector<std::string> names;
+  std::vector<TraceEvent> events;
+  uint64_t dropped;
+  try
+    {
+      std::ifstream file(args.front(), std::ios::binary);
+      if (! file)
+	throw std::invalid_argument("can not open " + args.front());
+      TraceBuffer::read(file, names, events, dropped);
+      for (const TraceEvent& event: events)
+	if (event._kind > TraceEvent::CUT)
+	  throw std::invalid_argument("unknown event");
+    }
+  catch (const std::exception& exc)
+    {
+      std::cerr << "ERROR: reading trace: " << exc.what() << "\n";
+      return 2;
+    }
+
+  if (chrome)
+    print_chrome(names, events);
+  else
+    print_text(names, events, dropped);
+  return 0;
+}
@@ -0,0 +1,87 @@
+/* grakopp-vm.cpp - Run a grammar compiled with grakopp -f vm
+   Copyright (C) 2014 semantics Kommunikationsmanagement GmbH
+   Written by Marcus Brinkmann <m.brinkmann@semantics.de>
+
+   This file is part of Grako++.  Grako++ is free software; you can
+   redistribute it and/or modify it under the terms of the 2-clause
+   BSD license, see file LICENSE.TXT.
+*/
+
+/* Usage: grakopp-vm [--test FILE] PROGRAM INPUT STARTRULE
+
+   This works like the main program of the generated parsers, but the
+   grammar is loaded at runtime.  */
+
+#include <list>
+
+#include <grakopp/vm.hpp>
+#include <grakopp/ast-io.hpp>
+
+int main(int argc, char *argv[])
+{
+  std::ios_base::sync_with_stdio(false);
+
+  int result = 0;
+  std::list<std::string> args(argv + 1, argv + argc);
+  bool validate = false;
+  std::string validate_file;
+
+  if (args.size() > 0 && args.front() == "--test")
+    {
+      args.pop_front();
+      validate = true;
+      validate_file = args.front();
+      args.pop_front();
+    }
+  if (args.size() != 3)
+    {
+      std::cerr << "Usage: grakopp-vm [--test FILE] PROGRAM INPUT STARTRULE\n";
+      return 2;
+    }
+
+  std::shared_ptr<VmProgram> program = std::make_shared<VmProgram>();
+  try
+    {
+      program->load_file(args.front());
+      args.pop_front();
+    }
+  catch (const std::exception& exc)
+    {
+      std::cerr << "ERROR: loading program: " << exc.what() << "\n";
+      return 2;
+    }
+
+  BufferPtr buf = std::make_shared<Buffer>();
+  VmParser parser(program);
+
+  buf->from_file(args.front());
+  args.pop_front();
+  parser.set_buffer(buf);
+
+  try
+    {
+      AstPtr ast = parser.parse_rule(args.front());
+      std::cout << *ast << "\n";
+      AstException *exc = ast->as_exception();
+      if (exc)
+	exc->_exc->_throw();
+
+      if (validate)
+	{
+	  AstPtr validate_ast = read_json_file(validate_file);
+	  if (ast != validate_ast)
+	    result = 1;
+	}
+    }
+  catch (FailedParseBase& exc)
+    {
+      std::cerr << "ERROR: " << exc << "\n";
+    }
+  catch (const std::invalid_argument& exc)
+    {
+      std::cerr << "ERROR: parsing test file: " << exc.what() << "\n";
+      result = 2;
+    }
+
+  return result;
+}